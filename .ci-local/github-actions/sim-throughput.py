@@ -0,0 +1,79 @@
+#!/usr/bin/env python
+
+'''
+Start the SPiiPlus simulator with a network latency and check the poll and
+profile throughput that SPiiPlusBench measures against it.
+'''
+
+import glob
+import os
+import subprocess
+import sys
+import time
+
+# Setup ANSI Colors (copied from cue.py)
+ANSI_RED = "\033[31;1m"
+ANSI_GREEN = "\033[32;1m"
+ANSI_BLUE = "\033[34;1m"
+ANSI_RESET = "\033[0m"
+
+PORT = 7010
+AXES = 8
+# Delay of each reply, in ms; 1 ms is a typical round trip to a controller
+LATENCY_MS = 1.0
+# A fast-tier poll is 5 round trips, so the rate can't exceed 1000 / (5 * LATENCY_MS)
+MIN_POLL_RATE = 50.0
+# The profile must be executed at 90% of its nominal rate or better (no buffer starvation)
+PROFILE_POINTS = 500
+SEGMENT_MS = 5
+MIN_POINT_RATE = 0.9 * 1000.0 / SEGMENT_MS
+
+def find_program(name):
+    '''
+    Find a host program built by the main module
+    '''
+    arch = os.environ.get('EPICS_HOST_ARCH', '*')
+    for pattern in (name, name + '.exe'):
+        matches = sorted(glob.glob(os.path.join('bin', arch, pattern)))
+        if matches:
+            return matches[0]
+    return None
+
+def run_bench(bench, args):
+    print("{}{}{}".format(ANSI_BLUE, ' '.join([bench] + args), ANSI_RESET))
+    sys.stdout.flush()
+    return subprocess.call([bench] + args)
+
+def main():
+    sim = find_program('SPiiPlusSim')
+    bench = find_program('SPiiPlusBench')
+    if (sim is None) or (bench is None):
+        print("{}SPiiPlusSim and SPiiPlusBench weren't built{}".format(ANSI_RED, ANSI_RESET))
+        return 1
+
+    proc = subprocess.Popen([sim, '-p', str(PORT), '-n', str(AXES), '-l', str(LATENCY_MS)],
+                            stdout=subprocess.PIPE, universal_newlines=True)
+    try:
+        # The simulator prints a line when it is listening
+        print(proc.stdout.readline().strip())
+        time.sleep(0.5)
+
+        address = 'localhost:{}'.format(PORT)
+        failures = 0
+        if run_bench(bench, ['-a', address, '-n', str(AXES), '-t', '5', '-r', str(MIN_POLL_RATE), 'poll']) != 0:
+            failures += 1
+        if run_bench(bench, ['-a', address, '-P', str(PROFILE_POINTS), '-T', str(SEGMENT_MS), '-r', str(MIN_POINT_RATE), 'profile']) != 0:
+            failures += 1
+    finally:
+        proc.kill()
+        proc.wait()
+
+    if failures:
+        print("{}Simulator throughput checks failed: {}{}".format(ANSI_RED, failures, ANSI_RESET))
+        return 1
+
+    print("{}Simulator throughput checks passed{}".format(ANSI_GREEN, ANSI_RESET))
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,624 @@
+/*
+ * SPiiPlusBench: host benchmarks of the code the driver uses to talk to a SPiiPlus controller,
+ * and of the throughput of a controller (or of SPiiPlusSim) with the driver's queries.
+ *
+ * Usage: SPiiPlusBench [-a address] [-n axes] [-i iterations] [-t seconds] [-P points] [-T segment_ms] [-s samples] [-r min_rate] mode
+ *
+ *   encoder   compare the cost of encoding a poll query with std::stringstream (the original
+ *             encoder), with formatArrayVar, and with a lookup in a frame cache
+ *   poll      send the binary queries of a fast-tier poll (APOS, FPOS, FVEL, AST, MST) repeatedly
+ *             and report the poll rate
+ *   profile   run a PATH motion of axes 0 and 1, feeding POINT commands as GSFREE allows like the
+ *             driver does, and report the rate at which the points were executed
+ *   readback  read the two rows of a data collection array the way the driver does (column chunks
+ *             of at most 64 KB, pipelined slices) for a range of sample counts and report MB/s
+ *
+ * The poll and profile modes exit with status 2 when the rate is below the minimum rate, so they
+ * can be used as throughput checks (see .ci-local/github-actions/sim-throughput.py).
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsGetopt.h>
+#include <osiSock.h>
+
+#include "SPiiPlusBinComm.h"
+
+#ifndef MIN
+#define MIN(a,b) ((a)<(b)?(a):(b))
+#endif
+
+#define BENCH_DEFAULT_ITERATIONS	100000
+#define BENCH_DEFAULT_AXES		8
+#define BENCH_DEFAULT_ADDRESS		"localhost:701"
+#define BENCH_DEFAULT_SECONDS		5.0
+#define BENCH_DEFAULT_POINTS		500
+#define BENCH_DEFAULT_SEGMENT_MS	10
+// The longest ASCII reply that is accepted
+#define BENCH_MAX_LINE			4096
+// How long to wait for a profile to finish, beyond its duration
+#define BENCH_PROFILE_TIMEOUT		10.0
+#define BENCH_DEFAULT_SAMPLES		100000
+// The array read by the readback benchmark, which is deleted afterwards
+#define BENCH_READBACK_VAR		"EPICS_BENCH_DATA"
+// The query size and the number of queries per write of SPiiPlusComm::getDoubleArrays
+#define BENCH_READ_CHUNK_BYTES		65536
+#define BENCH_READ_PIPELINE_DEPTH	16
+
+static void usage()
+{
+	fprintf(stderr, "Usage: SPiiPlusBench [-a address] [-n axes] [-i iterations] [-t seconds] [-P points] [-T segment_ms] [-s samples] [-r min_rate] mode\n");
+	fprintf(stderr, "  mode                 encoder, poll, profile or readback\n");
+	fprintf(stderr, "  -a address           host:port of the controller or simulator (default %s)\n", BENCH_DEFAULT_ADDRESS);
+	fprintf(stderr, "  -n axes              number of axes in the poll queries (default %i)\n", BENCH_DEFAULT_AXES);
+	fprintf(stderr, "  -i iterations        encodes per encoder (default %i)\n", BENCH_DEFAULT_ITERATIONS);
+	fprintf(stderr, "  -t seconds           duration of the poll benchmark (default %.0f)\n", BENCH_DEFAULT_SECONDS);
+	fprintf(stderr, "  -P points            number of profile points (default %i)\n", BENCH_DEFAULT_POINTS);
+	fprintf(stderr, "  -T segment_ms        profile segment time (default %i)\n", BENCH_DEFAULT_SEGMENT_MS);
+	fprintf(stderr, "  -s samples           largest readback sample count (default %i)\n", BENCH_DEFAULT_SAMPLES);
+	fprintf(stderr, "  -r min_rate          minimum polls or points per second (default 0, no check)\n");
+}
+
+static SOCKET connectController(const char *address)
+{
+	struct sockaddr_in addr;
+	SOCKET sock;
+	int flag;
+
+	if (osiSockAttach() == 0)
+	{
+		fprintf(stderr, "Unable to initialize the socket library\n");
+		return INVALID_SOCKET;
+	}
+
+	if (aToIPAddr(address, 701, &addr) != 0)
+	{
+		fprintf(stderr, "Invalid address: %s\n", address);
+		return INVALID_SOCKET;
+	}
+
+	sock = epicsSocketCreate(AF_INET, SOCK_STREAM, 0);
+	if (sock == INVALID_SOCKET)
+	{
+		fprintf(stderr, "Unable to create a socket\n");
+		return INVALID_SOCKET;
+	}
+
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+	{
+		fprintf(stderr, "Unable to connect to %s\n", address);
+		epicsSocketDestroy(sock);
+		return INVALID_SOCKET;
+	}
+
+	flag = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(flag));
+
+	return sock;
+}
+
+static bool sendAll(SOCKET sock, const char *data, int numBytes)
+{
+	int nsent;
+
+	while (numBytes > 0)
+	{
+		nsent = send(sock, data, numBytes, 0);
+		if (nsent <= 0) return false;
+		data += nsent;
+		numBytes -= nsent;
+	}
+	return true;
+}
+
+static bool recvAll(SOCKET sock, char *data, int numBytes)
+{
+	int nread;
+
+	while (numBytes > 0)
+	{
+		nread = recv(sock, data, numBytes, 0);
+		if (nread <= 0) return false;
+		data += nread;
+		numBytes -= nread;
+	}
+	return true;
+}
+
+/*
+ * Send an ASCII command or query and read the reply (up to the carriage return).
+ * Returns false if the connection failed or the controller replied with an error.
+ */
+static bool writeRead(SOCKET sock, const std::string& command, std::string& reply)
+{
+	std::string line = command + "\r";
+	char c;
+
+	if (!sendAll(sock, line.data(), (int)line.size())) return false;
+
+	reply.clear();
+	while (true)
+	{
+		if (!recvAll(sock, &c, 1)) return false;
+		if (c == '\r') break;
+		if ((c != '\n') && (reply.size() < BENCH_MAX_LINE)) reply += c;
+	}
+
+	if (!reply.empty() && (reply[0] == '?'))
+	{
+		fprintf(stderr, "%s: error %s\n", command.c_str(), reply.c_str()+1);
+		return false;
+	}
+	return true;
+}
+
+static bool writeReadDouble(SOCKET sock, const std::string& query, double *value)
+{
+	std::string reply;
+
+	if (!writeRead(sock, query, reply)) return false;
+	*value = atof(reply.c_str());
+	return true;
+}
+
+/*
+ * Read var(idx1start,idx1end)(idx2start,idx2end) with the binary read commands the driver uses,
+ * including the slices of long arrays.  output receives the data in row-major order.
+ */
+static bool readArray(SOCKET sock, const char *var, int dataSize, int idx1start, int idx1end, int idx2start, int idx2end, char *output)
+{
+	char command[MAX_MESSAGE_LEN];
+	char packet[MAX_PACKET_SIZE];
+	unsigned char header[4];
+	char trailer;
+	int outBytes, inBytes, dataBytes;
+	int replyBytes;
+	int slice = 0;
+	bool sliceAvailable = true;
+
+	while (sliceAvailable)
+	{
+		if (dataSize == DOUBLE_DATA_SIZE)
+		{
+			if (slice == 0)
+				readFloat64ArrayCmd(command, var, idx1start, idx1end, idx2start, idx2end, &outBytes, &inBytes, &dataBytes);
+			else
+				readFloat64SliceCmd(command, slice, var, idx1start, idx1end, idx2start, idx2end, &outBytes, &inBytes, &dataBytes);
+		}
+		else
+		{
+			if (slice == 0)
+				readInt32ArrayCmd(command, var, idx1start, idx1end, idx2start, idx2end, &outBytes, &inBytes, &dataBytes);
+			else
+				readInt32SliceCmd(command, slice, var, idx1start, idx1end, idx2start, idx2end, &outBytes, &inBytes, &dataBytes);
+		}
+
+		if (!sendAll(sock, command, outBytes)) return false;
+
+		// [E3][cmd][len LSB][len MSB, with SLICE_AVAILABLE when there are more slices] data [E6]
+		if (!recvAll(sock, (char *)header, 4)) return false;
+		replyBytes = header[2] | ((header[3] & ~SLICE_AVAILABLE) << 8);
+		sliceAvailable = (header[3] & SLICE_AVAILABLE) != 0;
+		if ((replyBytes > MAX_PACKET_DATA) || !recvAll(sock, packet, replyBytes) || !recvAll(sock, &trailer, 1)) return false;
+
+		if ((replyBytes == 6) && (packet[0] == '?') && (dataBytes != 6))
+		{
+			fprintf(stderr, "%s: error %.4s\n", var, packet+1);
+			return false;
+		}
+
+		memcpy(output, packet, replyBytes);
+		output += replyBytes;
+		slice++;
+	}
+	return true;
+}
+
+/*
+ * The fast tier of the driver's per-variable polling (see SPiiPlusController::pollVariables)
+ */
+static int benchmarkPoll(const char *address, int numAxes, double seconds, double minRate)
+{
+	std::vector <double> doubles(numAxes);
+	std::vector <epicsInt32> ints(numAxes);
+	epicsTimeStamp start, now;
+	double elapsed = 0.0;
+	double rate;
+	long polls = 0;
+	SOCKET sock;
+
+	sock = connectController(address);
+	if (sock == INVALID_SOCKET) return 1;
+
+	epicsTimeGetCurrent(&start);
+	while (elapsed < seconds)
+	{
+		if (!readArray(sock, "APOS", DOUBLE_DATA_SIZE, 0, numAxes-1, 0, 0, (char *)&doubles[0]) ||
+		    !readArray(sock, "FPOS", DOUBLE_DATA_SIZE, 0, numAxes-1, 0, 0, (char *)&doubles[0]) ||
+		    !readArray(sock, "FVEL", DOUBLE_DATA_SIZE, 0, numAxes-1, 0, 0, (char *)&doubles[0]) ||
+		    !readArray(sock, "AST", INT_DATA_SIZE, 0, numAxes-1, 0, 0, (char *)&ints[0]) ||
+		    !readArray(sock, "MST", INT_DATA_SIZE, 0, numAxes-1, 0, 0, (char *)&ints[0]))
+		{
+			fprintf(stderr, "Poll failed\n");
+			epicsSocketDestroy(sock);
+			return 1;
+		}
+		polls++;
+		epicsTimeGetCurrent(&now);
+		elapsed = epicsTimeDiffInSeconds(&now, &start);
+	}
+	epicsSocketDestroy(sock);
+
+	rate = polls / elapsed;
+	printf("poll: %li polls of %i axes in %.2f s: %.1f polls/s, %.3f ms/poll\n", polls, numAxes, elapsed, rate, elapsed / polls * 1000.0);
+
+	if (rate < minRate)
+	{
+		printf("poll: FAILED, less than %.1f polls/s\n", minRate);
+		return 2;
+	}
+	return 0;
+}
+
+/*
+ * Run a PATH motion of axes 0 and 1 that moves back and forth, sending POINT commands
+ * whenever there is room in the point buffer, like the driver's profile thread does.
+ * The points are executed at the nominal rate only if they are sent fast enough.
+ */
+static int benchmarkProfile(const char *address, int numPoints, int segmentMs, double minRate)
+{
+	std::stringstream cmd;
+	std::string reply;
+	epicsTimeStamp start, now;
+	double freeSlots, motorStatus;
+	double elapsed, rate, nominalRate;
+	double position;
+	int sent = 0;
+	int i, count;
+	bool started = false;
+	SOCKET sock;
+
+	sock = connectController(address);
+	if (sock == INVALID_SOCKET) return 1;
+
+	if (!writeRead(sock, "PATH/w (0,1)", reply))
+	{
+		epicsSocketDestroy(sock);
+		return 1;
+	}
+
+	while (sent < numPoints)
+	{
+		if (!writeReadDouble(sock, "?GSFREE(0)", &freeSlots)) break;
+
+		count = (int)freeSlots;
+		if (count > numPoints - sent) count = numPoints - sent;
+		for (i=0; i<count; i++, sent++)
+		{
+			position = ((sent / 100) % 2) ? (100 - sent % 100) * 0.01 : (sent % 100) * 0.01;
+			cmd.str("");
+			cmd << "POINT (0,1), " << position << ", " << -position << ", " << segmentMs;
+			if (!writeRead(sock, cmd.str(), reply)) break;
+		}
+		if (i < count) break;
+
+		if (!started)
+		{
+			// Start the motion once the buffer is full
+			if (!writeRead(sock, "GO (0,1)", reply)) break;
+			epicsTimeGetCurrent(&start);
+			started = true;
+		}
+		else if (count == 0)
+		{
+			epicsThreadSleep(segmentMs / 1000.0);
+		}
+	}
+
+	if ((sent < numPoints) || !writeRead(sock, "ENDS (0,1)", reply))
+	{
+		fprintf(stderr, "profile: failed after %i points\n", sent);
+		epicsSocketDestroy(sock);
+		return 1;
+	}
+
+	// Wait for the motion to end
+	while (true)
+	{
+		if (!writeReadDouble(sock, "?MST(0)", &motorStatus))
+		{
+			epicsSocketDestroy(sock);
+			return 1;
+		}
+		epicsTimeGetCurrent(&now);
+		elapsed = epicsTimeDiffInSeconds(&now, &start);
+		if (((int)motorStatus & (1<<5)) == 0) break;
+		if (elapsed > numPoints * segmentMs / 1000.0 + BENCH_PROFILE_TIMEOUT)
+		{
+			fprintf(stderr, "profile: the motion didn't end\n");
+			epicsSocketDestroy(sock);
+			return 1;
+		}
+		epicsThreadSleep(0.001);
+	}
+	epicsSocketDestroy(sock);
+
+	rate = numPoints / elapsed;
+	nominalRate = 1000.0 / segmentMs;
+	printf("profile: %i points of %i ms in %.2f s: %.1f points/s (nominal %.1f points/s)\n", numPoints, segmentMs, elapsed, rate, nominalRate);
+
+	if (rate < minRate)
+	{
+		printf("profile: FAILED, less than %.1f points/s\n", minRate);
+		return 2;
+	}
+	return 0;
+}
+
+static void benchmarkEncoder(int iterations, int numAxes)
+{
+	char command[MAX_MESSAGE_LEN];
+	binaryFrame_t cache[1];
+	binaryFrame_t *frame;
+	int cacheSize = 0;
+	int i;
+	long len = 0;
+	epicsTimeStamp start, end;
+	double streamTime, formatTime, cacheTime;
+
+	epicsTimeGetCurrent(&start);
+	for (i=0; i<iterations; i++)
+	{
+		std::stringstream varst;
+		varst << "APOS" << "(" << 0 << "," << (numAxes-1) << ")(" << 0 << "," << 0 << ")";
+		strncpy(command+8, varst.str().c_str(), varst.str().size());
+		len += varst.str().size();
+	}
+	epicsTimeGetCurrent(&end);
+	streamTime = epicsTimeDiffInSeconds(&end, &start);
+
+	epicsTimeGetCurrent(&start);
+	for (i=0; i<iterations; i++)
+	{
+		len += formatArrayVar(command+8, "APOS", 0, numAxes-1, 0, 0);
+	}
+	epicsTimeGetCurrent(&end);
+	formatTime = epicsTimeDiffInSeconds(&end, &start);
+
+	epicsTimeGetCurrent(&start);
+	for (i=0; i<iterations; i++)
+	{
+		frame = findReadArrayFrame(cache, &cacheSize, 1, "APOS", DOUBLE_DATA_SIZE, 0, numAxes-1, 0, 0);
+		memcpy(command, frame->frame, frame->outBytes);
+		len += frame->outBytes;
+	}
+	epicsTimeGetCurrent(&end);
+	cacheTime = epicsTimeDiffInSeconds(&end, &start);
+
+	printf("%i encodes (%li bytes): stringstream = %.1f ns, formatArrayVar = %.1f ns, frame cache = %.1f ns\n",
+	       iterations, len, (streamTime / iterations * 1e9), (formatTime / iterations * 1e9), (cacheTime / iterations * 1e9));
+}
+
+// One binary query of readRows: a slice of a column chunk
+typedef struct {
+	int chunkStart;
+	int chunkEnd;
+	int slice;
+} benchPacket_t;
+
+/*
+ * Read rows 0 and 1 of var(0,1)(0,numCols-1) into rows[0] and rows[1] like
+ * SPiiPlusComm::getDoubleArrays: the columns are queried in chunks of at most
+ * BENCH_READ_CHUNK_BYTES, and the slices of BENCH_READ_PIPELINE_DEPTH queries are
+ * sent in a single write before their replies are read.
+ */
+static bool readRows(SOCKET sock, const char *var, int numCols, double **rows)
+{
+	const int numRows = 2;
+	char command[MAX_MESSAGE_LEN];
+	char packet[MAX_PACKET_SIZE];
+	unsigned char header[4];
+	std::vector <benchPacket_t> packets;
+	std::string output;
+	benchPacket_t p;
+	int outBytes, inBytes, dataBytes;
+	int chunkCols, chunkWidth, chunkBytes, replyBytes;
+	int element, numValues, row, col;
+	size_t first, last, i;
+
+	chunkCols = BENCH_READ_CHUNK_BYTES / (numRows * DOUBLE_DATA_SIZE);
+	for (p.chunkStart = 0; p.chunkStart < numCols; p.chunkStart += chunkCols)
+	{
+		p.chunkEnd = p.chunkStart + chunkCols - 1;
+		if (p.chunkEnd > numCols-1)
+			p.chunkEnd = numCols-1;
+		chunkBytes = numRows * (p.chunkEnd - p.chunkStart + 1) * DOUBLE_DATA_SIZE;
+		for (p.slice = 0; p.slice * MAX_PACKET_DATA < chunkBytes; p.slice++)
+			packets.push_back(p);
+	}
+
+	for (first=0; first<packets.size(); first=last)
+	{
+		last = first + BENCH_READ_PIPELINE_DEPTH;
+		if (last > packets.size())
+			last = packets.size();
+
+		output.clear();
+		for (i=first; i<last; i++)
+		{
+			if (packets[i].slice == 0)
+				readFloat64ArrayCmd(command, var, 0, numRows-1, packets[i].chunkStart, packets[i].chunkEnd, &outBytes, &inBytes, &dataBytes);
+			else
+				readFloat64SliceCmd(command, packets[i].slice, var, 0, numRows-1, packets[i].chunkStart, packets[i].chunkEnd, &outBytes, &inBytes, &dataBytes);
+			output.append(command, outBytes);
+		}
+		if (!sendAll(sock, output.data(), (int)output.size())) return false;
+
+		for (i=first; i<last; i++)
+		{
+			if (!recvAll(sock, (char *)header, 4)) return false;
+			replyBytes = header[2] | ((header[3] & ~SLICE_AVAILABLE) << 8);
+			if ((replyBytes > MAX_PACKET_DATA) || !recvAll(sock, packet, replyBytes+1)) return false;
+
+			chunkWidth = packets[i].chunkEnd - packets[i].chunkStart + 1;
+			chunkBytes = numRows * chunkWidth * DOUBLE_DATA_SIZE;
+			if (replyBytes != MIN(MAX_PACKET_DATA, chunkBytes - packets[i].slice * MAX_PACKET_DATA))
+			{
+				fprintf(stderr, "%s: error %.4s\n", var, packet+1);
+				return false;
+			}
+
+			// The chunk is row-major, so the slice is split between the rows
+			element = packets[i].slice * (MAX_PACKET_DATA / DOUBLE_DATA_SIZE);
+			for (numValues = replyBytes / DOUBLE_DATA_SIZE; numValues > 0; numValues--, element++)
+			{
+				row = element / chunkWidth;
+				col = element % chunkWidth;
+				memcpy(&rows[row][packets[i].chunkStart + col], packet + (element - packets[i].slice * (MAX_PACKET_DATA / DOUBLE_DATA_SIZE)) * DOUBLE_DATA_SIZE, DOUBLE_DATA_SIZE);
+			}
+		}
+	}
+	return true;
+}
+
+/*
+ * Measure the throughput of reading the position and position error rows of a data collection
+ * array for a range of sample counts, up to maxSamples.
+ */
+static int benchmarkReadback(const char *address, int maxSamples)
+{
+	const int counts[] = {100, 1000, 10000, 100000, 1000000};
+	std::vector <double> positions(maxSamples), errors(maxSamples);
+	std::stringstream cmd;
+	std::string reply;
+	double *rows[2];
+	epicsTimeStamp start, end;
+	double elapsed, bytes;
+	unsigned int i;
+	int count;
+	bool ok = true;
+	SOCKET sock;
+
+	sock = connectController(address);
+	if (sock == INVALID_SOCKET) return 1;
+
+	cmd << "GLOBAL REAL " << BENCH_READBACK_VAR << "(2)(" << maxSamples << ")";
+	if (!writeRead(sock, cmd.str(), reply))
+	{
+		epicsSocketDestroy(sock);
+		return 1;
+	}
+
+	rows[0] = &positions[0];
+	rows[1] = &errors[0];
+	for (i=0; ok && (i<sizeof(counts)/sizeof(counts[0])); i++)
+	{
+		count = MIN(counts[i], maxSamples);
+
+		epicsTimeGetCurrent(&start);
+		ok = readRows(sock, BENCH_READBACK_VAR, count, rows);
+		epicsTimeGetCurrent(&end);
+		elapsed = epicsTimeDiffInSeconds(&end, &start);
+		bytes = 2.0 * count * sizeof(double);
+
+		if (ok)
+			printf("readback: %i samples (%.0f bytes): %.3f s, %.3f MB/s\n", count, bytes, elapsed, (elapsed > 0.0) ? (bytes / elapsed / 1e6) : 0.0);
+
+		if (count == maxSamples)
+			break;
+	}
+
+	cmd.str("");
+	cmd << "#VGV " << BENCH_READBACK_VAR;
+	writeRead(sock, cmd.str(), reply);
+	epicsSocketDestroy(sock);
+
+	if (!ok)
+	{
+		fprintf(stderr, "readback: failed\n");
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *address = BENCH_DEFAULT_ADDRESS;
+	int iterations = BENCH_DEFAULT_ITERATIONS;
+	int numAxes = BENCH_DEFAULT_AXES;
+	double seconds = BENCH_DEFAULT_SECONDS;
+	int numPoints = BENCH_DEFAULT_POINTS;
+	int segmentMs = BENCH_DEFAULT_SEGMENT_MS;
+	int maxSamples = BENCH_DEFAULT_SAMPLES;
+	double minRate = 0.0;
+	std::string mode;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "a:i:n:t:P:T:s:r:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'a':
+				address = optarg;
+				break;
+			case 'i':
+				iterations = atoi(optarg);
+				break;
+			case 'n':
+				numAxes = atoi(optarg);
+				break;
+			case 't':
+				seconds = atof(optarg);
+				break;
+			case 'P':
+				numPoints = atoi(optarg);
+				break;
+			case 'T':
+				segmentMs = atoi(optarg);
+				break;
+			case 's':
+				maxSamples = atoi(optarg);
+				break;
+			case 'r':
+				minRate = atof(optarg);
+				break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	if ((optind != argc-1) || (iterations < 1) || (numAxes < 1) || (numPoints < 1) || (segmentMs < 1) || (maxSamples < 1))
+	{
+		usage();
+		return 1;
+	}
+	mode = argv[optind];
+
+	if (mode == "encoder")
+	{
+		benchmarkEncoder(iterations, numAxes);
+		return 0;
+	}
+
+	if (mode == "poll")
+		return benchmarkPoll(address, numAxes, seconds, minRate);
+
+	if (mode == "profile")
+		return benchmarkProfile(address, numPoints, segmentMs, minRate);
+
+	if (mode == "readback")
+		return benchmarkReadback(address, maxSamples);
+
+	usage();
+	return 1;
+}
@@ -0,0 +1,1767 @@
+/*
+ * A simulated SPiiPlus controller: global variables, simple kinematic axes, PATH/POINT
+ * buffering, data collection and a small ACSPL+ program interpreter.  Only the subset of
+ * ACSPL+ that motorAcsMotion uses is implemented.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+
+#include <epicsMutex.h>
+#include <epicsTypes.h>
+
+#include "SPiiPlusSimController.h"
+
+// Per-axis variables: name, is integer, default value
+typedef struct simAxisVar {
+	const char *name;
+	bool isInt;
+	double value;
+} simAxisVar_t;
+
+static const simAxisVar_t axisVars[] = {
+	{"APOS", false, 0.0}, {"RPOS", false, 0.0}, {"FPOS", false, 0.0}, {"EPOS", false, 0.0}, {"F2POS", false, 0.0},
+	{"FVEL", false, 0.0}, {"PE", false, 0.0}, {"ROFFS", false, 0.0}, {"EOFFS", false, 0.0}, {"E2OFFS", false, 0.0},
+	{"E_AOFFS", false, 0.0}, {"E2_AOFFS", false, 0.0}, {"VEL", false, 10.0}, {"ACC", false, 100.0}, {"DEC", false, 100.0},
+	{"KDEC", false, 1000.0}, {"JERK", false, 1000.0}, {"XVEL", false, 1000.0}, {"XACC", false, 10000.0},
+	{"STEPF", false, 0.0001}, {"EFAC", false, 0.0001}, {"E2FAC", false, 0.0001},
+	{"AST", true, 0.0}, {"MST", true, 0.0}, {"FAULT", true, 0.0}, {"MFLAGS", true, 0.0}, {"MFLAGSX", true, 0.0},
+	{"E_TYPE", true, 1.0}, {"E2_TYPE", true, 0.0}, {"DCN", true, 0.0}
+};
+
+// Controller-wide arrays: name, is integer, number of elements
+typedef struct simGlobalVar {
+	const char *name;
+	bool isInt;
+	int size;
+} simGlobalVar_t;
+
+static const simGlobalVar_t globalVars[] = {
+	{"IN", true, 8}, {"OUT", true, 8}, {"AIN", false, 8}, {"AOUT", false, 8}, {"TIME", false, 1}, {"S_DCN", true, 1}, {"CTIME", false, 1}
+};
+
+static std::string trim(const std::string& str)
+{
+	size_t first = str.find_first_not_of(" \t\r\n");
+	size_t last = str.find_last_not_of(" \t\r\n");
+
+	if (first == std::string::npos) return "";
+	return str.substr(first, last-first+1);
+}
+
+static std::string toUpper(const std::string& str)
+{
+	std::string output(str);
+
+	for (size_t i=0; i<output.size(); i++)
+		output[i] = toupper(output[i]);
+
+	return output;
+}
+
+static bool isIdentifierChar(char c)
+{
+	return (isalnum((unsigned char)c) || (c == '_'));
+}
+
+static void skipSpaces(const char **p)
+{
+	while ((**p == ' ') || (**p == '\t')) (*p)++;
+}
+
+static std::string formatValue(double value, bool isInt)
+{
+	char buffer[64];
+
+	if (isInt || ((value == floor(value)) && (fabs(value) < 1.0e15)))
+		sprintf(buffer, "%.0f", value);
+	else
+		sprintf(buffer, "%.15g", value);
+
+	return buffer;
+}
+
+SPiiPlusSimController::SPiiPlusSimController(int numAxes, bool verbose)
+: numAxes_(numAxes), verbose_(verbose), time_(0.0), asciiCommands_(0), errors_(0)
+{
+	int i;
+	size_t j;
+	simVar_t *var;
+
+	mutex_ = epicsMutexMustCreate();
+
+	for (j=0; j<sizeof(axisVars)/sizeof(axisVars[0]); j++)
+	{
+		var = createVar(axisVars[j].name, numAxes_, 1, axisVars[j].isInt);
+		for (i=0; i<numAxes_; i++)
+			var->data[i] = axisVars[j].value;
+	}
+
+	for (j=0; j<sizeof(globalVars)/sizeof(globalVars[0]); j++)
+	{
+		createVar(globalVars[j].name, globalVars[j].size, 1, globalVars[j].isInt);
+	}
+	setElement("CTIME", 0, 0, SIM_CYCLE_MS);
+
+	for (i=0; i<SIM_MAX_AXES; i++)
+	{
+		axes_[i].mode = SIM_MODE_IDLE;
+		axes_[i].pending = false;
+		axes_[i].position = 0.0;
+		axes_[i].velocity = 0.0;
+		axes_[i].target = 0.0;
+		axes_[i].maxVelocity = 0.0;
+		axes_[i].jogDirection = 1;
+		axes_[i].homing = false;
+	}
+
+	// Axes start enabled
+	var = findVar("MST");
+	for (i=0; i<numAxes_; i++)
+		var->data[i] = SIM_MST_ENABLED;
+
+	path_.active = false;
+	path_.started = false;
+	path_.ended = false;
+	path_.relative = false;
+	path_.spline = false;
+	path_.segmentElapsed = 0.0;
+	path_.executed = 0;
+	path_.starvedCycles = 0;
+
+	for (i=0; i<SIM_NUM_DC_CHANNELS; i++)
+	{
+		dc_[i].active = false;
+		dc_[i].waiting = false;
+	}
+
+	for (i=0; i<SIM_NUM_BUFFERS; i++)
+	{
+		programs_[i].compiled = false;
+		programs_[i].running = false;
+		programs_[i].line = 0;
+		programs_[i].waitUntil = 0.0;
+		programs_[i].error = 0;
+	}
+
+	updateStatus();
+}
+
+SPiiPlusSimController::~SPiiPlusSimController()
+{
+	epicsMutexDestroy(mutex_);
+}
+
+void SPiiPlusSimController::lock()
+{
+	epicsMutexMustLock(mutex_);
+}
+
+void SPiiPlusSimController::unlock()
+{
+	epicsMutexUnlock(mutex_);
+}
+
+/*
+ * Execute one ASCII line and return the reply: the value followed by a CR for queries,
+ * ":" followed by a CR for other commands, and "?####" followed by a CR for errors.
+ */
+std::string SPiiPlusSimController::executeAscii(const std::string& line)
+{
+	std::string command = trim(line);
+	std::string reply;
+	char errorStr[16];
+	int err;
+
+	asciiCommands_++;
+
+	if (command.empty())
+		return ":\r";
+
+	if (command[0] == '?')
+		err = executeQuery(command.substr(1), reply);
+	else
+		err = executeCommand(command, reply);
+
+	if (err)
+	{
+		errors_++;
+		if (verbose_) printf("%s -> error %i\n", command.c_str(), err);
+		sprintf(errorStr, "?%04i\r", err);
+		return errorStr;
+	}
+
+	if (verbose_) printf("%s -> %s\n", command.c_str(), reply.empty() ? ":" : reply.c_str());
+
+	if (reply.empty())
+		return ":\r";
+
+	return reply + "\r";
+}
+
+int SPiiPlusSimController::executeQuery(const std::string& query, std::string& reply)
+{
+	std::string expression = trim(query);
+	std::string name;
+	simVar_t *var;
+	const char *p;
+	double value;
+	int err = 0;
+	size_t i;
+
+	// ??#### returns the error message
+	if (!expression.empty() && (expression[0] == '?'))
+	{
+		reply = errorMessage(atoi(expression.c_str()+1));
+		return 0;
+	}
+
+	if (toUpper(expression) == "VR")
+	{
+		reply = "SPiiPlus simulator 3.10";
+		return 0;
+	}
+
+	// A variable name without indices returns every element
+	p = expression.c_str();
+	name = parseIdentifier(&p);
+	skipSpaces(&p);
+	if (!name.empty() && (*p == '\0') && ((var = findVar(name)) != NULL))
+	{
+		for (i=0; i<var->data.size(); i++)
+		{
+			if (i > 0) reply += " ";
+			reply += formatValue(var->data[i], var->isInt);
+		}
+		return 0;
+	}
+
+	value = evaluate(expression, &err);
+	if (err) return err;
+
+	reply = formatValue(value, false);
+	return 0;
+}
+
+int SPiiPlusSimController::executeCommand(const std::string& command, std::string& reply)
+{
+	std::string name, keyword, switches, rest;
+	std::vector <std::string> args;
+	const char *p;
+	bool isAssignment;
+	int err, buffer, i;
+	double value;
+
+	if (command[0] == '#')
+		return executeBufferCommand(command);
+
+	p = command.c_str();
+	name = parseIdentifier(&p);
+	if (name.empty()) return SIM_ERR_SYNTAX;
+	keyword = toUpper(name);
+
+	// Command switches, e.g. PTP/rv
+	while (*p == '/')
+	{
+		p++;
+		while (isalpha((unsigned char)*p)) switches += tolower(*p++);
+	}
+	rest = trim(p);
+
+	if ((keyword == "GLOBAL") || (keyword == "REAL") || (keyword == "INT"))
+	{
+		if (keyword == "GLOBAL")
+		{
+			p = rest.c_str();
+			keyword = toUpper(parseIdentifier(&p));
+			rest = trim(p);
+		}
+		if ((keyword != "REAL") && (keyword != "INT")) return SIM_ERR_SYNTAX;
+		return declareVariable(rest, keyword == "INT");
+	}
+
+	if (keyword == "SET")
+	{
+		return executeAssignment(rest, &isAssignment);
+	}
+
+	if (keyword == "SETVAR")
+	{
+		// SETVAR(value, tag)
+		if ((rest.size() < 2) || (rest[0] != '(') || (rest[rest.size()-1] != ')')) return SIM_ERR_SYNTAX;
+		splitArgs(rest.substr(1, rest.size()-2), args);
+		if (args.size() != 2) return SIM_ERR_ARGUMENTS;
+		err = 0;
+		value = evaluate(args[0], &err);
+		if (!err) tags_[(int)evaluate(args[1], &err)] = value;
+		return err;
+	}
+
+	if (keyword == "FILL")
+	{
+		// FILL(value, var)
+		simVar_t *var;
+		if ((rest.size() < 2) || (rest[0] != '(') || (rest[rest.size()-1] != ')')) return SIM_ERR_SYNTAX;
+		splitArgs(rest.substr(1, rest.size()-2), args);
+		if (args.size() < 2) return SIM_ERR_ARGUMENTS;
+		err = 0;
+		value = evaluate(args[0], &err);
+		if (err) return err;
+		var = findVar(trim(args[1]));
+		if (var == NULL) return SIM_ERR_UNDEFINED;
+		for (size_t j=0; j<var->data.size(); j++)
+			var->data[j] = var->isInt ? floor(value) : value;
+		return 0;
+	}
+
+	if ((keyword == "START") || (keyword == "STOP"))
+	{
+		splitArgs(rest, args);
+
+		if (keyword == "STOP")
+		{
+			// STOP without arguments stops every program
+			for (i=0; i<SIM_NUM_BUFFERS; i++)
+			{
+				if (args.empty() || (i == atoi(args[0].c_str())))
+					programs_[i].running = false;
+			}
+			return 0;
+		}
+
+		if (args.size() != 2) return SIM_ERR_ARGUMENTS;
+		buffer = atoi(args[0].c_str());
+		if ((buffer < 0) || (buffer >= SIM_NUM_BUFFERS)) return SIM_ERR_BUFFER;
+		if (programs_[buffer].running) return SIM_ERR_PROGRAM_RUNNING;
+		if (!programs_[buffer].compiled) return SIM_ERR_BUFFER;
+
+		// The program starts after the label, or at a line number
+		if (isdigit((unsigned char)args[1][0]))
+		{
+			programs_[buffer].line = atoi(args[1].c_str()) - 1;
+		}
+		else
+		{
+			std::string label = trim(args[1]) + ":";
+			for (i=0; i<(int)programs_[buffer].lines.size(); i++)
+			{
+				if (trim(programs_[buffer].lines[i]) == label) break;
+			}
+			if (i == (int)programs_[buffer].lines.size()) return SIM_ERR_UNDEFINED;
+			programs_[buffer].line = i + 1;
+		}
+		programs_[buffer].running = true;
+		programs_[buffer].waitUntil = 0.0;
+		programs_[buffer].error = 0;
+		return 0;
+	}
+
+	if ((keyword == "ENABLE") || (keyword == "DISABLE") || (keyword == "HALT") || (keyword == "KILL") ||
+	    (keyword == "PTP") || (keyword == "JOG") || (keyword == "HOME") || (keyword == "GO") ||
+	    (keyword == "PATH") || (keyword == "PVSPLINE") || (keyword == "POINT") || (keyword == "MPOINT") || (keyword == "ENDS"))
+	{
+		splitArgs(rest, args);
+		return executeMotion(keyword, switches, args);
+	}
+
+	if ((keyword == "DC") || (keyword == "STOPDC"))
+	{
+		splitArgs(rest, args);
+		if (keyword == "DC") return executeDataCollection(switches, args);
+
+		for (i=0; i<SIM_NUM_DC_CHANNELS; i++)
+		{
+			if (args.empty() || (dc_[i].axis == atoi(args[0].c_str())))
+				dc_[i].active = false;
+		}
+		return 0;
+	}
+
+	if (keyword == "FCLEAR")
+	{
+		simVar_t *fault = findVar("FAULT");
+		for (i=0; i<numAxes_; i++)
+		{
+			if (rest.empty() || (i == atoi(rest.c_str()))) fault->data[i] = 0.0;
+		}
+		return 0;
+	}
+
+	// Position event generation isn't simulated
+	if ((keyword == "ASSIGNPEG") || (keyword == "ASSIGNPOUTS") || (keyword == "PEG_I") ||
+	    (keyword == "PEG_R") || (keyword == "STOPPEG"))
+	{
+		return 0;
+	}
+
+	err = executeAssignment(command, &isAssignment);
+	if (!isAssignment) return SIM_ERR_SYNTAX;
+
+	return err;
+}
+
+/*
+ * VAR=expr, VAR(i)=expr or VAR(i)(j)=expr.  Writing RPOS, FPOS or F2POS (with SET) moves
+ * the reference position or changes the encoder offsets.
+ */
+int SPiiPlusSimController::executeAssignment(const std::string& command, bool *isAssignment)
+{
+	std::string name;
+	const char *p = command.c_str();
+	int indices[2] = {0, 0};
+	int numIndices = 0;
+	int bit = -1;
+	int err = 0;
+	double value, word;
+
+	*isAssignment = false;
+
+	name = parseIdentifier(&p);
+	if (name.empty()) return SIM_ERR_SYNTAX;
+
+	skipSpaces(&p);
+	while ((*p == '(') && (numIndices < 2))
+	{
+		p++;
+		indices[numIndices++] = (int)parseExpression(&p, &err);
+		if (err) return err;
+		skipSpaces(&p);
+		if (*p != ')') return SIM_ERR_SYNTAX;
+		p++;
+		skipSpaces(&p);
+	}
+
+	// A single bit of an integer, e.g. OUT(0).3=1
+	if (*p == '.')
+	{
+		p++;
+		if (!isdigit((unsigned char)*p)) return SIM_ERR_SYNTAX;
+		bit = strtol(p, (char **)&p, 10);
+		if ((bit < 0) || (bit > 31)) return SIM_ERR_INDEX;
+		skipSpaces(&p);
+	}
+
+	if ((*p != '=') || (*(p+1) == '=')) return SIM_ERR_SYNTAX;
+	p++;
+	*isAssignment = true;
+
+	value = parseExpression(&p, &err);
+	if (err) return err;
+	skipSpaces(&p);
+	if (*p != '\0') return SIM_ERR_SYNTAX;
+
+	if ((name == "RPOS") || (name == "APOS"))
+	{
+		if ((indices[0] < 0) || (indices[0] >= numAxes_)) return SIM_ERR_INDEX;
+		axes_[indices[0]].position = value;
+		axes_[indices[0]].target = value;
+		updateStatus();
+		return 0;
+	}
+	if ((name == "FPOS") || (name == "F2POS"))
+	{
+		if ((indices[0] < 0) || (indices[0] >= numAxes_)) return SIM_ERR_INDEX;
+		err = setElement((name == "FPOS") ? "EOFFS" : "E2OFFS", indices[0], 0, value - axes_[indices[0]].position);
+		updateStatus();
+		return err;
+	}
+
+	if (bit >= 0)
+	{
+		err = getElement(name, indices[0], indices[1], &word);
+		if (err) return err;
+		if (value != 0.0)
+			value = (double)((long)word | (1L << bit));
+		else
+			value = (double)((long)word & ~(1L << bit));
+	}
+
+	return setElement(name, indices[0], indices[1], value);
+}
+
+/*
+ * #VGV var          delete a global variable
+ * #<buffer>D        delete a program
+ * #<buffer>A line   append a line to a program
+ * #<buffer>C        compile a program
+ */
+int SPiiPlusSimController::executeBufferCommand(const std::string& command)
+{
+	const char *p = command.c_str() + 1;
+	std::string name;
+	char action;
+	int buffer;
+
+	if (!isdigit((unsigned char)*p))
+	{
+		name = toUpper(parseIdentifier(&p));
+		if (name == "VGV")
+		{
+			vars_.erase(trim(p));
+			return 0;
+		}
+		return SIM_ERR_SYNTAX;
+	}
+
+	buffer = strtol(p, (char **)&p, 10);
+	if ((buffer < 0) || (buffer >= SIM_NUM_BUFFERS)) return SIM_ERR_BUFFER;
+	action = toupper(*p++);
+
+	switch (action)
+	{
+		case 'D':
+			if (programs_[buffer].running) return SIM_ERR_PROGRAM_RUNNING;
+			programs_[buffer].lines.clear();
+			programs_[buffer].compiled = false;
+			return 0;
+
+		case 'A':
+			if (programs_[buffer].running) return SIM_ERR_PROGRAM_RUNNING;
+			if (*p == ' ') p++;
+			programs_[buffer].lines.push_back(p);
+			programs_[buffer].compiled = false;
+			return 0;
+
+		case 'C':
+			return compileProgram(buffer);
+
+		default:
+			return SIM_ERR_SYNTAX;
+	}
+}
+
+/*
+ * (REAL|INT) name[(rows)[(cols)]]
+ * An existing variable is replaced when the size changes.
+ */
+int SPiiPlusSimController::declareVariable(const std::string& declaration, bool isInt)
+{
+	const char *p = declaration.c_str();
+	std::string name;
+	simVar_t *var;
+	int dims[2] = {1, 1};
+	int numDims = 0;
+	int err = 0;
+
+	name = parseIdentifier(&p);
+	if (name.empty()) return SIM_ERR_SYNTAX;
+
+	skipSpaces(&p);
+	while ((*p == '(') && (numDims < 2))
+	{
+		p++;
+		dims[numDims++] = (int)parseExpression(&p, &err);
+		if (err) return err;
+		skipSpaces(&p);
+		if (*p != ')') return SIM_ERR_SYNTAX;
+		p++;
+		skipSpaces(&p);
+	}
+	if ((dims[0] < 1) || (dims[1] < 1)) return SIM_ERR_INDEX;
+
+	var = findVar(name);
+	if ((var != NULL) && (var->rows == dims[0]) && (var->cols == dims[1]) && (var->isInt == isInt))
+		return 0;
+
+	createVar(name, dims[0], dims[1], isInt);
+	return 0;
+}
+
+/*
+ * ENABLE/DISABLE/HALT/KILL axes
+ * PTP[/rvmw] axes, positions...[, velocity]
+ * JOG[/v] axis[, velocity][, direction]
+ * HOME axis[, method[, velocity...]]
+ * GO axes
+ * PATH[/twr] axes
+ * PVSPLINE[/twr] axes
+ * POINT axes, positions..., [velocities...,] time
+ * MPOINT axes, matrix, points (one point per column; the last row is the time)
+ * ENDS axes
+ */
+int SPiiPlusSimController::executeMotion(const std::string& name, const std::string& switches, std::vector <std::string>& args)
+{
+	std::vector <int> axes;
+	std::vector <double> values;
+	simVar_t *mst = findVar("MST");
+	simVar_t *mflags = findVar("MFLAGS");
+	simPoint_t point;
+	double velocity;
+	int err = 0;
+	size_t i;
+	bool relative = (switches.find('r') != std::string::npos);
+	bool wait = (switches.find('w') != std::string::npos);
+
+	if (args.empty()) return SIM_ERR_ARGUMENTS;
+	err = parseAxes(args[0], axes);
+	if (err) return err;
+
+	if (name == "MPOINT")
+	{
+		simVar_t *matrix;
+		int numPoints, row, col;
+
+		if (!path_.active || path_.spline || (path_.axes[0] != axes[0]) || (path_.axes.size() != axes.size())) return SIM_ERR_BUFFER;
+		if (args.size() != 3) return SIM_ERR_ARGUMENTS;
+		matrix = findVar(trim(args[1]));
+		if (matrix == NULL) return SIM_ERR_UNDEFINED;
+		numPoints = (int)evaluate(args[2], &err);
+		if (err) return err;
+		if ((matrix->rows < (int)axes.size()+1) || (numPoints > matrix->cols)) return SIM_ERR_INDEX;
+		if (path_.points.size() + numPoints > SIM_POINT_BUFFER_SIZE) return SIM_ERR_BUFFER;
+
+		for (col=0; col<numPoints; col++)
+		{
+			point.positions.clear();
+			for (row=0; row<(int)axes.size(); row++)
+			{
+				velocity = matrix->data[row*matrix->cols+col];
+				point.positions.push_back(path_.relative ? (path_.origin[row] + velocity) : velocity);
+			}
+			point.time = matrix->data[axes.size()*matrix->cols+col];
+			path_.points.push_back(point);
+		}
+		return 0;
+	}
+
+	for (i=1; i<args.size(); i++)
+	{
+		// JOG accepts + or - as the direction
+		if ((trim(args[i]) == "+") || (trim(args[i]) == "-"))
+		{
+			values.push_back(trim(args[i]) == "+" ? 1.0 : -1.0);
+			continue;
+		}
+		values.push_back(evaluate(args[i], &err));
+		if (err) return err;
+	}
+
+	if ((name == "ENABLE") || (name == "DISABLE"))
+	{
+		for (i=0; i<axes.size(); i++)
+		{
+			if (name == "ENABLE")
+			{
+				mst->data[axes[i]] = (int)mst->data[axes[i]] | SIM_MST_ENABLED;
+			}
+			else
+			{
+				mst->data[axes[i]] = (int)mst->data[axes[i]] & ~SIM_MST_ENABLED;
+				axes_[axes[i]].mode = SIM_MODE_IDLE;
+				axes_[axes[i]].velocity = 0.0;
+			}
+		}
+		return 0;
+	}
+
+	if ((name == "HALT") || (name == "KILL"))
+	{
+		for (i=0; i<axes.size(); i++)
+		{
+			if (axes_[axes[i]].mode != SIM_MODE_IDLE)
+			{
+				axes_[axes[i]].mode = SIM_MODE_HALT;
+				axes_[axes[i]].pending = false;
+			}
+			if (path_.active)
+			{
+				for (size_t j=0; j<path_.axes.size(); j++)
+				{
+					if (path_.axes[j] == axes[i]) path_.active = false;
+				}
+			}
+		}
+		return 0;
+	}
+
+	if (name == "GO")
+	{
+		goAxes(axes);
+		return 0;
+	}
+
+	if (name == "ENDS")
+	{
+		if (!path_.active || (path_.axes[0] != axes[0])) return SIM_ERR_BUFFER;
+		path_.ended = true;
+		return 0;
+	}
+
+	for (i=0; i<axes.size(); i++)
+	{
+		if (!((int)mst->data[axes[i]] & SIM_MST_ENABLED)) return SIM_ERR_DISABLED;
+	}
+
+	if (name == "PTP")
+	{
+		if ((values.size() != axes.size()) && !((switches.find('v') != std::string::npos) && (values.size() == axes.size()+1)))
+			return SIM_ERR_ARGUMENTS;
+
+		for (i=0; i<axes.size(); i++)
+		{
+			if (switches.find('v') != std::string::npos)
+				velocity = values.back();
+			else
+				getElement("VEL", axes[i], 0, &velocity);
+
+			startPtp(axes[i], relative ? (axes_[axes[i]].target + values[i]) : values[i], velocity);
+			axes_[axes[i]].pending = wait;
+		}
+		return 0;
+	}
+
+	if (name == "JOG")
+	{
+		// The direction follows the velocity, if there is one
+		size_t direction = 0;
+		if ((switches.find('v') != std::string::npos) && !values.empty())
+		{
+			velocity = values[0];
+			direction = 1;
+		}
+		else
+		{
+			getElement("VEL", axes[0], 0, &velocity);
+		}
+
+		axes_[axes[0]].mode = SIM_MODE_JOG;
+		axes_[axes[0]].pending = wait;
+		axes_[axes[0]].maxVelocity = fabs(velocity);
+		axes_[axes[0]].jogDirection = ((velocity < 0) != ((values.size() > direction) && (values[direction] < 0))) ? -1 : 1;
+		return 0;
+	}
+
+	if (name == "HOME")
+	{
+		// Homing to the current position (method 37) doesn't move the axis
+		if ((values.size() > 0) && ((int)values[0] == 37))
+		{
+			mflags->data[axes[0]] = (int)mflags->data[axes[0]] | SIM_MFLAGS_HOME;
+			return 0;
+		}
+
+		if (values.size() > 1)
+			velocity = values[1];
+		else
+			getElement("VEL", axes[0], 0, &velocity);
+
+		mflags->data[axes[0]] = (int)mflags->data[axes[0]] & ~SIM_MFLAGS_HOME;
+		startPtp(axes[0], 0.0, velocity);
+		axes_[axes[0]].mode = SIM_MODE_HOME;
+		return 0;
+	}
+
+	if ((name == "PATH") || (name == "PVSPLINE"))
+	{
+		if (path_.active) return SIM_ERR_BUSY;
+
+		path_.active = true;
+		path_.started = !wait;
+		path_.ended = false;
+		path_.relative = relative;
+		path_.spline = (name == "PVSPLINE");
+		path_.axes = axes;
+		path_.origin.clear();
+		for (i=0; i<axes.size(); i++)
+		{
+			path_.origin.push_back(axes_[axes[i]].position);
+			axes_[axes[i]].mode = SIM_MODE_PATH;
+			axes_[axes[i]].pending = false;
+		}
+		path_.segmentStart = path_.origin;
+		path_.segmentStartVelocity.assign(axes.size(), 0.0);
+		path_.points.clear();
+		path_.segmentElapsed = 0.0;
+		path_.executed = 0;
+		path_.starvedCycles = 0;
+		return 0;
+	}
+
+	if (name == "POINT")
+	{
+		if (!path_.active || (path_.axes[0] != axes[0]) || (path_.axes.size() != axes.size())) return SIM_ERR_BUFFER;
+		if (values.size() != (path_.spline ? 2 : 1)*axes.size()+1) return SIM_ERR_ARGUMENTS;
+		if (path_.points.size() >= SIM_POINT_BUFFER_SIZE) return SIM_ERR_BUFFER;
+
+		for (i=0; i<axes.size(); i++)
+			point.positions.push_back(path_.relative ? (path_.origin[i] + values[i]) : values[i]);
+		for (i=0; path_.spline && (i<axes.size()); i++)
+			point.velocities.push_back(values[axes.size()+i]);
+		point.time = values.back();
+		path_.points.push_back(point);
+		return 0;
+	}
+
+	return SIM_ERR_SYNTAX;
+}
+
+/*
+ * DC/sw axis, var, samples, period, source1, source2, ...
+ * DC var, samples, period, source1, source2, ...
+ */
+int SPiiPlusSimController::executeDataCollection(const std::string& switches, std::vector <std::string>& args)
+{
+	simDataCollection_t *dc = NULL;
+	simVar_t *var;
+	size_t first = 0;
+	int err = 0;
+	int i;
+
+	for (i=0; i<SIM_NUM_DC_CHANNELS; i++)
+	{
+		if (!dc_[i].active)
+		{
+			dc = &dc_[i];
+			break;
+		}
+	}
+	if (dc == NULL) return SIM_ERR_BUSY;
+
+	dc->axis = -1;
+	if (switches.find('s') != std::string::npos)
+	{
+		if (args.empty()) return SIM_ERR_ARGUMENTS;
+		dc->axis = (int)evaluate(args[0], &err);
+		if (err) return err;
+		first = 1;
+	}
+
+	if (args.size() < first+4) return SIM_ERR_ARGUMENTS;
+
+	dc->var = trim(args[first]);
+	dc->numSamples = (int)evaluate(args[first+1], &err);
+	if (!err) dc->period = evaluate(args[first+2], &err);
+	if (err) return err;
+
+	dc->sources.clear();
+	for (i=first+3; i<(int)args.size(); i++)
+		dc->sources.push_back(trim(args[i]));
+
+	var = findVar(dc->var);
+	if (var == NULL) return SIM_ERR_UNDEFINED;
+	if ((var->rows < (int)dc->sources.size()) || (var->cols < dc->numSamples)) return SIM_ERR_INDEX;
+
+	dc->count = 0;
+	// The first sample is taken when data collection starts
+	dc->elapsed = dc->period;
+	dc->waiting = (switches.find('w') != std::string::npos);
+	dc->active = true;
+
+	if (dc->axis >= 0) setElement("DCN", dc->axis, 0, 0.0);
+	setElement("S_DCN", 0, 0, 0.0);
+
+	return 0;
+}
+
+int SPiiPlusSimController::parseAxes(const std::string& arg, std::vector <int>& axes)
+{
+	std::vector <std::string> list;
+	std::string axesStr = trim(arg);
+	int err = 0;
+	int axis;
+	size_t i;
+
+	axes.clear();
+
+	if (!axesStr.empty() && (axesStr[0] == '(') && (axesStr[axesStr.size()-1] == ')'))
+		splitArgs(axesStr.substr(1, axesStr.size()-2), list);
+	else
+		list.push_back(axesStr);
+
+	for (i=0; i<list.size(); i++)
+	{
+		axis = (int)evaluate(list[i], &err);
+		if (err) return err;
+		if ((axis < 0) || (axis >= numAxes_)) return SIM_ERR_INDEX;
+		axes.push_back(axis);
+	}
+
+	return 0;
+}
+
+/*
+ * Split a list of arguments at the commas that aren't inside parentheses
+ */
+void SPiiPlusSimController::splitArgs(const std::string& args, std::vector <std::string>& output)
+{
+	int depth = 0;
+	size_t start = 0;
+	size_t i;
+
+	output.clear();
+	if (trim(args).empty()) return;
+
+	for (i=0; i<args.size(); i++)
+	{
+		if (args[i] == '(') depth++;
+		else if (args[i] == ')') depth--;
+		else if ((args[i] == ',') && (depth == 0))
+		{
+			output.push_back(trim(args.substr(start, i-start)));
+			start = i+1;
+		}
+	}
+	output.push_back(trim(args.substr(start)));
+}
+
+/*
+ * Expressions: numbers, variables with up to two indices, GSFREE(axis), GETVAR(tag), ABS(x), FLOOR(x),
+ * + - * / & | ~ and the comparisons = <> < > <= >=
+ */
+double SPiiPlusSimController::evaluate(const std::string& expression, int *err)
+{
+	const char *p = expression.c_str();
+	double value;
+
+	value = parseExpression(&p, err);
+	skipSpaces(&p);
+	if (!*err && (*p != '\0')) *err = SIM_ERR_SYNTAX;
+
+	return value;
+}
+
+double SPiiPlusSimController::parseExpression(const char **p, int *err)
+{
+	double value = parseComparison(p, err);
+	double rhs;
+	char op;
+
+	skipSpaces(p);
+	while (!*err && ((**p == '&') || (**p == '|')))
+	{
+		op = *(*p)++;
+		rhs = parseComparison(p, err);
+		if (op == '&')
+			value = (double)((long)value & (long)rhs);
+		else
+			value = (double)((long)value | (long)rhs);
+		skipSpaces(p);
+	}
+
+	return value;
+}
+
+double SPiiPlusSimController::parseComparison(const char **p, int *err)
+{
+	double value = parseSum(p, err);
+	double rhs;
+	std::string op;
+
+	skipSpaces(p);
+	if (*err) return value;
+
+	if ((**p == '<') || (**p == '>') || (**p == '='))
+	{
+		op += *(*p)++;
+		if ((**p == '>') || (**p == '=')) op += *(*p)++;
+		rhs = parseSum(p, err);
+
+		if (op == "=") return (value == rhs);
+		if (op == "<>") return (value != rhs);
+		if (op == "<") return (value < rhs);
+		if (op == ">") return (value > rhs);
+		if (op == "<=") return (value <= rhs);
+		if (op == ">=") return (value >= rhs);
+		*err = SIM_ERR_SYNTAX;
+	}
+
+	return value;
+}
+
+double SPiiPlusSimController::parseSum(const char **p, int *err)
+{
+	double value = parseTerm(p, err);
+	char op;
+
+	skipSpaces(p);
+	while (!*err && ((**p == '+') || (**p == '-')))
+	{
+		op = *(*p)++;
+		if (op == '+')
+			value += parseTerm(p, err);
+		else
+			value -= parseTerm(p, err);
+		skipSpaces(p);
+	}
+
+	return value;
+}
+
+double SPiiPlusSimController::parseTerm(const char **p, int *err)
+{
+	double value = parseUnary(p, err);
+	double rhs;
+	char op;
+
+	skipSpaces(p);
+	while (!*err && ((**p == '*') || (**p == '/')))
+	{
+		op = *(*p)++;
+		rhs = parseUnary(p, err);
+		if (op == '*')
+			value *= rhs;
+		else if (rhs != 0.0)
+			value /= rhs;
+		else
+			*err = SIM_ERR_ARGUMENTS;
+		skipSpaces(p);
+	}
+
+	return value;
+}
+
+double SPiiPlusSimController::parseUnary(const char **p, int *err)
+{
+	skipSpaces(p);
+
+	if (**p == '-')
+	{
+		(*p)++;
+		return -parseUnary(p, err);
+	}
+	if (**p == '+')
+	{
+		(*p)++;
+		return parseUnary(p, err);
+	}
+	if (**p == '~')
+	{
+		(*p)++;
+		return (double)(~(long)parseUnary(p, err));
+	}
+	if (**p == '^')
+	{
+		(*p)++;
+		return (parseUnary(p, err) == 0.0);
+	}
+
+	return parsePrimary(p, err);
+}
+
+double SPiiPlusSimController::parsePrimary(const char **p, int *err)
+{
+	std::string name, keyword;
+	double indices[2] = {0.0, 0.0};
+	int numIndices = 0;
+	double value = 0.0;
+	char *end;
+
+	skipSpaces(p);
+
+	if (**p == '(')
+	{
+		(*p)++;
+		value = parseExpression(p, err);
+		skipSpaces(p);
+		if (**p != ')')
+		{
+			*err = SIM_ERR_SYNTAX;
+			return 0.0;
+		}
+		(*p)++;
+		return value;
+	}
+
+	if (isdigit((unsigned char)**p) || (**p == '.'))
+	{
+		if ((**p == '0') && ((*(*p+1) == 'x') || (*(*p+1) == 'X')))
+			value = (double)strtol(*p, &end, 16);
+		else
+			value = strtod(*p, &end);
+		*p = end;
+		return value;
+	}
+
+	name = parseIdentifier(p);
+	if (name.empty())
+	{
+		*err = SIM_ERR_SYNTAX;
+		return 0.0;
+	}
+
+	skipSpaces(p);
+	while ((**p == '(') && (numIndices < 2))
+	{
+		(*p)++;
+		indices[numIndices++] = parseExpression(p, err);
+		if (*err) return 0.0;
+		skipSpaces(p);
+		if (**p != ')')
+		{
+			*err = SIM_ERR_SYNTAX;
+			return 0.0;
+		}
+		(*p)++;
+		skipSpaces(p);
+	}
+
+	keyword = toUpper(name);
+	if (keyword == "GSFREE")
+	{
+		if (path_.active && !path_.axes.empty() && (path_.axes[0] == (int)indices[0]))
+			return (double)(SIM_POINT_BUFFER_SIZE - path_.points.size());
+		return (double)SIM_POINT_BUFFER_SIZE;
+	}
+	if (keyword == "GETVAR")
+	{
+		return tags_[(int)indices[0]];
+	}
+	if (keyword == "ABS")
+	{
+		return fabs(indices[0]);
+	}
+	if (keyword == "FLOOR")
+	{
+		return floor(indices[0]);
+	}
+
+	*err = getElement(name, (int)indices[0], (int)indices[1], &value);
+	return value;
+}
+
+std::string SPiiPlusSimController::parseIdentifier(const char **p)
+{
+	std::string name;
+
+	skipSpaces(p);
+	if (!isalpha((unsigned char)**p) && (**p != '_')) return name;
+
+	while (isIdentifierChar(**p))
+		name += *(*p)++;
+
+	return name;
+}
+
+simVar_t* SPiiPlusSimController::findVar(const std::string& name)
+{
+	std::map <std::string, simVar_t>::iterator it = vars_.find(name);
+
+	if (it == vars_.end()) return NULL;
+	return &it->second;
+}
+
+simVar_t* SPiiPlusSimController::createVar(const std::string& name, int rows, int cols, bool isInt)
+{
+	simVar_t *var = &vars_[name];
+
+	var->rows = rows;
+	var->cols = cols;
+	var->isInt = isInt;
+	var->data.assign(rows*cols, 0.0);
+
+	return var;
+}
+
+int SPiiPlusSimController::getElement(const std::string& name, int idx1, int idx2, double *value)
+{
+	simVar_t *var = findVar(name);
+
+	if (var == NULL) return SIM_ERR_UNDEFINED;
+	if ((idx1 < 0) || (idx1 >= var->rows) || (idx2 < 0) || (idx2 >= var->cols)) return SIM_ERR_INDEX;
+
+	*value = var->data[idx1*var->cols + idx2];
+	return 0;
+}
+
+int SPiiPlusSimController::setElement(const std::string& name, int idx1, int idx2, double value)
+{
+	simVar_t *var = findVar(name);
+
+	if (var == NULL) return SIM_ERR_UNDEFINED;
+	if ((idx1 < 0) || (idx1 >= var->rows) || (idx2 < 0) || (idx2 >= var->cols)) return SIM_ERR_INDEX;
+
+	var->data[idx1*var->cols + idx2] = var->isInt ? floor(value) : value;
+	return 0;
+}
+
+/*
+ * Copy VAR(idx1start,idx1end)(idx2start,idx2end) into output as little-endian 32-bit integers
+ * or 64-bit reals, row by row.
+ */
+int SPiiPlusSimController::readArray(const char *name, int dataSize, int idx1start, int idx1end, int idx2start, int idx2end, std::vector <char>& output)
+{
+	simVar_t *var = findVar(name);
+	epicsInt32 intValue;
+	double value;
+	int i, j;
+	size_t offset = 0;
+
+	if (var == NULL) return SIM_ERR_UNDEFINED;
+	if ((idx1start < 0) || (idx1end >= var->rows) || (idx1start > idx1end) ||
+	    (idx2start < 0) || (idx2end >= var->cols) || (idx2start > idx2end))
+		return SIM_ERR_INDEX;
+
+	output.resize((idx1end-idx1start+1) * (idx2end-idx2start+1) * dataSize);
+
+	for (i=idx1start; i<=idx1end; i++)
+	{
+		for (j=idx2start; j<=idx2end; j++)
+		{
+			value = var->data[i*var->cols + j];
+			if (dataSize == 4)
+			{
+				intValue = (epicsInt32)value;
+				memcpy(&output[offset], &intValue, 4);
+			}
+			else
+			{
+				memcpy(&output[offset], &value, 8);
+			}
+			offset += dataSize;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Write 64-bit reals to VAR(idx1start,idx1end)(idx2start,idx2end), starting offset elements
+ * into the range.
+ */
+int SPiiPlusSimController::writeArray(const char *name, int idx1start, int idx1end, int idx2start, int idx2end, int offset, const char *data, int numBytes)
+{
+	simVar_t *var = findVar(name);
+	int cols = idx2end - idx2start + 1;
+	int numElements = (idx1end - idx1start + 1) * cols;
+	double value;
+	int k, i, j;
+
+	if (var == NULL) return SIM_ERR_UNDEFINED;
+	if ((idx1start < 0) || (idx1end >= var->rows) || (idx1start > idx1end) ||
+	    (idx2start < 0) || (idx2end >= var->cols) || (idx2start > idx2end) ||
+	    (offset + numBytes/8 > numElements))
+		return SIM_ERR_INDEX;
+
+	for (k=0; k<numBytes/8; k++)
+	{
+		memcpy(&value, data + 8*k, 8);
+		i = idx1start + (offset+k) / cols;
+		j = idx2start + (offset+k) % cols;
+		var->data[i*var->cols + j] = var->isInt ? floor(value) : value;
+	}
+
+	return 0;
+}
+
+void SPiiPlusSimController::startPtp(int axis, double target, double velocity)
+{
+	axes_[axis].mode = SIM_MODE_PTP;
+	axes_[axis].pending = false;
+	axes_[axis].target = target;
+	axes_[axis].maxVelocity = fabs(velocity);
+}
+
+void SPiiPlusSimController::goAxes(std::vector <int>& axes)
+{
+	size_t i;
+	int j;
+
+	for (i=0; i<axes.size(); i++)
+	{
+		axes_[axes[i]].pending = false;
+
+		if (path_.active && !path_.axes.empty() && (path_.axes[0] == axes[i]))
+			path_.started = true;
+
+		for (j=0; j<SIM_NUM_DC_CHANNELS; j++)
+		{
+			if (dc_[j].active && (dc_[j].axis == axes[i]))
+				dc_[j].waiting = false;
+		}
+	}
+}
+
+/*
+ * Trapezoidal motion: accelerate with ACC up to the move velocity and decelerate with DEC
+ */
+void SPiiPlusSimController::updateAxis(int axis, double dt)
+{
+	simAxis_t *a = &axes_[axis];
+	double acc, dec, desired, remaining, limit, dv;
+
+	if ((a->mode == SIM_MODE_IDLE) || (a->mode == SIM_MODE_PATH) || a->pending) return;
+
+	getElement("ACC", axis, 0, &acc);
+	getElement("DEC", axis, 0, &dec);
+	if (acc <= 0.0) acc = 1.0e12;
+	if (dec <= 0.0) dec = 1.0e12;
+
+	remaining = a->target - a->position;
+
+	switch (a->mode)
+	{
+		case SIM_MODE_PTP:
+		case SIM_MODE_HOME:
+			desired = sqrt(2.0 * dec * fabs(remaining));
+			if (desired > a->maxVelocity) desired = a->maxVelocity;
+			if (remaining < 0.0) desired = -desired;
+			break;
+
+		case SIM_MODE_JOG:
+			desired = a->jogDirection * a->maxVelocity;
+			break;
+
+		default:
+			desired = 0.0;
+			break;
+	}
+
+	dv = desired - a->velocity;
+	limit = ((fabs(desired) > fabs(a->velocity)) && (desired * a->velocity >= 0.0)) ? acc * dt : dec * dt;
+	if (dv > limit) dv = limit;
+	if (dv < -limit) dv = -limit;
+	a->velocity += dv;
+
+	if ((a->mode == SIM_MODE_PTP) || (a->mode == SIM_MODE_HOME))
+	{
+		if ((fabs(a->velocity * dt) >= fabs(remaining)) || (fabs(remaining) < 1.0e-12))
+		{
+			a->position = a->target;
+			a->velocity = 0.0;
+			if (a->mode == SIM_MODE_HOME)
+			{
+				simVar_t *mflags = findVar("MFLAGS");
+				mflags->data[axis] = (int)mflags->data[axis] | SIM_MFLAGS_HOME;
+			}
+			a->mode = SIM_MODE_IDLE;
+			return;
+		}
+	}
+
+	a->position += a->velocity * dt;
+	a->target = (a->mode == SIM_MODE_PTP) || (a->mode == SIM_MODE_HOME) ? a->target : a->position;
+
+	if ((a->mode == SIM_MODE_HALT) && (a->velocity == 0.0))
+		a->mode = SIM_MODE_IDLE;
+}
+
+/*
+ * Interpolate linearly between the points of the path.  The path holds its position when the
+ * point buffer runs out before ENDS (starvation).
+ */
+void SPiiPlusSimController::updatePath(double dt)
+{
+	simPoint_t *point;
+	double remaining = dt;
+	double fraction, position, duration;
+	size_t i;
+
+	if (!path_.active) return;
+
+	for (i=0; i<path_.axes.size(); i++)
+		axes_[path_.axes[i]].velocity = 0.0;
+
+	if (!path_.started) return;
+
+	while ((remaining > 0.0) && !path_.points.empty())
+	{
+		point = &path_.points.front();
+
+		if (remaining >= (point->time - path_.segmentElapsed))
+		{
+			remaining -= point->time - path_.segmentElapsed;
+			for (i=0; i<path_.axes.size(); i++)
+			{
+				axes_[path_.axes[i]].velocity = (point->positions[i] - axes_[path_.axes[i]].position) / (dt / 1000.0);
+				axes_[path_.axes[i]].position = point->positions[i];
+				axes_[path_.axes[i]].target = point->positions[i];
+			}
+			path_.segmentStart = point->positions;
+			if (path_.spline) path_.segmentStartVelocity = point->velocities;
+			path_.segmentElapsed = 0.0;
+			path_.points.pop_front();
+			path_.executed++;
+		}
+		else
+		{
+			path_.segmentElapsed += remaining;
+			remaining = 0.0;
+			fraction = path_.segmentElapsed / point->time;
+			duration = point->time / 1000.0;
+			for (i=0; i<path_.axes.size(); i++)
+			{
+				if (path_.spline)
+				{
+					// Cubic Hermite interpolation of the start and end positions and velocities
+					position = (2*pow(fraction,3) - 3*pow(fraction,2) + 1) * path_.segmentStart[i] +
+					           (pow(fraction,3) - 2*pow(fraction,2) + fraction) * duration * path_.segmentStartVelocity[i] +
+					           (-2*pow(fraction,3) + 3*pow(fraction,2)) * point->positions[i] +
+					           (pow(fraction,3) - pow(fraction,2)) * duration * point->velocities[i];
+				}
+				else
+				{
+					position = path_.segmentStart[i] + (point->positions[i] - path_.segmentStart[i]) * fraction;
+				}
+				axes_[path_.axes[i]].velocity = (position - axes_[path_.axes[i]].position) / (dt / 1000.0);
+				axes_[path_.axes[i]].position = position;
+				axes_[path_.axes[i]].target = position;
+			}
+		}
+	}
+
+	if (path_.points.empty())
+	{
+		if (path_.ended)
+		{
+			path_.active = false;
+			for (i=0; i<path_.axes.size(); i++)
+			{
+				axes_[path_.axes[i]].mode = SIM_MODE_IDLE;
+				axes_[path_.axes[i]].velocity = 0.0;
+			}
+		}
+		else if (remaining > 0.0)
+		{
+			path_.starvedCycles++;
+		}
+	}
+}
+
+void SPiiPlusSimController::updateDataCollection(double dt)
+{
+	simDataCollection_t *dc;
+	simVar_t *var;
+	double value;
+	int i, err;
+	size_t k;
+
+	for (i=0; i<SIM_NUM_DC_CHANNELS; i++)
+	{
+		dc = &dc_[i];
+		if (!dc->active || dc->waiting) continue;
+
+		var = findVar(dc->var);
+		if (var == NULL)
+		{
+			dc->active = false;
+			continue;
+		}
+
+		while ((dc->elapsed >= dc->period) && (dc->count < dc->numSamples))
+		{
+			for (k=0; k<dc->sources.size(); k++)
+			{
+				err = 0;
+				value = evaluate(dc->sources[k], &err);
+				var->data[k*var->cols + dc->count] = value;
+			}
+			dc->count++;
+			dc->elapsed -= dc->period;
+		}
+		dc->elapsed += dt;
+
+		if (dc->axis >= 0) setElement("DCN", dc->axis, 0, dc->count);
+		setElement("S_DCN", 0, 0, dc->count);
+
+		if (dc->count >= dc->numSamples)
+			dc->active = false;
+	}
+}
+
+/*
+ * Copy the axis state into the variables that are read by clients
+ */
+void SPiiPlusSimController::updateStatus()
+{
+	simVar_t *apos = findVar("APOS");
+	simVar_t *rpos = findVar("RPOS");
+	simVar_t *fpos = findVar("FPOS");
+	simVar_t *epos = findVar("EPOS");
+	simVar_t *f2pos = findVar("F2POS");
+	simVar_t *fvel = findVar("FVEL");
+	simVar_t *eoffs = findVar("EOFFS");
+	simVar_t *e2offs = findVar("E2OFFS");
+	simVar_t *mst = findVar("MST");
+	simVar_t *ast = findVar("AST");
+	simAxis_t *a;
+	int motorStatus, axisStatus;
+	int i, j;
+	bool moving;
+
+	for (i=0; i<numAxes_; i++)
+	{
+		a = &axes_[i];
+
+		apos->data[i] = a->position;
+		rpos->data[i] = a->position;
+		fpos->data[i] = a->position + eoffs->data[i];
+		epos->data[i] = fpos->data[i];
+		f2pos->data[i] = a->position + e2offs->data[i];
+		fvel->data[i] = a->velocity;
+
+		moving = (a->mode != SIM_MODE_IDLE) && !a->pending;
+		if ((a->mode == SIM_MODE_PATH) && !path_.started) moving = false;
+
+		motorStatus = (int)mst->data[i] & SIM_MST_ENABLED;
+		axisStatus = 0;
+		if (moving)
+		{
+			motorStatus |= SIM_MST_MOVE;
+			axisStatus |= SIM_AST_MOVE;
+		}
+		else
+		{
+			motorStatus |= SIM_MST_INPOS;
+		}
+
+		if (path_.active && (path_.axes[0] == i))
+		{
+			axisStatus |= SIM_AST_LEAD;
+			if (path_.started && path_.points.empty() && !path_.ended) axisStatus |= SIM_AST_STARV;
+		}
+
+		for (j=0; j<SIM_NUM_DC_CHANNELS; j++)
+		{
+			if (dc_[j].active && (dc_[j].axis == i)) axisStatus |= SIM_AST_DC;
+		}
+
+		mst->data[i] = motorStatus;
+		ast->data[i] = axisStatus;
+	}
+
+	setElement("TIME", 0, 0, time_);
+}
+
+void SPiiPlusSimController::cycle()
+{
+	int i;
+
+	time_ += SIM_CYCLE_MS;
+
+	for (i=0; i<SIM_NUM_BUFFERS; i++)
+	{
+		if (programs_[i].running) runProgram(i);
+	}
+
+	for (i=0; i<numAxes_; i++)
+		updateAxis(i, SIM_CYCLE_MS / 1000.0);
+	updatePath(SIM_CYCLE_MS);
+
+	updateStatus();
+	updateDataCollection(SIM_CYCLE_MS);
+}
+
+/*
+ * Match the block statements (WHILE, LOOP, IF/ELSE, BLOCK) with their END lines
+ */
+int SPiiPlusSimController::compileProgram(int buffer)
+{
+	simProgram_t *program = &programs_[buffer];
+	std::vector <int> stack;
+	std::string keyword;
+	const char *p;
+	size_t i;
+
+	program->match.assign(program->lines.size(), -1);
+	program->loopCount.assign(program->lines.size(), 0);
+	program->compiled = false;
+
+	for (i=0; i<program->lines.size(); i++)
+	{
+		p = program->lines[i].c_str();
+		keyword = toUpper(parseIdentifier(&p));
+
+		if ((keyword == "WHILE") || (keyword == "LOOP") || (keyword == "IF") || (keyword == "BLOCK"))
+		{
+			stack.push_back(i);
+		}
+		else if (keyword == "ELSE")
+		{
+			if (stack.empty()) return SIM_ERR_SYNTAX;
+			program->match[stack.back()] = i;
+			stack.back() = i;
+		}
+		else if ((keyword == "END") && (trim(p).empty()))
+		{
+			if (stack.empty()) return SIM_ERR_SYNTAX;
+			program->match[stack.back()] = i;
+			program->match[i] = stack.back();
+			stack.pop_back();
+		}
+	}
+
+	if (!stack.empty()) return SIM_ERR_SYNTAX;
+
+	program->compiled = true;
+	return 0;
+}
+
+/*
+ * Execute one line per controller cycle.  The lines of a BLOCK, and lines that only change
+ * the program flow, don't use a cycle.
+ */
+void SPiiPlusSimController::runProgram(int buffer)
+{
+	simProgram_t *program = &programs_[buffer];
+	int blockEnd = -1;
+	int linesExecuted = 0;
+	int result;
+
+	while (program->running && (time_ >= program->waitUntil) && (linesExecuted < 100000))
+	{
+		if ((program->line < 0) || (program->line >= (int)program->lines.size()))
+		{
+			program->running = false;
+			break;
+		}
+
+		if (program->line == blockEnd) blockEnd = -1;
+
+		{
+			const char *p = program->lines[program->line].c_str();
+			if (toUpper(parseIdentifier(&p)) == "BLOCK")
+				blockEnd = program->match[program->line];
+		}
+
+		result = executeProgramLine(program);
+		linesExecuted++;
+
+		// A line that used a cycle ends the cycle, unless it is in a BLOCK
+		if ((result > 0) && (blockEnd < 0)) break;
+		if (result < 0) break;
+	}
+}
+
+/*
+ * Returns 0 if the line didn't use a cycle, 1 if it did and -1 if the program must wait
+ */
+int SPiiPlusSimController::executeProgramLine(simProgram_t *program)
+{
+	std::string text = trim(program->lines[program->line]);
+	std::string keyword, reply;
+	const char *p = text.c_str();
+	int line = program->line;
+	int err = 0;
+	double value;
+
+	if (text.empty() || (text[0] == '!'))
+	{
+		program->line++;
+		return 0;
+	}
+
+	keyword = toUpper(parseIdentifier(&p));
+
+	// Labels
+	if (!keyword.empty() && (trim(p) == ":"))
+	{
+		program->line++;
+		return 0;
+	}
+
+	if (keyword == "BLOCK")
+	{
+		program->line++;
+		return 0;
+	}
+
+	if ((keyword == "END") && (program->match[line] >= 0))
+	{
+		const char *q = program->lines[program->match[line]].c_str();
+		std::string opener = toUpper(parseIdentifier(&q));
+
+		if (opener == "WHILE")
+		{
+			program->line = program->match[line];
+		}
+		else if ((opener == "LOOP") && (--program->loopCount[program->match[line]] > 0))
+		{
+			program->line = program->match[line] + 1;
+		}
+		else
+		{
+			program->line++;
+		}
+		return 0;
+	}
+
+	if (keyword == "ELSE")
+	{
+		program->line = program->match[line] + 1;
+		return 0;
+	}
+
+	if ((keyword == "WHILE") || (keyword == "IF"))
+	{
+		value = evaluate(p, &err);
+		if (err) goto error;
+		program->line = (value != 0.0) ? (line + 1) : (program->match[line] + 1);
+		return 1;
+	}
+
+	if (keyword == "LOOP")
+	{
+		program->loopCount[line] = (int)evaluate(p, &err);
+		if (err) goto error;
+		program->line = (program->loopCount[line] > 0) ? (line + 1) : (program->match[line] + 1);
+		return 1;
+	}
+
+	if (keyword == "TILL")
+	{
+		value = evaluate(p, &err);
+		if (err) goto error;
+		if (value != 0.0) program->line++;
+		return 1;
+	}
+
+	if (keyword == "WAIT")
+	{
+		value = evaluate(p, &err);
+		if (err) goto error;
+		program->waitUntil = time_ + value;
+		program->line++;
+		return -1;
+	}
+
+	if ((keyword == "STOP") || (keyword == "RET"))
+	{
+		program->running = false;
+		return -1;
+	}
+
+	err = executeCommand(text, reply);
+	if (err) goto error;
+	program->line++;
+	return 1;
+
+error:
+	if (verbose_) printf("program error %i on line %i: %s\n", err, line+1, text.c_str());
+	program->error = err;
+	program->running = false;
+	return -1;
+}
+
+const char* SPiiPlusSimController::errorMessage(int errNo)
+{
+	switch (errNo)
+	{
+		case SIM_ERR_SYNTAX:		return "Syntax error";
+		case SIM_ERR_ARGUMENTS:		return "Wrong number of arguments";
+		case SIM_ERR_INDEX:		return "Index is out of range";
+		case SIM_ERR_UNDEFINED:		return "Undefined variable";
+		case SIM_ERR_PROGRAM_RUNNING:	return "Program is running";
+		case SIM_ERR_BUFFER:		return "Buffer error";
+		case SIM_ERR_DISABLED:		return "Motor is disabled";
+		case SIM_ERR_BUSY:		return "Resource is busy";
+		default:			return "?";
+	}
+}
+
+void SPiiPlusSimController::report(FILE *fp)
+{
+	int i;
+
+	fprintf(fp, "time = %.0lf ms, ASCII commands = %lu, errors = %lu\n", time_, asciiCommands_, errors_);
+	if (path_.active || path_.executed)
+		fprintf(fp, "path: %s, %lu points executed, %lu points queued, %lu starved cycles\n",
+		        path_.active ? "active" : "done", path_.executed, (unsigned long)path_.points.size(), path_.starvedCycles);
+	for (i=0; i<SIM_NUM_BUFFERS; i++)
+	{
+		if (programs_[i].running || programs_[i].error)
+			fprintf(fp, "buffer %i: %s, line %i, error %i\n", i, programs_[i].running ? "running" : "stopped", programs_[i].line+1, programs_[i].error);
+	}
+}
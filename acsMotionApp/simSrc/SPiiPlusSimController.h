@@ -0,0 +1,188 @@
+#ifndef SPIIPLUS_SIM_CONTROLLER_H
+#define SPIIPLUS_SIM_CONTROLLER_H
+
+#include <stdio.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <epicsMutex.h>
+
+#define SIM_MAX_AXES		64
+#define SIM_NUM_BUFFERS		64
+#define SIM_NUM_DC_CHANNELS	8
+#define SIM_POINT_BUFFER_SIZE	50
+// The controller cycle, which is also the motion and program update period
+#define SIM_CYCLE_MS		1.0
+
+// Error numbers returned by the simulator (the same numbers the controller uses for these errors)
+#define SIM_ERR_SYNTAX		1002
+#define SIM_ERR_INDEX		1035
+#define SIM_ERR_UNDEFINED	1064
+#define SIM_ERR_ARGUMENTS	1023
+#define SIM_ERR_BUFFER		3022
+#define SIM_ERR_PROGRAM_RUNNING	3020
+#define SIM_ERR_DISABLED	3073
+#define SIM_ERR_BUSY		3042
+
+// Axis motion modes
+#define SIM_MODE_IDLE		0
+#define SIM_MODE_PTP		1
+#define SIM_MODE_JOG		2
+#define SIM_MODE_HALT		3
+#define SIM_MODE_HOME		4
+#define SIM_MODE_PATH		5
+
+// Status bits reported by the simulator (see SPiiPlusDriver.h)
+#define SIM_MST_ENABLED		(1<<0)
+#define SIM_MST_INPOS		(1<<4)
+#define SIM_MST_MOVE		(1<<5)
+#define SIM_MST_ACC		(1<<6)
+#define SIM_AST_LEAD		(1<<0)
+#define SIM_AST_DC		(1<<3)
+#define SIM_AST_MOVE		(1<<5)
+#define SIM_AST_ACC		(1<<6)
+#define SIM_AST_STARV		(1<<17)
+#define SIM_MFLAGS_HOME		(1<<3)
+
+typedef struct simVar {
+	int rows;
+	int cols;
+	bool isInt;
+	std::vector <double> data;
+} simVar_t;
+
+typedef struct simAxis {
+	int mode;
+	bool pending;                 /**< Waiting for GO (/w switch) */
+	double position;              /**< Reference position */
+	double velocity;
+	double target;
+	double maxVelocity;           /**< Velocity of the current move */
+	int jogDirection;
+	bool homing;
+} simAxis_t;
+
+typedef struct simPoint {
+	std::vector <double> positions;
+	std::vector <double> velocities;  /**< End velocities of PVSPLINE segments */
+	double time;                  /**< Segment time in ms */
+} simPoint_t;
+
+// The PATH/POINT/ENDS (or PVSPLINE/POINT/ENDS) motion of a group of axes (only one group can run at a time)
+typedef struct simPath {
+	bool active;
+	bool started;
+	bool ended;
+	bool relative;
+	bool spline;                        /**< PVSPLINE: segments are cubic in position and velocity */
+	std::vector <int> axes;
+	std::vector <double> origin;        /**< Start positions, used by relative paths */
+	std::vector <double> segmentStart;
+	std::vector <double> segmentStartVelocity;
+	std::deque <simPoint_t> points;
+	double segmentElapsed;
+	unsigned long executed;
+	unsigned long starvedCycles;
+} simPath_t;
+
+typedef struct simDataCollection {
+	bool active;
+	bool waiting;                 /**< Waiting for GO (/w switch) */
+	int axis;
+	std::string var;
+	int numSamples;
+	int count;
+	double period;
+	double elapsed;
+	std::vector <std::string> sources;
+} simDataCollection_t;
+
+typedef struct simProgram {
+	std::vector <std::string> lines;
+	std::vector <int> match;        /**< Matching END (or opener for END lines) of block statements */
+	std::vector <int> loopCount;
+	bool compiled;
+	bool running;
+	int line;
+	double waitUntil;
+	int error;
+} simProgram_t;
+
+class SPiiPlusSimController {
+public:
+	SPiiPlusSimController(int numAxes, bool verbose);
+	~SPiiPlusSimController();
+
+	void lock();
+	void unlock();
+
+	/* The transports call these with the lock held */
+	std::string executeAscii(const std::string& line);
+	int readArray(const char *var, int dataSize, int idx1start, int idx1end, int idx2start, int idx2end, std::vector <char>& output);
+	int writeArray(const char *var, int idx1start, int idx1end, int idx2start, int idx2end, int offset, const char *data, int numBytes);
+
+	/* Called every SIM_CYCLE_MS by the motion thread, with the lock held */
+	void cycle();
+
+	void report(FILE *fp);
+
+private:
+	int executeCommand(const std::string& command, std::string& reply);
+	int executeQuery(const std::string& query, std::string& reply);
+	int executeAssignment(const std::string& command, bool *isAssignment);
+	int executeBufferCommand(const std::string& command);
+	int executeMotion(const std::string& name, const std::string& switches, std::vector <std::string>& args);
+	int executeDataCollection(const std::string& switches, std::vector <std::string>& args);
+	int declareVariable(const std::string& declaration, bool isInt);
+
+	int parseAxes(const std::string& arg, std::vector <int>& axes);
+	void splitArgs(const std::string& args, std::vector <std::string>& output);
+
+	/* expression evaluation */
+	double evaluate(const std::string& expression, int *err);
+	double parseExpression(const char **p, int *err);
+	double parseComparison(const char **p, int *err);
+	double parseSum(const char **p, int *err);
+	double parseTerm(const char **p, int *err);
+	double parseUnary(const char **p, int *err);
+	double parsePrimary(const char **p, int *err);
+	std::string parseIdentifier(const char **p);
+
+	simVar_t* findVar(const std::string& name);
+	simVar_t* createVar(const std::string& name, int rows, int cols, bool isInt);
+	int getElement(const std::string& name, int idx1, int idx2, double *value);
+	int setElement(const std::string& name, int idx1, int idx2, double value);
+
+	/* motion */
+	void startPtp(int axis, double target, double velocity);
+	void updateAxis(int axis, double dt);
+	void updatePath(double dt);
+	void updateDataCollection(double dt);
+	void updateStatus();
+	void goAxes(std::vector <int>& axes);
+
+	/* programs */
+	int compileProgram(int buffer);
+	void runProgram(int buffer);
+	int executeProgramLine(simProgram_t *program);
+
+	const char* errorMessage(int errNo);
+
+	epicsMutexId mutex_;
+	int numAxes_;
+	bool verbose_;
+	double time_;                   /**< Controller time (ms) */
+	std::map <std::string, simVar_t> vars_;
+	std::map <int, double> tags_;
+	simAxis_t axes_[SIM_MAX_AXES];
+	simPath_t path_;
+	simDataCollection_t dc_[SIM_NUM_DC_CHANNELS];
+	simProgram_t programs_[SIM_NUM_BUFFERS];
+	unsigned long asciiCommands_;
+	unsigned long errors_;
+};
+
+#endif /* SPIIPLUS_SIM_CONTROLLER_H */
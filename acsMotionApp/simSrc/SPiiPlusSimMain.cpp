@@ -0,0 +1,410 @@
+/*
+ * SPiiPlusSim: a TCP server that simulates a SPiiPlus controller, so that the driver can be
+ * exercised and benchmarked without hardware.
+ *
+ * Usage: SPiiPlusSim [-p port] [-n axes] [-l latency_ms] [-b bytes_per_second] [-s report_period] [-v]
+ *
+ * ASCII commands and binary frames can be mixed on the same connection, like on the controller.
+ * Every reply is delayed by the latency, plus the transfer time of the reply when a bandwidth
+ * is specified.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsGetopt.h>
+#include <osiSock.h>
+
+#include "SPiiPlusBinComm.h"
+#include "SPiiPlusSimController.h"
+
+#define SIM_DEFAULT_PORT	701
+#define SIM_DEFAULT_AXES	8
+// The longest ASCII line that is accepted
+#define SIM_MAX_LINE		4096
+
+typedef struct simConnection {
+	SOCKET sock;
+	SPiiPlusSimController *controller;
+	double latency;              /**< Reply delay (s) */
+	double bandwidth;            /**< Bytes per second, or 0 for no limit */
+} simConnection_t;
+
+static bool verbose = false;
+static double reportPeriod = 0.0;
+
+static void usage()
+{
+	fprintf(stderr, "Usage: SPiiPlusSim [-p port] [-n axes] [-l latency_ms] [-b bytes_per_second] [-s report_period] [-v]\n");
+	fprintf(stderr, "  -p port              TCP port (default %i)\n", SIM_DEFAULT_PORT);
+	fprintf(stderr, "  -n axes              number of axes (default %i)\n", SIM_DEFAULT_AXES);
+	fprintf(stderr, "  -l latency_ms        delay before each reply (default 0)\n");
+	fprintf(stderr, "  -b bytes_per_second  simulated link bandwidth (default unlimited)\n");
+	fprintf(stderr, "  -s report_period     seconds between status reports (default 0, no reports)\n");
+	fprintf(stderr, "  -v                   print every command\n");
+}
+
+/*
+ * Parse "VAR(a,b)(c,d)" (the indices are optional)
+ */
+static bool parseArrayVar(const char *str, int len, std::string& var, int *idx1start, int *idx1end, int *idx2start, int *idx2end)
+{
+	std::string text(str, len);
+	size_t paren = text.find('(');
+
+	*idx1start = *idx1end = *idx2start = *idx2end = 0;
+
+	var = text.substr(0, paren);
+	if (paren == std::string::npos) return !var.empty();
+
+	if (sscanf(text.c_str()+paren, "(%d,%d)(%d,%d)", idx1start, idx1end, idx2start, idx2end) == 4)
+		return true;
+	if (sscanf(text.c_str()+paren, "(%d,%d)", idx1start, idx1end) == 2)
+		return true;
+
+	return false;
+}
+
+static void appendErrorReply(std::string& reply, unsigned char cmd, int errNo)
+{
+	char body[16];
+
+	sprintf(body, "?%04i\r", errNo);
+	reply += (char)REPLY_START;
+	reply += (char)cmd;
+	reply += (char)0x06;
+	reply += (char)0x00;
+	reply.append(body, 6);
+	reply += (char)REPLY_END;
+}
+
+/*
+ * Read:  [D3][cmd][len LSB][len MSB] [%slice] %?? [type] VAR(a,b)(c,d) [D6]
+ * Write: [D3][cmd][len LSB][len MSB] [%slice] %>> [08] VAR(a,b)(c,d) /% data [D6]
+ * Long reads are returned in slices of MAX_PACKET_DATA bytes; long writes are sent in slices
+ * that hold as many doubles as fit alongside the command.
+ */
+static void processBinary(SPiiPlusSimController *controller, const char *frame, int frameBytes, std::string& reply)
+{
+	unsigned char cmd = (unsigned char)frame[1];
+	const char *body = frame + 4;
+	int bodyBytes = frameBytes - 5;
+	int slice = 0;
+	int pos = 0;
+	int idx1start, idx1end, idx2start, idx2end;
+	int dataSize, varBytes, sliceBytes, maxDoublesPerPacket, offset, err;
+	const char *dataStart;
+	std::vector <char> data;
+	std::string var;
+
+	// The optional slice number
+	if ((bodyBytes > 1) && (body[0] == '%') && (body[1] != '?') && (body[1] != '>'))
+	{
+		slice = atoi(body+1);
+		pos = 1;
+		while ((pos < bodyBytes) && (body[pos] != '%')) pos++;
+	}
+
+	if ((bodyBytes - pos > 4) && !strncmp(body+pos, "%??", 3))
+	{
+		dataSize = (unsigned char)body[pos+3];
+		if (!parseArrayVar(body+pos+4, bodyBytes-pos-4, var, &idx1start, &idx1end, &idx2start, &idx2end))
+		{
+			appendErrorReply(reply, cmd, SIM_ERR_SYNTAX);
+			return;
+		}
+
+		controller->lock();
+		err = controller->readArray(var.c_str(), dataSize, idx1start, idx1end, idx2start, idx2end, data);
+		controller->unlock();
+
+		if (err || ((int)data.size() <= slice * MAX_PACKET_DATA))
+		{
+			appendErrorReply(reply, cmd, err ? err : SIM_ERR_INDEX);
+			return;
+		}
+
+		sliceBytes = (int)data.size() - slice * MAX_PACKET_DATA;
+		if (sliceBytes > MAX_PACKET_DATA) sliceBytes = MAX_PACKET_DATA;
+
+		reply += (char)REPLY_START;
+		reply += (char)cmd;
+		reply += (char)(sliceBytes & 0xFF);
+		reply += (char)(((sliceBytes >> 8) & 0x7F) | (((slice+1) * MAX_PACKET_DATA < (int)data.size()) ? SLICE_AVAILABLE : 0));
+		reply.append(&data[slice * MAX_PACKET_DATA], sliceBytes);
+		reply += (char)REPLY_END;
+		return;
+	}
+
+	if ((bodyBytes - pos > 4) && !strncmp(body+pos, "%>>", 3))
+	{
+		dataStart = (const char *)memchr(body+pos+4, '/', bodyBytes-pos-4);
+		if ((dataStart == NULL) || (dataStart[1] != '%'))
+		{
+			appendErrorReply(reply, cmd, SIM_ERR_SYNTAX);
+			return;
+		}
+		varBytes = dataStart - (body+pos+4);
+		if (!parseArrayVar(body+pos+4, varBytes, var, &idx1start, &idx1end, &idx2start, &idx2end))
+		{
+			appendErrorReply(reply, cmd, SIM_ERR_SYNTAX);
+			return;
+		}
+		dataStart += 2;
+
+		// The element offset of a slice depends on the number of doubles that fit in a packet
+		offset = 0;
+		if (cmd == WRITE_LD_ARRAY_CMD)
+		{
+			maxDoublesPerPacket = (MAX_PACKET_DATA - varBytes - 8) / DOUBLE_DATA_SIZE;
+			offset = slice * maxDoublesPerPacket;
+		}
+
+		controller->lock();
+		err = controller->writeArray(var.c_str(), idx1start, idx1end, idx2start, idx2end, offset, dataStart, (body + bodyBytes) - dataStart);
+		controller->unlock();
+
+		if (err)
+		{
+			appendErrorReply(reply, cmd, err);
+			return;
+		}
+
+		reply += (char)ACKNOWLEDGE;
+		reply += (char)cmd;
+		return;
+	}
+
+	appendErrorReply(reply, cmd, SIM_ERR_SYNTAX);
+}
+
+static void connectionThread(void *arg)
+{
+	simConnection_t *connection = (simConnection_t *)arg;
+	SPiiPlusSimController *controller = connection->controller;
+	std::string input, reply;
+	char buffer[MAX_PACKET_SIZE];
+	size_t pos, eol;
+	int nread, frameBytes;
+	bool incomplete;
+
+	while ((nread = recv(connection->sock, buffer, sizeof(buffer), 0)) > 0)
+	{
+		input.append(buffer, nread);
+		reply.clear();
+		pos = 0;
+		incomplete = false;
+
+		// Process every complete message that has been received
+		while ((pos < input.size()) && !incomplete)
+		{
+			if ((unsigned char)input[pos] == FRAME_START)
+			{
+				if (input.size() - pos < 4)
+				{
+					incomplete = true;
+					break;
+				}
+				frameBytes = ((unsigned char)input[pos+2] | ((unsigned char)input[pos+3] << 8)) + 5;
+				if (input.size() - pos < (size_t)frameBytes)
+				{
+					incomplete = true;
+					break;
+				}
+				processBinary(controller, input.data()+pos, frameBytes, reply);
+				pos += frameBytes;
+			}
+			else if ((input[pos] == '\r') || (input[pos] == '\n'))
+			{
+				pos++;
+			}
+			else
+			{
+				eol = input.find_first_of("\r\n", pos);
+				if (eol == std::string::npos)
+				{
+					if (input.size() - pos > SIM_MAX_LINE) pos = input.size();
+					incomplete = true;
+					break;
+				}
+				controller->lock();
+				reply += controller->executeAscii(input.substr(pos, eol-pos));
+				controller->unlock();
+				pos = eol + 1;
+			}
+		}
+		input.erase(0, pos);
+
+		if (reply.empty()) continue;
+
+		if ((connection->latency > 0.0) || (connection->bandwidth > 0.0))
+			epicsThreadSleep(connection->latency + ((connection->bandwidth > 0.0) ? (reply.size() / connection->bandwidth) : 0.0));
+
+		if (send(connection->sock, reply.data(), reply.size(), 0) != (int)reply.size())
+			break;
+	}
+
+	if (verbose) printf("Connection closed\n");
+	epicsSocketDestroy(connection->sock);
+	delete connection;
+}
+
+/*
+ * Run the controller cycles, keeping up with the wall clock
+ */
+static void motionThread(void *arg)
+{
+	SPiiPlusSimController *controller = (SPiiPlusSimController *)arg;
+	epicsTimeStamp startTime, now;
+	double cycles = 0.0;
+	double elapsed;
+
+	epicsTimeGetCurrent(&startTime);
+
+	while (true)
+	{
+		epicsThreadSleep(SIM_CYCLE_MS / 1000.0);
+		epicsTimeGetCurrent(&now);
+		elapsed = epicsTimeDiffInSeconds(&now, &startTime) * 1000.0 / SIM_CYCLE_MS;
+
+		// Don't try to catch up after a long stall
+		if (elapsed - cycles > 1000.0) cycles = elapsed - 1000.0;
+
+		controller->lock();
+		while (cycles + 1.0 <= elapsed)
+		{
+			controller->cycle();
+			cycles += 1.0;
+		}
+		controller->unlock();
+	}
+}
+
+/*
+ * Print the controller status periodically
+ */
+static void reportThread(void *arg)
+{
+	SPiiPlusSimController *controller = (SPiiPlusSimController *)arg;
+
+	while (true)
+	{
+		epicsThreadSleep(reportPeriod);
+		controller->lock();
+		controller->report(stdout);
+		controller->unlock();
+		fflush(stdout);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	SPiiPlusSimController *controller;
+	simConnection_t *connection;
+	osiSockAddr addr;
+	osiSocklen_t addrSize;
+	SOCKET listenSock, sock;
+	int port = SIM_DEFAULT_PORT;
+	int numAxes = SIM_DEFAULT_AXES;
+	double latency = 0.0;
+	double bandwidth = 0.0;
+	int opt, flag;
+
+	while ((opt = getopt(argc, argv, "p:n:l:b:s:vh")) != -1)
+	{
+		switch (opt)
+		{
+			case 'p':
+				port = atoi(optarg);
+				break;
+			case 'n':
+				numAxes = atoi(optarg);
+				break;
+			case 'l':
+				latency = atof(optarg) / 1000.0;
+				break;
+			case 'b':
+				bandwidth = atof(optarg);
+				break;
+			case 's':
+				reportPeriod = atof(optarg);
+				break;
+			case 'v':
+				verbose = true;
+				break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	if ((numAxes < 1) || (numAxes > SIM_MAX_AXES))
+	{
+		fprintf(stderr, "The number of axes must be between 1 and %i\n", SIM_MAX_AXES);
+		return 1;
+	}
+
+	if (osiSockAttach() == 0)
+	{
+		fprintf(stderr, "Unable to initialize the socket library\n");
+		return 1;
+	}
+
+	listenSock = epicsSocketCreate(AF_INET, SOCK_STREAM, 0);
+	if (listenSock == INVALID_SOCKET)
+	{
+		fprintf(stderr, "Unable to create a socket\n");
+		return 1;
+	}
+	epicsSocketEnableAddressReuseDuringTimeWaitState(listenSock);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.ia.sin_family = AF_INET;
+	addr.ia.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.ia.sin_port = htons(port);
+
+	if ((bind(listenSock, &addr.sa, sizeof(addr.ia)) != 0) || (listen(listenSock, 5) != 0))
+	{
+		fprintf(stderr, "Unable to listen on port %i\n", port);
+		epicsSocketDestroy(listenSock);
+		return 1;
+	}
+
+	controller = new SPiiPlusSimController(numAxes, verbose);
+
+	epicsThreadCreate("SPiiPlusSimMotion", epicsThreadPriorityHigh, epicsThreadGetStackSize(epicsThreadStackMedium), (EPICSTHREADFUNC)motionThread, controller);
+
+	if (reportPeriod > 0.0)
+		epicsThreadCreate("SPiiPlusSimReport", epicsThreadPriorityLow, epicsThreadGetStackSize(epicsThreadStackSmall), (EPICSTHREADFUNC)reportThread, controller);
+
+	printf("SPiiPlus simulator: %i axes, port %i, latency %.1f ms, bandwidth %.0f bytes/s (0 = unlimited)\n", numAxes, port, latency * 1000.0, bandwidth);
+	fflush(stdout);
+
+	while (true)
+	{
+		addrSize = sizeof(addr);
+		sock = epicsSocketAccept(listenSock, &addr.sa, &addrSize);
+		if (sock == INVALID_SOCKET) continue;
+
+		flag = 1;
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(flag));
+
+		if (verbose) printf("Connection accepted\n");
+
+		connection = new simConnection_t;
+		connection->sock = sock;
+		connection->controller = controller;
+		connection->latency = latency;
+		connection->bandwidth = bandwidth;
+
+		epicsThreadCreate("SPiiPlusSimConnection", epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackMedium), (EPICSTHREADFUNC)connectionThread, connection);
+	}
+
+	return 0;
+}
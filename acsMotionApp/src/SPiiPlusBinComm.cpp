@@ -1,5 +1,4 @@
 #include <string.h>
-#include <sstream>
 #include <math.h>
 #include <stdio.h>
 
@@ -10,6 +9,111 @@
  * The SPiiPlusDriver uses its writeReadBinary method to send the commands.
  */
 
+/*
+ * Write the decimal representation of value to output without using the heap.
+ * Returns the number of characters written (no terminating null).
+ */
+static int formatInt(char *output, int value)
+{
+	char digits[12];
+	int numDigits=0;
+	int len=0;
+	unsigned int magnitude;
+	
+	if (value < 0)
+	{
+		output[len++] = '-';
+		magnitude = 0u - (unsigned int)value;
+	}
+	else
+	{
+		magnitude = (unsigned int)value;
+	}
+	
+	do
+	{
+		digits[numDigits++] = '0' + (magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude);
+	
+	while (numDigits)
+	{
+		output[len++] = digits[--numDigits];
+	}
+	
+	return len;
+}
+
+/*
+ * Format the variable part of a binary command, VAR(a,b)(c,d), into a caller-supplied buffer.
+ * The buffer needs room for strlen(var) + 50 characters. Returns the number of characters
+ * written (no terminating null).
+ */
+//  formatArrayVar(      buffer,          "APOS",             0,           7,             0,           0)
+int formatArrayVar(char *output, const char *var, int idx1start, int idx1end, int idx2start, int idx2end)
+{
+	int len;
+	
+	len = strlen(var);
+	memcpy(output, var, len);
+	output[len++] = '(';
+	len += formatInt(output+len, idx1start);
+	output[len++] = ',';
+	len += formatInt(output+len, idx1end);
+	output[len++] = ')';
+	output[len++] = '(';
+	len += formatInt(output+len, idx2start);
+	output[len++] = ',';
+	len += formatInt(output+len, idx2end);
+	output[len++] = ')';
+	
+	return len;
+}
+
+/*
+ * Find the read command for an array in a cache of prebuilt commands, adding it if it isn't there.
+ * Repeated queries (the polled variables) can then be sent without being encoded again.
+ * Returns NULL if the command isn't cached and the cache is full.
+ */
+binaryFrame_t* findReadArrayFrame(binaryFrame_t *cache, int *cacheSize, int maxCacheSize, const char *var, int dataSize, int idx1start, int idx1end, int idx2start, int idx2end)
+{
+	binaryFrame_t *frame;
+	int i;
+	
+	for (i=0; i<*cacheSize; i++)
+	{
+		frame = &cache[i];
+		if ((frame->dataSize == dataSize) && (frame->idx1start == idx1start) && (frame->idx1end == idx1end) &&
+		    (frame->idx2start == idx2start) && (frame->idx2end == idx2end) && !strcmp(frame->var, var))
+		{
+			return frame;
+		}
+	}
+	
+	if ((*cacheSize >= maxCacheSize) || (strlen(var) >= MAX_FRAME_VAR_LEN))
+	{
+		return NULL;
+	}
+	
+	frame = &cache[*cacheSize];
+	strcpy(frame->var, var);
+	frame->dataSize = dataSize;
+	frame->idx1start = idx1start;
+	frame->idx1end = idx1end;
+	frame->idx2start = idx2start;
+	frame->idx2end = idx2end;
+	
+	if (dataSize == DOUBLE_DATA_SIZE)
+		readFloat64ArrayCmd(frame->frame, var, idx1start, idx1end, idx2start, idx2end, &frame->outBytes, &frame->inBytes, &frame->dataBytes);
+	else
+		readInt32ArrayCmd(frame->frame, var, idx1start, idx1end, idx2start, idx2end, &frame->outBytes, &frame->inBytes, &frame->dataBytes);
+	
+	// Only count the entry once it is complete
+	*cacheSize += 1;
+	
+	return frame;
+}
+
 //  readFloat64ArrayCmd(      buffer,          "APOS",             0,           7,          &out,          &in,          &data)
 int readFloat64ArrayCmd(char *output, const char *var, int idx1start, int idx1end, int *outBytes, int *inBytes, int *dataBytes)
 {
@@ -41,7 +145,6 @@ int readFloat64ArrayCmd(char *output, const char *var, int idx1start, int idx1en
 //  readFloat64ArrayCmd(      buffer,          "APOS",             0,           7,             0,           0,         false,          &out,          &in,          &data)
 int readFloat64ArrayCmd(char *output, const char *var, int idx1start, int idx1end, int idx2start, int idx2end, bool checksum, int *outBytes, int *inBytes, int *dataBytes)
 {
-	std::stringstream varst;
 	int asciiVarSize;
 	int cmdSize;
 	
@@ -54,8 +157,7 @@ int readFloat64ArrayCmd(char *output, const char *var, int idx1start, int idx1en
 		*inBytes = *dataBytes + 5;
 	
 	// The variable string part of the command
-	varst << var << "(" << idx1start << "," << idx1end << ")(" << idx2start << "," << idx2end << ")";
-	asciiVarSize = varst.str().size();
+	asciiVarSize = formatArrayVar(output+8, var, idx1start, idx1end, idx2start, idx2end);
 	// Command = %?? + 0x8 + varst (doesn't include prefix or suffix)
 	cmdSize = asciiVarSize+4;
 	
@@ -80,7 +182,7 @@ int readFloat64ArrayCmd(char *output, const char *var, int idx1start, int idx1en
 	// command
 	strncpy(output+4, "%??", 3);
 	output[7] = DOUBLE_DATA_SIZE;
-	strncpy(output+8, varst.str().c_str(), asciiVarSize);
+	// The variable string was formatted at output+8 above
 	// end
 	output[8+asciiVarSize] = FRAME_END;
 	
@@ -102,7 +204,6 @@ int readFloat64SliceCmd(char *output, int slice, const char *var, int idx1start,
  */
 int readFloat64SliceCmd(char *output, int slice, const char *var, int idx1start, int idx1end, int idx2start, int idx2end, bool checksum, int *outBytes, int *inBytes, int *dataBytes)
 {
-	std::stringstream varst;
 	int asciiVarSize;
 	int cmdSize;
 	int numSlices;
@@ -126,12 +227,10 @@ int readFloat64SliceCmd(char *output, int slice, const char *var, int idx1start,
 		*inBytes = bytesRemaining + 5;
 	}
 	
-	// The variable string part of the command
-	varst << var << "(" << idx1start << "," << idx1end << ")(" << idx2start << "," << idx2end << ")";
-	asciiVarSize = varst.str().size();
 	// The slice string part of the command (one or two characters)
-	sprintf(sliceStr, "%i", slice);
-	sliceSize = strlen(sliceStr);
+	sliceSize = formatInt(sliceStr, slice);
+	// The variable string part of the command
+	asciiVarSize = formatArrayVar(output+(sliceSize+9), var, idx1start, idx1end, idx2start, idx2end);
 	// Command = % + slice + %?? + 0x8 + varst (doesn't include prefix or suffix)
 	cmdSize = sliceSize + asciiVarSize + 5;
 	
@@ -151,7 +250,7 @@ int readFloat64SliceCmd(char *output, int slice, const char *var, int idx1start,
 	strncpy(output+5, sliceStr, sliceSize);
 	strncpy(output+(sliceSize+5), "%??", 3);
 	output[sliceSize+8] = DOUBLE_DATA_SIZE;
-	strncpy(output+(sliceSize+9), varst.str().c_str(), asciiVarSize);
+	// The variable string was formatted at output+(sliceSize+9) above
 	// end
 	// NOTE: asciiVarSize + 9 + sliceSize = cmdSize + 4
 	output[cmdSize+4] = FRAME_END;
@@ -193,7 +292,6 @@ int readInt32ArrayCmd(char *output, const char *var, int idx1start, int idx1end,
 //  readInt32ArrayCmd(      buffer,         "FAULT",             0,           7,             0,           0,         false,          &out,          &in,          &data)
 int readInt32ArrayCmd(char *output, const char *var, int idx1start, int idx1end, int idx2start, int idx2end, bool checksum, int *outBytes, int *inBytes, int *dataBytes)
 {
-	std::stringstream varst;
 	int asciiVarSize;
 	int cmdSize;
 	
@@ -206,8 +304,7 @@ int readInt32ArrayCmd(char *output, const char *var, int idx1start, int idx1end,
 		*inBytes = *dataBytes + 5;
 	
 	// The variable string part of the command
-	varst << var << "(" << idx1start << "," << idx1end << ")(" << idx2start << "," << idx2end << ")";
-	asciiVarSize = varst.str().size();
+	asciiVarSize = formatArrayVar(output+8, var, idx1start, idx1end, idx2start, idx2end);
 	// Command = %?? + 0x4 + varst (doesn't include prefix or suffix)
 	cmdSize = asciiVarSize+4;
 	
@@ -232,7 +329,7 @@ int readInt32ArrayCmd(char *output, const char *var, int idx1start, int idx1end,
 	// command
 	strncpy(output+4, "%??", 3);
 	output[7] = INT_DATA_SIZE;
-	strncpy(output+8, varst.str().c_str(), asciiVarSize);
+	// The variable string was formatted at output+8 above
 	// end
 	output[8+asciiVarSize] = FRAME_END;
 	
@@ -254,7 +351,6 @@ int readInt32SliceCmd(char *output, int slice, const char *var, int idx1start, i
  */
 int readInt32SliceCmd(char *output, int slice, const char *var, int idx1start, int idx1end, int idx2start, int idx2end, bool checksum, int *outBytes, int *inBytes, int *dataBytes)
 {
-	std::stringstream varst;
 	int asciiVarSize;
 	int cmdSize;
 	int numSlices;
@@ -278,12 +374,10 @@ int readInt32SliceCmd(char *output, int slice, const char *var, int idx1start, i
 		*inBytes = bytesRemaining + 5;
 	}
 	
-	// The variable string part of the command
-	varst << var << "(" << idx1start << "," << idx1end << ")(" << idx2start << "," << idx2end << ")";
-	asciiVarSize = varst.str().size();
 	// The slice string part of the command (one or two characters)
-	sprintf(sliceStr, "%i", slice);
-	sliceSize = strlen(sliceStr);
+	sliceSize = formatInt(sliceStr, slice);
+	// The variable string part of the command
+	asciiVarSize = formatArrayVar(output+(sliceSize+9), var, idx1start, idx1end, idx2start, idx2end);
 	// Command = % + slice + %?? + 0x4 + varst (doesn't include prefix or suffix)
 	cmdSize = sliceSize + asciiVarSize + 5;
 	
@@ -303,7 +397,7 @@ int readInt32SliceCmd(char *output, int slice, const char *var, int idx1start, i
 	strncpy(output+5, sliceStr, sliceSize);
 	strncpy(output+(sliceSize+5), "%??", 3);
 	output[sliceSize+8] = INT_DATA_SIZE;
-	strncpy(output+(sliceSize+9), varst.str().c_str(), asciiVarSize);
+	// The variable string was formatted at output+(sliceSize+9) above
 	// end
 	// NOTE: asciiVarSize + 9 + sliceSize = cmdSize + 4
 	output[cmdSize+4] = FRAME_END;
@@ -347,7 +441,7 @@ int writeFloat64ArrayCmd(char *output, const char *var, int idx1start, int idx1e
 //  writeFloat64ArrayCmd(      buffer,          "APOS",             0,           7,             0,           0,        &data,         false,         0,     &remainingSlices,          &out,          &in,     &packetDoubles)
 int writeFloat64ArrayCmd(char *output, const char *var, int idx1start, int idx1end, int idx2start, int idx2end, double *data, bool checksum, int slice, int *remainingSlices, int *outBytes, int *inBytes, int *packetDoubles)
 {
-	std::stringstream varst;
+	char varStr[MAX_MESSAGE_LEN];
 	int asciiVarSize;
 	int cmdSize;
 	bool multiPacket;
@@ -368,8 +462,7 @@ int writeFloat64ArrayCmd(char *output, const char *var, int idx1start, int idx1e
 	totalDataBytes = numDoubles * DOUBLE_DATA_SIZE;
 	
 	// The variable string part of the command
-	varst << var << "(" << idx1start << "," << idx1end << ")(" << idx2start << "," << idx2end << ")";
-	asciiVarSize = varst.str().size();
+	asciiVarSize = formatArrayVar(varStr, var, idx1start, idx1end, idx2start, idx2end);
 	
 	/*
 	 * The format of the command (and size of its components):
@@ -462,8 +555,7 @@ int writeFloat64ArrayCmd(char *output, const char *var, int idx1start, int idx1e
 		output[offset] = '%';
 		offset += 1;
 		
-		sliceSize = sprintf(sliceStr, "%i", slice);
-		output[offset] = slice;
+		sliceSize = formatInt(sliceStr, slice);
 		memcpy(output+offset, sliceStr, sliceSize);
 		offset += sliceSize;
 	}
@@ -471,7 +563,7 @@ int writeFloat64ArrayCmd(char *output, const char *var, int idx1start, int idx1e
 	offset += 3;
 	output[offset] = DOUBLE_DATA_SIZE;
 	offset += 1;
-	strncpy(output+offset, varst.str().c_str(), asciiVarSize);
+	memcpy(output+offset, varStr, asciiVarSize);
 	offset += asciiVarSize;
 	// data
 	memcpy(output+offset, "/%", 2);
@@ -1,9 +1,14 @@
+#ifndef SPIIPLUS_BIN_COMM_H
+#define SPIIPLUS_BIN_COMM_H
+
 #define MAX_MESSAGE_LEN		256
 #define MAX_PACKET_SIZE		1405
 #define MAX_PACKET_DATA		1400
 //
 #define FRAME_START 		0xd3
 #define FRAME_END 		0xd6
+#define REPLY_START 		0xe3
+#define REPLY_END 		0xe6
 //
 #define INT_DATA_SIZE 		0x04
 #define DOUBLE_DATA_SIZE	0x08
@@ -25,6 +30,25 @@
 #define WRITE_LI_ARRAY_CMD	0x3A
 #define WRITE_LI_SLICE_CMD	0x3B
 #define ACKNOWLEDGE		0xe9
+//
+#define MAX_FRAME_VAR_LEN	32
+
+// A prebuilt read command, cached so that repeated queries don't need to be encoded again
+typedef struct binaryFrame {
+	char var[MAX_FRAME_VAR_LEN];
+	int dataSize;
+	int idx1start;
+	int idx1end;
+	int idx2start;
+	int idx2end;
+	int outBytes;
+	int inBytes;
+	int dataBytes;
+	char frame[MAX_MESSAGE_LEN];
+} binaryFrame_t;
+
+int formatArrayVar(char *output, const char *var, int idx1start, int idx1end, int idx2start, int idx2end);
+binaryFrame_t* findReadArrayFrame(binaryFrame_t *cache, int *cacheSize, int maxCacheSize, const char *var, int dataSize, int idx1start, int idx1end, int idx2start, int idx2end);
 
 int readFloat64ArrayCmd(char *output, const char *var, int idx1start, int idx1end, int *outBytes, int *inBytes, int *dataBytes);
 int readFloat64ArrayCmd(char *output, const char *var, int idx1start, int idx1end, bool checksum, int *outBytes, int *inBytes, int *dataBytes);
@@ -46,3 +70,5 @@ int writeFloat64ArrayCmd(char *output, const char *var, int idx1start, int idx1e
 int writeFloat64ArrayCmd(char *output, const char *var, int idx1start, int idx1end, double *data, bool checksum, int slice, int *remainingSlices, int *outBytes, int *inBytes, int *packetDoubles);
 int writeFloat64ArrayCmd(char *output, const char *var, int idx1start, int idx1end, int idx2start, int idx2end, double *data, int slice, int *remainingSlices, int *outBytes, int *inBytes, int *packetDoubles);
 int writeFloat64ArrayCmd(char *output, const char *var, int idx1start, int idx1end, int idx2start, int idx2end, double *data, bool checksum, int slice, int *remainingSlices, int *outBytes, int *inBytes, int *packetDoubles);
+
+#endif /* SPIIPLUS_BIN_COMM_H */
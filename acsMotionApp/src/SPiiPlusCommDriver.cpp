@@ -30,6 +30,15 @@ SPiiPlusComm::SPiiPlusComm(const char *commPortName, const char* asynPortName, i
 {
 	// Can numChannels be zero for this class?
 	
+	pasynUserBinary_ = NULL;
+	frameCacheSize_ = 0;
+	binaryMode_ = false;
+	dedicatedBinaryPort_ = false;
+	binaryTransactions_ = 0;
+	eosChanges_ = 0;
+	binaryTime_ = 0.0;
+	maxBinaryTime_ = 0.0;
+	
 	// 
 	asynStatus status = pasynOctetSyncIO->connect(asynPortName, 0, &pasynUserComm_, NULL);
 	
@@ -40,15 +49,110 @@ SPiiPlusComm::SPiiPlusComm(const char *commPortName, const char* asynPortName, i
 		
 		return;
 	}
+	
+	// Binary commands share the ASCII connection until connectBinaryPort is called
+	pasynUserBinary_ = pasynUserComm_;
 }
 
 
 // This is needed to resolve a build error: undefined reference to `vtable for SPiiPlusComm'
 SPiiPlusComm::~SPiiPlusComm()
 {
+	if (dedicatedBinaryPort_)
+	{
+		pasynOctetSyncIO->disconnect(pasynUserBinary_);
+	}
 	pasynOctetSyncIO->disconnect(pasynUserComm_);
 }
 
+/*
+ * Send binary commands over a second connection to the controller (for example, a second
+ * TCP/IP connection) so the EOS characters never need to change.
+ */
+asynStatus SPiiPlusComm::connectBinaryPort(const char *asynPortName)
+{
+	asynUser *pasynUser;
+	asynStatus status;
+	static const char *functionName = "connectBinaryPort";
+	
+	status = pasynOctetSyncIO->connect(asynPortName, 0, &pasynUser, NULL);
+	if (status != asynSuccess)
+	{
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: cannot connect to binary port %s\n", driverName, functionName, asynPortName);
+		return status;
+	}
+	
+	// Binary replies can contain any character, so the port must not have EOS characters
+	pasynOctetSyncIO->setInputEos(pasynUser, "", 0);
+	pasynOctetSyncIO->setOutputEos(pasynUser, "", 0);
+	
+	lock();
+	// Leave the shared connection ready for ASCII commands
+	setBinaryMode(false);
+	if (dedicatedBinaryPort_)
+	{
+		pasynOctetSyncIO->disconnect(pasynUserBinary_);
+	}
+	pasynUserBinary_ = pasynUser;
+	dedicatedBinaryPort_ = true;
+	unlock();
+	
+	return asynSuccess;
+}
+
+/*
+ * The EOS characters of the shared connection are only changed when switching between
+ * ASCII and binary commands, instead of around every binary command.
+ */
+void SPiiPlusComm::setBinaryMode(bool binaryMode)
+{
+	if (dedicatedBinaryPort_ || (binaryMode == binaryMode_)) return;
+	
+	if (binaryMode)
+	{
+		pasynOctetSyncIO->setInputEos(pasynUserComm_, "", 0);
+		pasynOctetSyncIO->setOutputEos(pasynUserComm_, "", 0);
+	}
+	else
+	{
+		pasynOctetSyncIO->setInputEos(pasynUserComm_, "\r", 1);
+		pasynOctetSyncIO->setOutputEos(pasynUserComm_, "\r", 1);
+	}
+	
+	binaryMode_ = binaryMode;
+	eosChanges_++;
+}
+
+void SPiiPlusComm::report(FILE *fp, int details)
+{
+	fprintf(fp, "    binary port: %s\n", dedicatedBinaryPort_ ? "dedicated" : "shared");
+	fprintf(fp, "    binary transactions: %lu\n", binaryTransactions_);
+	if (binaryTransactions_ > 0)
+	{
+		fprintf(fp, "    binary transaction time: mean = %.3lf ms, max = %.3lf ms\n", (binaryTime_ / binaryTransactions_ * 1000.0), (maxBinaryTime_ * 1000.0));
+	}
+	fprintf(fp, "    EOS changes: %lu\n", eosChanges_);
+	fprintf(fp, "    cached binary commands: %i of %i\n", frameCacheSize_, SPIIPLUS_FRAME_CACHE_SIZE);
+	
+	if (details > 0)
+	{
+		asynPortDriver::report(fp, details);
+	}
+}
+
+void SPiiPlusComm::updateBinaryStats(epicsTimeStamp *startTime)
+{
+	epicsTimeStamp endTime;
+	double elapsed;
+	
+	epicsTimeGetCurrent(&endTime);
+	elapsed = epicsTimeDiffInSeconds(&endTime, startTime);
+	
+	binaryTransactions_++;
+	binaryTime_ += elapsed;
+	if (elapsed > maxBinaryTime_) maxBinaryTime_ = elapsed;
+}
+
 // Note: This method is copied from asynMotorController.cpp
 /** Writes a string to the controller and reads a response.
   * \param[in] output Pointer to the output string.
@@ -58,14 +162,26 @@ SPiiPlusComm::~SPiiPlusComm()
   * \param[out] timeout Timeout before returning an error.*/
 asynStatus SPiiPlusComm::writeReadController(const char *output, char *input, 
                                                     size_t maxChars, size_t *nread, double timeout)
+{
+  return writeReadController(output, strlen(output), input, maxChars, nread, timeout);
+}
+
+/** Writes outChars characters to the controller and reads a response.
+  * The output doesn't need to be NUL-terminated. */
+asynStatus SPiiPlusComm::writeReadController(const char *output, size_t outChars, char *input, 
+                                                    size_t maxChars, size_t *nread, double timeout)
 {
   size_t nwrite;
   asynStatus status;
   int eomReason;
   // const char *functionName="writeReadController";
   
+  lock();
+  setBinaryMode(false);
+  unlock();
+  
   status = pasynOctetSyncIO->writeRead(pasynUserComm_, output,
-                                       strlen(output), input, maxChars, timeout,
+                                       outChars, input, maxChars, timeout,
                                        &nwrite, nread, &eomReason);
                         
   return status;
@@ -255,6 +371,127 @@ asynStatus SPiiPlusComm::writeReadAck(std::stringstream& cmd)
 	return status;
 }
 
+/*
+ * Send several immediate commands in a single write and parse the reply of each one.
+ * The controller answers every command with either a ':' prompt or an "?####" error,
+ * so the replies can be matched to the commands in order.  The errNos vector (optional)
+ * receives 0 or the error number of each command.  The commands are cleared on return.
+ */
+asynStatus SPiiPlusComm::writeReadBatch(std::vector<std::string>& cmds, std::vector<int> *errNos)
+{
+	static const char *functionName = "writeReadBatch";
+	std::string output;
+	size_t i;
+	asynStatus status;
+	std::vector<int> localErrNos;
+	std::vector<int>& errors = (errNos != NULL) ? *errNos : localErrNos;
+	
+	for (i=0; i<cmds.size(); i++)
+	{
+		if (i > 0)
+			output += "\r";
+		output += cmds[i];
+	}
+	
+	status = writeReadBlock(output.c_str(), output.size(), cmds.size(), &errors);
+	
+	for (i=0; i<errors.size(); i++)
+	{
+		if (errors[i] != 0)
+			asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Command failed: %s\n", driverName, functionName, cmds[i].c_str());
+	}
+	
+	cmds.clear();
+	
+	return status;
+}
+
+/*
+ * Write a block of numCmds immediate commands, already separated by carriage returns, and
+ * parse the reply of each one like writeReadBatch.  The block is outChars long and doesn't
+ * need to be NUL-terminated, so callers can send a range of a preformatted buffer.
+ */
+asynStatus SPiiPlusComm::writeReadBlock(const char *output, size_t outChars, size_t numCmds, std::vector<int> *errNos)
+{
+	static const char *functionName = "writeReadBlock";
+	char inString[MAX_CONTROLLER_STRING_SIZE];
+	size_t nread, numReplies, i;
+	int eomReason;
+	char *ptr;
+	asynStatus status = asynSuccess;
+	asynStatus readStatus;
+	std::vector<int> localErrNos;
+	std::vector<int>& errors = (errNos != NULL) ? *errNos : localErrNos;
+	
+	errors.assign(numCmds, 0);
+	
+	if (numCmds == 0)
+		return asynSuccess;
+	
+	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: output = %.*s\n", driverName, functionName, (int)outChars, output);
+	
+	std::fill(inString, inString + MAX_CONTROLLER_STRING_SIZE, '\0');
+	
+	// Hold the lock until every reply has been read so no other command can be interleaved
+	lock();
+	readStatus = writeReadController(output, outChars, inString, MAX_CONTROLLER_STRING_SIZE-1, &nread, -1);
+	
+	numReplies = 0;
+	while ((readStatus == asynSuccess) && (numReplies < numCmds))
+	{
+		inString[nread] = '\0';
+		asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s:  input = %s\n", driverName, functionName, inString);
+		
+		ptr = inString;
+		while ((*ptr != '\0') && (numReplies < numCmds))
+		{
+			if (*ptr == ':')
+			{
+				numReplies++;
+				ptr++;
+			}
+			else if (*ptr == '?')
+			{
+				errors[numReplies] = strtol(ptr+1, &ptr, 10);
+				
+				asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Command %i of %i failed\n", driverName, functionName, (int)numReplies+1, (int)numCmds);
+				numReplies++;
+				status = asynError;
+			}
+			else
+			{
+				// Skip the terminators between replies
+				ptr++;
+			}
+		}
+		
+		if (numReplies < numCmds)
+		{
+			// The remaining replies arrive in later reads
+			std::fill(inString, inString + MAX_CONTROLLER_STRING_SIZE, '\0');
+			readStatus = pasynOctetSyncIO->read(pasynUserComm_, inString, MAX_CONTROLLER_STRING_SIZE-1, SPIIPLUS_BATCH_TIMEOUT, &nread, &eomReason);
+		}
+	}
+	
+	// Query the error messages only after all the replies have been consumed
+	for (i=0; i<errors.size(); i++)
+	{
+		if (errors[i] != 0)
+			writeReadBinaryErrorMessage(errors[i]);
+	}
+	unlock();
+	
+	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: %i of %i replies, status = %i\n", driverName, functionName, (int)numReplies, (int)numCmds, readStatus);
+	
+	if (readStatus != asynSuccess)
+	{
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Only %i of %i replies received\n", driverName, functionName, (int)numReplies, (int)numCmds);
+		status = readStatus;
+	}
+	
+	return status;
+}
+
 asynStatus SPiiPlusComm::writeReadErrorMessage(char* errNoReply)
 {
 	static const char *functionName = "writeReadErrorMessage";
@@ -334,99 +571,175 @@ asynStatus SPiiPlusComm::writeReadBinaryErrorMessage(int errNo)
 	return status;
 }
 
+/*
+ * Read exactly numBytes.  A read can return fewer bytes than requested when there are no EOS
+ * characters, so keep reading until everything arrives or the read fails.
+ */
+asynStatus SPiiPlusComm::readBinaryBytes(char *buffer, size_t numBytes, double timeout)
+{
+	size_t nread, totalRead=0;
+	int eomReason;
+	asynStatus status = asynSuccess;
+	
+	while (totalRead < numBytes)
+	{
+		status = pasynOctetSyncIO->read(pasynUserBinary_, buffer+totalRead, numBytes-totalRead, timeout, &nread, &eomReason);
+		if (status != asynSuccess) break;
+		totalRead += nread;
+	}
+	
+	return status;
+}
+
+/*
+ * Read a binary reply: [E3][cmd][length LSB][length MSB] body [E6]
+ * The 4-byte header is read into packetBuffer_ first, then exactly the body length it advertises
+ * plus the suffix.  The body is read straight into the destination when it fits; otherwise (for
+ * example, an error reply to a query for a single integer) it is read into packetBuffer_.
+ * Bytes that precede the start of a reply (left over from an earlier timeout) are discarded.
+ */
+asynStatus SPiiPlusComm::readBinaryReply(char *body, int maxBodyBytes, double timeout, size_t *nread, bool *bodyInPacketBuffer)
+{
+	int bodyBytes;
+	int discarded=0;
+	asynStatus status;
+	static const char *functionName = "readBinaryReply";
+	
+	*nread = 0;
+	*bodyInPacketBuffer = false;
+	
+	status = readBinaryBytes(packetBuffer_, 4, timeout);
+	if (status != asynSuccess) return status;
+	
+	while (((unsigned char)packetBuffer_[0] != REPLY_START) && (discarded < MAX_PACKET_SIZE))
+	{
+		memmove(packetBuffer_, packetBuffer_+1, 3);
+		status = readBinaryBytes(packetBuffer_+3, 1, timeout);
+		if (status != asynSuccess) return status;
+		discarded++;
+	}
+	
+	if (discarded > 0)
+	{
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Discarded %i bytes before the reply\n", driverName, functionName, discarded);
+	}
+	
+	// The most-significant bit of the body length is the slice-available flag
+	bodyBytes = ((int)((unsigned char)packetBuffer_[3] & ~SLICE_AVAILABLE) << 8) | (int)(unsigned char)packetBuffer_[2];
+	if ((bodyBytes + 5) > MAX_PACKET_SIZE)
+	{
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Reply body is too long: %i bytes\n", driverName, functionName, bodyBytes);
+		return asynError;
+	}
+	
+	if (bodyBytes <= maxBodyBytes)
+	{
+		status = readBinaryBytes(body, bodyBytes, timeout);
+		if (status != asynSuccess) return status;
+		
+		status = readBinaryBytes(packetBuffer_+4+bodyBytes, 1, timeout);
+		if (status != asynSuccess) return status;
+		
+		// Error replies have a 6-byte body; keep a complete copy for binaryErrorCheck
+		if (bodyBytes == 6)
+		{
+			memcpy(packetBuffer_+4, body, bodyBytes);
+		}
+	}
+	else
+	{
+		*bodyInPacketBuffer = true;
+		status = readBinaryBytes(packetBuffer_+4, bodyBytes+1, timeout);
+		if (status != asynSuccess) return status;
+	}
+	
+	if ((unsigned char)packetBuffer_[bodyBytes+4] != REPLY_END)
+	{
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Incorrect reply suffix: %x\n", driverName, functionName, (unsigned char)packetBuffer_[bodyBytes+4]);
+		return asynError;
+	}
+	
+	*nread = bodyBytes + 5;
+	
+	return status;
+}
+
 // NOTE: readBytes the number of data bytes that were read, excluding the command header and suffix
-// NOTE: there is no error checking on inBytes and outBytes
+// NOTE: there is no error checking on outBytes
 // FYI: motor/motorApp/MotorSrc/asynMotorController.h:#define MAX_CONTROLLER_STRING_SIZE 256
 asynStatus SPiiPlusComm::writeReadBinary(char *output, int outBytes, char *input, int inBytes, size_t *dataBytes, bool *sliceAvailable)
 {
-	char outString[MAX_CONTROLLER_STRING_SIZE];
-	char* packetBuffer;
-	size_t nwrite, nread;
-	int eomReason;
+	size_t nwrite, nread=0;
 	int errNo = 0;
+	bool bodyInPacketBuffer = false;
 	asynStatus status;
+	epicsTimeStamp startTime;
 	static const char *functionName = "writeReadBinary";
 	
 	asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: start\n", driverName, functionName);
 	
 	lock();
 	
-	std::fill(outString, outString + MAX_CONTROLLER_STRING_SIZE, '\0');
-	packetBuffer = (char *)calloc(MAX_PACKET_DATA+5, sizeof(char));
+	epicsTimeGetCurrent(&startTime);
+	*sliceAvailable = false;
+	*dataBytes = 0;
 	
-	// Clear the EOS characters
-	pasynOctetSyncIO->setInputEos(pasynUserComm_, "", 0);
-	pasynOctetSyncIO->setOutputEos(pasynUserComm_, "", 0);
-	
-	// Flush the receive buffer
-	status = pasynOctetSyncIO->flush(pasynUserComm_);
+	// Clear the EOS characters, if the previous command was an ASCII command
+	setBinaryMode(true);
 	
 	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: output bytes = %i, output = %s\n", driverName, functionName, outBytes, output);
 	
 	// Send the query command
-	memcpy(outString, output, outBytes);
-	status = pasynOctetSyncIO->write(pasynUserComm_, outString, outBytes, SPIIPLUS_CMD_TIMEOUT, &nwrite);
+	status = pasynOctetSyncIO->write(pasynUserBinary_, output, outBytes, SPIIPLUS_CMD_TIMEOUT, &nwrite);
 	
-	// The reply from the controller has a 4-byte header and a 1-byte suffix
-	status = pasynOctetSyncIO->read(pasynUserComm_, packetBuffer, inBytes, SPIIPLUS_ARRAY_TIMEOUT, &nread, &eomReason);
+	// The reply from the controller has a 4-byte header and a 1-byte suffix; the data is read
+	// straight into the input buffer. It is already in little-endian format.
+	if (status == asynSuccess)
+	{
+		status = readBinaryReply(input, inBytes-5, SPIIPLUS_ARRAY_TIMEOUT, &nread, &bodyInPacketBuffer);
+	}
 	
-	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: input bytes = %i\n", driverName, functionName, inBytes);
+	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: input bytes = %i, nread = %li\n", driverName, functionName, inBytes, nread);
 	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: status = %i\n", driverName, functionName, status);
 	
 	if (status == asynSuccess)
 	{
 		// Check for an error reply
-		errNo = binaryErrorCheck(packetBuffer, nread);
+		errNo = binaryErrorCheck(packetBuffer_, nread);
 		if (errNo != 0)
 		{
-			*sliceAvailable = false;
 			asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Binary read failed (controller)\n", driverName, functionName);
 			status = asynError;
 		}
+		else if (bodyInPacketBuffer)
+		{
+			asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Reply is longer than expected: expected = %i, read = %li\n", driverName, functionName, inBytes, nread);
+			status = asynError;
+		}
 		else
 		{
 			// Check if there is another slice
 			/*
 			 * Bit 7 of the 3rd byte, which is the most-significant byte of the BE message size, indicates if another slice is available
 			 */
-			if (packetBuffer[3] & SLICE_AVAILABLE)
+			if (packetBuffer_[3] & SLICE_AVAILABLE)
 			{
 				*sliceAvailable = true;
 			}
-			else
-			{
-				*sliceAvailable = false;
-			}
 			
 			// Subtract the 5 header bytes to get the number of bytes in the data
 			*dataBytes = nread - 5;
-			
-			// The data is already in little-endian format, so just copy it
-			memcpy(input, packetBuffer+4, *dataBytes);
 		}
 	}
 	else
 	{
-		*sliceAvailable = false;
 		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Binary read failed (asyn): status=%i, nread=%li\n", driverName, functionName, status, nread);
 		
-		// If fewer bytes were read and there was an asyn timeout, there might still be an error message
-		if (nread > 0)
-		{
-			errNo = binaryErrorCheck(packetBuffer, nread);
-			if (errNo != 0)
-			{
-				status = asynError;
-			}
-		}
+		// Discard the rest of the reply so the next command starts cleanly
+		pasynOctetSyncIO->flush(pasynUserBinary_);
 	}
 	
-	// Restore the EOS characters
-	pasynOctetSyncIO->setInputEos(pasynUserComm_, "\r", 1);
-	pasynOctetSyncIO->setOutputEos(pasynUserComm_, "\r", 1);
-
-	// Free up allocated memory
-	free(packetBuffer);
+	updateBinaryStats(&startTime);
 	
 	unlock();
 	
@@ -554,57 +867,73 @@ asynStatus SPiiPlusComm::isVariableDefined(bool *isDefined, const char *var)
  */
 asynStatus SPiiPlusComm::writeReadAckBinary(char *output, int outBytes, char *input, int inBytes)
 {
-	size_t nwrite, nread, extraRead;
-	int eomReason;
+	size_t nwrite, nread=0;
 	int commandID;
+	int bodyBytes;
 	int errNo = 0;
 	asynStatus status;
+	epicsTimeStamp startTime;
 	static const char *functionName = "writeReadAckBinary";
 	
 	asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: start\n", driverName, functionName);
 	
 	lock();
 	
-	// Clear the EOS characters
-	pasynOctetSyncIO->setInputEos(pasynUserComm_, "", 0);
-	pasynOctetSyncIO->setOutputEos(pasynUserComm_, "", 0);
+	epicsTimeGetCurrent(&startTime);
 	
-	// Flush the receive buffer
-	status = pasynOctetSyncIO->flush(pasynUserComm_);
+	// Clear the EOS characters, if the previous command was an ASCII command
+	setBinaryMode(true);
 	
 	// Save the command ID
 	commandID = output[1];
 	
 	// Send the command
-	status = pasynOctetSyncIO->write(pasynUserComm_, output, outBytes, SPIIPLUS_ARRAY_TIMEOUT, &nwrite);
+	status = pasynOctetSyncIO->write(pasynUserBinary_, output, outBytes, SPIIPLUS_ARRAY_TIMEOUT, &nwrite);
 	
 	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: status = %i; output bytes = %i, nwrite = %li\n", driverName, functionName, status, outBytes, nwrite);
 
 	// A successful reply from the controller is 2 bytes (ack & command ID) 
 	// NOTE: the comand timeout is too short and the array timeout is overkill
-	status = pasynOctetSyncIO->read(pasynUserComm_, input, inBytes, SPIIPLUS_ACK_TIMEOUT, &nread, &eomReason);
+	if (status == asynSuccess)
+	{
+		status = readBinaryBytes(input, 2, SPIIPLUS_ACK_TIMEOUT);
+		nread = 2;
+	}
 	
-	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: status = %i; input bytes = %i, nread = %li\n", driverName, functionName, status, inBytes, nread);
+	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: status = %i; input bytes = %i\n", driverName, functionName, status, inBytes);
 	
 	// A successful read doesn't necessarily mean the command succeeded
 	if (status == asynSuccess)
 	{
 		// Confirm write was successful
-		if ((unsigned char)input[0] != ACKNOWLEDGE)
+		if ((unsigned char)input[0] == REPLY_START)
 		{
-			// Error messages are more than 2 characters and we only read 2 so far. Read the rest now.
-			status = pasynOctetSyncIO->read(pasynUserComm_, input+inBytes, MAX_MESSAGE_LEN, SPIIPLUS_ACK_TIMEOUT, &extraRead, &eomReason);
+			// Error replies have a 4-byte header. Read the rest of the header, then the body and suffix.
+			status = readBinaryBytes(input+2, 2, SPIIPLUS_ACK_TIMEOUT);
+			if (status == asynSuccess)
+			{
+				bodyBytes = ((int)((unsigned char)input[3] & ~SLICE_AVAILABLE) << 8) | (int)(unsigned char)input[2];
+				if ((bodyBytes + 5) <= MAX_MESSAGE_LEN)
+				{
+					status = readBinaryBytes(input+4, bodyBytes+1, SPIIPLUS_ACK_TIMEOUT);
+					nread = bodyBytes + 5;
+				}
+			}
 			
-			asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,    "%s:%s: status = %i; extraRead = %li, eomReason = %i\n", driverName, functionName, status, extraRead, eomReason);
+			asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,    "%s:%s: status = %i; nread = %li\n", driverName, functionName, status, nread);
 			
 			// Check for an error reply
-			errNo = binaryErrorCheck(input, nread+extraRead);
+			errNo = binaryErrorCheck(input, nread);
 			if (errNo != 0)
 			{
 				asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Binary read failed (controller)\n", driverName, functionName);
-				status = asynError;
 			}
-		
+			status = asynError;
+		}
+		else if ((unsigned char)input[0] != ACKNOWLEDGE)
+		{
+			asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Unexpected reply: %x %x\n", driverName, functionName, (unsigned char)input[0], (unsigned char)input[1]);
+			status = asynError;
 		}
 		else
 		{
@@ -621,12 +950,16 @@ asynStatus SPiiPlusComm::writeReadAckBinary(char *output, int outBytes, char *in
 	}
 	else
 	{
-		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Binary read failed (asyn): status=%i, nread=%li\n", driverName, functionName, status, nread);
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Binary read failed (asyn): status=%i\n", driverName, functionName, status);
 	}
 	
-	// Restore the EOS characters
-	pasynOctetSyncIO->setInputEos(pasynUserComm_, "\r", 1);
-	pasynOctetSyncIO->setOutputEos(pasynUserComm_, "\r", 1);
+	if (status != asynSuccess)
+	{
+		// Discard the rest of the reply so the next command starts cleanly
+		pasynOctetSyncIO->flush(pasynUserBinary_);
+	}
+	
+	updateBinaryStats(&startTime);
 	
 	unlock();
 	
@@ -641,10 +974,23 @@ asynStatus SPiiPlusComm::writeReadAckBinary(char *output, int outBytes, char *in
 	return status;
 }
 
-asynStatus SPiiPlusComm::getDoubleArray(char *output, const char *var, int idx1start, int idx1end, int idx2start, int idx2end)
+/*
+ * Forget the cached read commands, e.g. when the ranges of the polled variables change, so the
+ * commands of the new ranges can be cached.
+ */
+void SPiiPlusComm::clearFrameCache()
+{
+	lock();
+	frameCacheSize_ = 0;
+	unlock();
+}
+
+asynStatus SPiiPlusComm::getDoubleArray(char *output, const char *var, int idx1start, int idx1end, int idx2start, int idx2end, bool cacheFrame)
 {
 	//char outString[MAX_CONTROLLER_STRING_SIZE];
 	char command[MAX_MESSAGE_LEN];
+	char *initialCommand;
+	binaryFrame_t *frame;
 	asynStatus status;
 	int remainingBytes;
 	int readBytes;
@@ -659,8 +1005,24 @@ asynStatus SPiiPlusComm::getDoubleArray(char *output, const char *var, int idx1s
 	//std::fill(outString, outString + MAX_CONTROLLER_STRING_SIZE, '\0');
 	
 	// Create the command to query array data. This could be the only command
-	// that needs to be sent or it could be the first of many.
-	readFloat64ArrayCmd(command, var, idx1start, idx1end, idx2start, idx2end, &outBytes, &inBytes, &dataBytes);
+	// that needs to be sent or it could be the first of many. Repeated queries use a cached command;
+	// callers that read a different range every time don't cache it, so the cache is kept for the poll queries.
+	// The cached command is copied, since clearFrameCache may reuse its entry once the lock is released.
+	frame = NULL;
+	lock();
+	if (cacheFrame)
+		frame = findReadArrayFrame(frameCache_, &frameCacheSize_, SPIIPLUS_FRAME_CACHE_SIZE, var, DOUBLE_DATA_SIZE, idx1start, idx1end, idx2start, idx2end);
+	if (frame)
+	{
+		memcpy(command, frame->frame, frame->outBytes);
+		outBytes = frame->outBytes;
+		inBytes = frame->inBytes;
+		dataBytes = frame->dataBytes;
+	}
+	unlock();
+	if (!frame)
+		readFloat64ArrayCmd(command, var, idx1start, idx1end, idx2start, idx2end, &outBytes, &inBytes, &dataBytes);
+	initialCommand = command;
 	
 	remainingBytes = dataBytes;
 	readBytes = 0;
@@ -668,7 +1030,7 @@ asynStatus SPiiPlusComm::getDoubleArray(char *output, const char *var, int idx1s
 	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: var = %s, ((%i, %i), (%i, %i))\n", driverName, functionName, var, idx1start, idx1end, idx2start, idx2end);
 	
 	// Send the command
-	status = writeReadBinary((char*)command, outBytes, output+readBytes, inBytes, &nread, &sliceAvailable);
+	status = writeReadBinary(initialCommand, outBytes, output+readBytes, inBytes, &nread, &sliceAvailable);
 	asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: Initial array query: request = %i; read = %li\n", driverName, functionName, inBytes, nread);
 	
 	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: status = %i\n", driverName, functionName, status);
@@ -700,6 +1062,198 @@ asynStatus SPiiPlusComm::getDoubleArray(char *output, const char *var, int idx1s
 	return status;
 }
 
+/*
+ * Read var(idx1start,idx1end)(idx2start,idx2end) directly into one destination array per row.
+ * rows[i] receives row idx1start+i and has room for rowSize values; rows that aren't needed
+ * can be NULL.  See getDoubleArrays.
+ */
+asynStatus SPiiPlusComm::getDoubleArray(double **rows, size_t rowSize, const char *var, int idx1start, int idx1end, int idx2start, int idx2end)
+{
+	std::vector<doubleArrayRead_t> reads(1);
+	
+	strncpy(reads[0].var, var, MAX_FRAME_VAR_LEN-1);
+	reads[0].var[MAX_FRAME_VAR_LEN-1] = '\0';
+	reads[0].idx1start = idx1start;
+	reads[0].idx1end = idx1end;
+	reads[0].idx2start = idx2start;
+	reads[0].idx2end = idx2end;
+	reads[0].rows.assign(rows, rows + (idx1end >= idx1start ? idx1end - idx1start + 1 : 0));
+	reads[0].rowSize = rowSize;
+	
+	return getDoubleArrays(reads);
+}
+
+// One binary query of getDoubleArrays: a slice of a column chunk of one of the reads
+typedef struct {
+	size_t read;
+	int chunkStart;
+	int chunkEnd;
+	int slice;
+} doubleArrayPacket_t;
+
+/*
+ * Copy numValues doubles, which start at element (row-major) of the chunk that begins at
+ * column chunkStart, into the destination rows of a read.
+ */
+static void scatterRows(doubleArrayRead_t& read, int chunkStart, int chunkWidth, int element, const char *data, int numValues)
+{
+	int numRows = read.idx1end - read.idx1start + 1;
+	int row, col, run;
+	
+	while ((numValues > 0) && (element < numRows * chunkWidth))
+	{
+		row = element / chunkWidth;
+		col = element % chunkWidth;
+		run = chunkWidth - col;
+		if (run > numValues)
+			run = numValues;
+		if (read.rows[row])
+			memcpy(read.rows[row] + (chunkStart - read.idx2start) + col, data, run * DOUBLE_DATA_SIZE);
+		data += run * DOUBLE_DATA_SIZE;
+		element += run;
+		numValues -= run;
+	}
+}
+
+/*
+ * Read several blocks of 2D real arrays, each into one destination array per row.  The columns
+ * of each block are queried in chunks of at most MAX_BINARY_READ_LEN bytes, which keeps the
+ * number of slices of a query within what the slice command can address, so the size of the
+ * arrays isn't limited by a buffer.  The number of slices of every chunk is known in advance,
+ * so the queries for all of the slices of all of the blocks are sent SPIIPLUS_READ_PIPELINE_DEPTH
+ * at a time in a single write, and the replies are copied from the packet into the rows as they
+ * arrive.  The commands aren't cached, since they depend on the chunk.
+ */
+asynStatus SPiiPlusComm::getDoubleArrays(std::vector<doubleArrayRead_t>& reads)
+{
+	char command[MAX_MESSAGE_LEN];
+	char slice[MAX_PACKET_DATA];
+	std::vector<doubleArrayPacket_t> packets;
+	std::vector<int> errNos;
+	doubleArrayPacket_t packet;
+	std::string output;
+	asynStatus status = asynSuccess;
+	epicsTimeStamp startTime;
+	int numRows, numCols, chunkCols, chunkWidth, chunkBytes;
+	int outBytes, inBytes, dataBytes, expectedBytes;
+	int errNo;
+	size_t first, last, i, r;
+	size_t nwrite, nread;
+	bool bodyInPacketBuffer;
+	static const char *functionName = "getDoubleArrays";
+	
+	asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: start\n", driverName, functionName);
+	
+	for (r=0; r<reads.size(); r++)
+	{
+		numRows = reads[r].idx1end - reads[r].idx1start + 1;
+		numCols = reads[r].idx2end - reads[r].idx2start + 1;
+		if ((numRows <= 0) || (numCols <= 0) || ((size_t)numRows != reads[r].rows.size()) || ((size_t)numCols > reads[r].rowSize))
+		{
+			asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s((%i, %i), (%i, %i)) doesn't fit in %li rows of %li values\n", driverName, functionName, 
+					reads[r].var, reads[r].idx1start, reads[r].idx1end, reads[r].idx2start, reads[r].idx2end, reads[r].rows.size(), reads[r].rowSize);
+			return asynError;
+		}
+		
+		chunkCols = MAX_BINARY_READ_LEN / (numRows * DOUBLE_DATA_SIZE);
+		if (chunkCols < 1)
+			chunkCols = 1;
+		
+		packet.read = r;
+		for (packet.chunkStart = reads[r].idx2start; packet.chunkStart <= reads[r].idx2end; packet.chunkStart += chunkCols)
+		{
+			packet.chunkEnd = packet.chunkStart + chunkCols - 1;
+			if (packet.chunkEnd > reads[r].idx2end)
+				packet.chunkEnd = reads[r].idx2end;
+			chunkBytes = numRows * (packet.chunkEnd - packet.chunkStart + 1) * DOUBLE_DATA_SIZE;
+			for (packet.slice = 0; packet.slice * MAX_PACKET_DATA < chunkBytes; packet.slice++)
+				packets.push_back(packet);
+		}
+	}
+	
+	for (first=0; (first<packets.size()) && (status == asynSuccess); first=last)
+	{
+		last = first + SPIIPLUS_READ_PIPELINE_DEPTH;
+		if (last > packets.size())
+			last = packets.size();
+		
+		// Every query of the window goes out in a single write
+		output.clear();
+		for (i=first; i<last; i++)
+		{
+			doubleArrayRead_t& read = reads[packets[i].read];
+			if (packets[i].slice == 0)
+				readFloat64ArrayCmd(command, read.var, read.idx1start, read.idx1end, packets[i].chunkStart, packets[i].chunkEnd, &outBytes, &inBytes, &dataBytes);
+			else
+				readFloat64SliceCmd(command, packets[i].slice, read.var, read.idx1start, read.idx1end, packets[i].chunkStart, packets[i].chunkEnd, &outBytes, &inBytes, &dataBytes);
+			output.append(command, outBytes);
+			
+			asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: var = %s, ((%i, %i), (%i, %i)), slice %i\n", driverName, functionName, 
+					read.var, read.idx1start, read.idx1end, packets[i].chunkStart, packets[i].chunkEnd, packets[i].slice);
+		}
+		
+		lock();
+		epicsTimeGetCurrent(&startTime);
+		setBinaryMode(true);
+		
+		status = pasynOctetSyncIO->write(pasynUserBinary_, output.data(), output.size(), SPIIPLUS_CMD_TIMEOUT, &nwrite);
+		if (status != asynSuccess)
+		{
+			asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Binary write failed (asyn): status=%i\n", driverName, functionName, status);
+			last = first;
+		}
+		
+		// Read every reply of the window, even after an error reply, so the next command starts cleanly
+		for (i=first; i<last; i++)
+		{
+			doubleArrayRead_t& read = reads[packets[i].read];
+			nread = 0;
+			status = readBinaryReply(slice, MAX_PACKET_DATA, SPIIPLUS_ARRAY_TIMEOUT, &nread, &bodyInPacketBuffer);
+			if (status != asynSuccess)
+			{
+				asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Binary read failed (asyn): status=%i, nread=%li\n", driverName, functionName, status, nread);
+				pasynOctetSyncIO->flush(pasynUserBinary_);
+				break;
+			}
+			
+			errNo = binaryErrorCheck(packetBuffer_, nread);
+			if (errNo != 0)
+			{
+				asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Binary read of %s failed (controller)\n", driverName, functionName, read.var);
+				errNos.push_back(errNo);
+				status = asynError;
+				continue;
+			}
+			
+			numRows = read.idx1end - read.idx1start + 1;
+			chunkWidth = packets[i].chunkEnd - packets[i].chunkStart + 1;
+			expectedBytes = numRows * chunkWidth * DOUBLE_DATA_SIZE - packets[i].slice * MAX_PACKET_DATA;
+			if (expectedBytes > MAX_PACKET_DATA)
+				expectedBytes = MAX_PACKET_DATA;
+			if ((int)nread - 5 != expectedBytes)
+			{
+				asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Slice %i of %s: expected = %i; read = %li\n", driverName, functionName, packets[i].slice, read.var, expectedBytes, nread-5);
+				status = asynError;
+				continue;
+			}
+			
+			scatterRows(read, packets[i].chunkStart, chunkWidth, packets[i].slice * (MAX_PACKET_DATA / DOUBLE_DATA_SIZE), slice, expectedBytes / DOUBLE_DATA_SIZE);
+		}
+		
+		updateBinaryStats(&startTime);
+		unlock();
+		
+		// Print the human-readable error strings once the replies have been read
+		for (i=0; i<errNos.size(); i++)
+			writeReadBinaryErrorMessage(errNos[i]);
+		errNos.clear();
+	}
+	
+	asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: end\n", driverName, functionName);
+	
+	return status;
+}
+
 asynStatus SPiiPlusComm::globalVarCheck(const char *var, int idx1start, int idx1end, int idx2start, int idx2end, int *dimensions, int *numElements, int *errNo)
 {
 	std::stringstream cmd;
@@ -824,7 +1378,57 @@ asynStatus SPiiPlusComm::createGlobalRealVar(const char *var, int idx1start, int
 	return status;
 }
 
-asynStatus SPiiPlusComm::putDoubleArray(double *data, const char *var, int idx1start, int idx1end, int idx2start, int idx2end)
+/*
+ * Replace the contents of a program buffer with the specified lines and compile it.
+ * The buffer is stopped first, in case an older copy of the program is running.
+ * The program is not started; the calling method should use START once this succeeds.
+ */
+asynStatus SPiiPlusComm::loadProgram(int buffer, std::vector <std::string>& program)
+{
+	std::stringstream cmd;
+	asynStatus status;
+	unsigned int i;
+	static const char *functionName = "loadProgram";
+	
+	asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: buffer = %i, lines = %i\n", driverName, functionName, buffer, (int)program.size());
+	
+	// STOP buffer (an error is returned if the buffer isn't running, which can be ignored)
+	cmd << "STOP " << buffer;
+	writeReadAck(cmd);
+	
+	// Delete the existing program: #<buffer>D
+	cmd << "#" << buffer << "D";
+	status = writeReadAck(cmd);
+	if (status != asynSuccess)
+	{
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Unable to clear buffer %i\n", driverName, functionName, buffer);
+		return status;
+	}
+	
+	// Append the program one line at a time: #<buffer>A <line>
+	for (i=0; i<program.size(); i++)
+	{
+		cmd << "#" << buffer << "A " << program[i];
+		status = writeReadAck(cmd);
+		if (status != asynSuccess)
+		{
+			asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Unable to append line %i to buffer %i: %s\n", driverName, functionName, i+1, buffer, program[i].c_str());
+			return status;
+		}
+	}
+	
+	// Compile the buffer: #<buffer>C
+	cmd << "#" << buffer << "C";
+	status = writeReadAck(cmd);
+	if (status != asynSuccess)
+	{
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Unable to compile buffer %i\n", driverName, functionName, buffer);
+	}
+	
+	return status;
+}
+
+asynStatus SPiiPlusComm::putDoubleArray(double *data, const char *var, int idx1start, int idx1end, int idx2start, int idx2end, bool checkVar)
 {
 	char *inBuff;
 	char *command;
@@ -843,35 +1447,44 @@ asynStatus SPiiPlusComm::putDoubleArray(double *data, const char *var, int idx1s
 	// TODO: how to handle local variables?
 	
 	// Confirm the global variable exists and is large enough to hold the
-	// array to be written to it.
-	status = globalVarCheck(var, idx1start, idx1end, idx2start, idx2end, &dimensions, &numElements, &errNo);
-	
-	if (status == asynSuccess)
+	// array to be written to it.  Callers that declared the variable themselves
+	// can skip this query.
+	if (checkVar)
 	{
-		// Check the error number
-		if (errNo == 1064)
+		status = globalVarCheck(var, idx1start, idx1end, idx2start, idx2end, &dimensions, &numElements, &errNo);
+		
+		if (status == asynSuccess)
 		{
-			// The variable doesn't exist and can be created
-			status = createGlobalRealVar(var, idx1start, idx1end, idx2start, idx2end);
-			
-			if (status != asynSuccess)
+			// Check the error number
+			if (errNo == 1064)
 			{
-				// TODO: add asyn error message
-				asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,    "%s:%s: Failed to create gobal variable: %s\n", driverName, functionName, var);
-				return asynError;
+				// The variable doesn't exist and can be created
+				status = createGlobalRealVar(var, idx1start, idx1end, idx2start, idx2end);
+				
+				if (status != asynSuccess)
+				{
+					// TODO: add asyn error message
+					asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,    "%s:%s: Failed to create gobal variable: %s\n", driverName, functionName, var);
+					return asynError;
+				}
 			}
 		}
+		else
+		{
+			// Variable isn't large enough to hold the data; can't proceed.
+			asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,    "%s:%s: Global variable exists but isn't large enough: %s\n", driverName, functionName, var);
+			return asynError;
+		}
 	}
 	else
 	{
-		// Variable isn't large enough to hold the data; can't proceed.
-		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,    "%s:%s: Global variable exists but isn't large enough: %s\n", driverName, functionName, var);
-		return asynError;
+		dimensions = ((idx2end - idx2start) > 0) ? 2 : 1;
 	}
 	
-	command = (char *)calloc(MAX_PACKET_SIZE, sizeof(char));
-	// Is MAX_PACKET_SIZE unnecessarily large for the Ack / error reply?  Ack is 2 bytes. Error is longer, but not that long.
-	inBuff = (char *)calloc(MAX_PACKET_DATA, sizeof(char));
+	// The packets are built in buffers owned by this class, so hold the lock until the last packet is sent
+	lock();
+	command = commandBuffer_;
+	inBuff = ackBuffer_;
 	
 	/* 
 	 * Unlike getDoubleArray, which parses the reply from the controller to determine if there is another
@@ -944,17 +1557,18 @@ asynStatus SPiiPlusComm::putDoubleArray(double *data, const char *var, int idx1s
 	
 	asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: end\n", driverName, functionName);
 	
-	free(command);
-	free(inBuff);
+	unlock();
 	
 	// The returnd status is the status of the last packet set to the controller
 	return status;
 }
 
-asynStatus SPiiPlusComm::getIntegerArray(char *output, const char *var, int idx1start, int idx1end, int idx2start, int idx2end)
+asynStatus SPiiPlusComm::getIntegerArray(char *output, const char *var, int idx1start, int idx1end, int idx2start, int idx2end, bool cacheFrame)
 {
 	//char outString[MAX_CONTROLLER_STRING_SIZE];
 	char command[MAX_MESSAGE_LEN];
+	char *initialCommand;
+	binaryFrame_t *frame;
 	asynStatus status;
 	int remainingBytes;
 	int readBytes;
@@ -969,8 +1583,24 @@ asynStatus SPiiPlusComm::getIntegerArray(char *output, const char *var, int idx1
 	//std::fill(outString, outString + MAX_CONTROLLER_STRING_SIZE, '\0');
 	
 	// Create the command to query array data. This could be the only command
-	// that needs to be sent or it could be the first of many.
-	readInt32ArrayCmd(command, var, idx1start, idx1end, idx2start, idx2end, &outBytes, &inBytes, &dataBytes);
+	// that needs to be sent or it could be the first of many. Repeated queries use a cached command;
+	// one-shot reads don't cache it, so the cache is kept for the poll queries.
+	// The cached command is copied, since clearFrameCache may reuse its entry once the lock is released.
+	frame = NULL;
+	lock();
+	if (cacheFrame)
+		frame = findReadArrayFrame(frameCache_, &frameCacheSize_, SPIIPLUS_FRAME_CACHE_SIZE, var, INT_DATA_SIZE, idx1start, idx1end, idx2start, idx2end);
+	if (frame)
+	{
+		memcpy(command, frame->frame, frame->outBytes);
+		outBytes = frame->outBytes;
+		inBytes = frame->inBytes;
+		dataBytes = frame->dataBytes;
+	}
+	unlock();
+	if (!frame)
+		readInt32ArrayCmd(command, var, idx1start, idx1end, idx2start, idx2end, &outBytes, &inBytes, &dataBytes);
+	initialCommand = command;
 	
 	remainingBytes = dataBytes;
 	readBytes = 0;
@@ -978,7 +1608,7 @@ asynStatus SPiiPlusComm::getIntegerArray(char *output, const char *var, int idx1
 	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: var = %s, ((%i, %i), (%i, %i))\n", driverName, functionName, var, idx1start, idx1end, idx2start, idx2end);
 	
 	// Send the command
-	status = writeReadBinary((char*)command, outBytes, output+readBytes, inBytes, &nread, &sliceAvailable);
+	status = writeReadBinary(initialCommand, outBytes, output+readBytes, inBytes, &nread, &sliceAvailable);
 	asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: Initial array query: request = %i; read = %li\n", driverName, functionName, inBytes, nread);
 	
 	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: status = %i\n", driverName, functionName, status);
@@ -1,6 +1,30 @@
 
+#include <string>
+#include <vector>
+
+#include <epicsTime.h>
+
 #include "asynDriver.h"
 
+#include "SPiiPlusBinComm.h"
+
+// Enough for every polled variable of a few axis ranges plus the profile readback arrays
+#define SPIIPLUS_FRAME_CACHE_SIZE 64
+
+// Time to wait for the rest of the replies to a batch of commands
+#define SPIIPLUS_BATCH_TIMEOUT 1.0
+
+// Binary queries sent before their replies are read (1 reads every packet before sending the next query)
+#define SPIIPLUS_READ_PIPELINE_DEPTH 16
+
+// A block of a 2D real array, read into one destination array per row by getDoubleArrays
+typedef struct {
+  char var[MAX_FRAME_VAR_LEN];
+  int idx1start, idx1end, idx2start, idx2end;
+  std::vector<double *> rows;   /**< One per row, each with room for rowSize values; NULL rows are discarded */
+  size_t rowSize;
+} doubleArrayRead_t;
+
 class SPiiPlusController;
 
 class epicsShareClass SPiiPlusComm : public asynPortDriver {
@@ -11,26 +35,34 @@ public:
   /* These are the methods that we override from asynPortDriver */
   //virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
   //virtual asynStatus readInt32(asynUser *pasynUser, epicsInt32 *value);
-  //virtual void report(FILE *fp, int details);
+  virtual void report(FILE *fp, int details);
   // These should be private but are called from C
   void pollerThread(void);
 
   asynStatus writeReadController(const char *output, char *input, size_t maxChars, size_t *nread, double timeout);
+  asynStatus writeReadController(const char *output, size_t outChars, char *input, size_t maxChars, size_t *nread, double timeout);
   asynStatus writeReadInt(std::stringstream& cmd, int* val);
   asynStatus writeReadDouble(std::stringstream& cmd, double* val);
   asynStatus writeReadStr(std::stringstream& cmd, char* val);
   asynStatus writeReadAck(std::stringstream& cmd);
+  asynStatus writeReadBatch(std::vector<std::string>& cmds, std::vector<int> *errNos = NULL);
+  asynStatus writeReadBlock(const char *output, size_t outChars, size_t numCmds, std::vector<int> *errNos = NULL);
   asynStatus writeReadErrorMessage(char* errNoReply);
   asynStatus writeReadBinaryErrorMessage(int errNo);
-  asynStatus getIntegerArray(char *output, const char *var, int idx1start, int idx1end, int idx2start, int idx2end);
-  asynStatus getDoubleArray(char *output, const char *var, int idx1start, int idx1end, int idx2start, int idx2end);
-  asynStatus putDoubleArray(double *data, const char *var, int idx1start, int idx1end, int idx2start, int idx2end);
+  asynStatus getIntegerArray(char *output, const char *var, int idx1start, int idx1end, int idx2start, int idx2end, bool cacheFrame = true);
+  asynStatus getDoubleArray(char *output, const char *var, int idx1start, int idx1end, int idx2start, int idx2end, bool cacheFrame = true);
+  asynStatus getDoubleArray(double **rows, size_t rowSize, const char *var, int idx1start, int idx1end, int idx2start, int idx2end);
+  asynStatus getDoubleArrays(std::vector<doubleArrayRead_t>& reads);
+  void clearFrameCache();
+  asynStatus putDoubleArray(double *data, const char *var, int idx1start, int idx1end, int idx2start, int idx2end, bool checkVar = true);
   asynStatus writeReadBinary(char *output, int outBytes, char *input, int inBytes, size_t *dataBytes, bool* sliceAvailable);
   asynStatus writeReadAckBinary(char *output, int outBytes, char *input, int inBytes);
   int binaryErrorCheck(char *buffer, int readBytes);
   asynStatus isVariableDefined(bool *isDefined, const char *var);
   asynStatus globalVarCheck(const char *var, int idx1start, int idx1end, int idx2start, int idx2end, int *dimensions, int *numElements, int *errNo);
   asynStatus createGlobalRealVar(const char *var, int idx1start, int idx1end, int idx2start, int idx2end);
+  asynStatus loadProgram(int buffer, std::vector <std::string>& program);
+  asynStatus connectBinaryPort(const char *asynPortName);
 
 protected:
   //int something_;
@@ -39,11 +71,32 @@ protected:
   //#define LAST_SPIIPLUS_COMM_PARAM digitalOutput_
 
   asynUser *pasynUserComm_;
+  asynUser *pasynUserBinary_;   /**< Binary commands use pasynUserComm_ unless a dedicated port is connected */
   //char outString_[MAX_CONTROLLER_STRING_SIZE];
   //char inString_[MAX_CONTROLLER_STRING_SIZE];
 
 private:
+  void setBinaryMode(bool binaryMode);
+  asynStatus readBinaryBytes(char *buffer, size_t numBytes, double timeout);
+  asynStatus readBinaryReply(char *body, int maxBodyBytes, double timeout, size_t *nread, bool *bodyInPacketBuffer);
+  void updateBinaryStats(epicsTimeStamp *startTime);
+  
   SPiiPlusController *pC_;
+  bool binaryMode_;             /**< The EOS characters of pasynUserComm_ are cleared */
+  bool dedicatedBinaryPort_;
+  unsigned long binaryTransactions_;
+  unsigned long eosChanges_;
+  double binaryTime_;
+  double maxBinaryTime_;
+  
+  // Reused by every binary transaction (protected by the port lock) to avoid allocations
+  char packetBuffer_[MAX_PACKET_SIZE];
+  char commandBuffer_[MAX_PACKET_SIZE];
+  char ackBuffer_[MAX_MESSAGE_LEN];
+  
+  // Prebuilt read commands for the polled variables
+  binaryFrame_t frameCache_[SPIIPLUS_FRAME_CACHE_SIZE];
+  int frameCacheSize_;
   double pollPeriod_;
   int forceCallback_;
 
@@ -26,6 +26,12 @@
 
 static const char *driverName = "SPiiPlusController";
 
+// The variables copied by the poll snapshot program, in the order of the SPIIPLUS_SNAPSHOT_* rows
+static const char *snapshotVariables[SPIIPLUS_SNAPSHOT_ROWS] = {"APOS", "RPOS", "EPOS", "FPOS", "F2POS", "VPOS", "FVEL",
+                                                                "ROFFS", "EOFFS", "E2OFFS", "E_AOFFS",
+                                                                "AST", "MST", "FAULT", "MFLAGS", "MFLAGSX",
+                                                                "XVEL", "XACC", "ACC", "DEC", "TIME"};
+
 static void SPiiPlusProfileThreadC(void *pPvt);
 
 #ifndef MAX
@@ -128,18 +134,101 @@ SPiiPlusController::SPiiPlusController(const char* ACSPortName, const char* asyn
 	createParam(SPiiPlusPOUTSBitCodeString,               asynParamOctet,   &SPiiPlusPOUTSBitCode_);
 	createParam(SPiiPlusPulseWidthString,                 asynParamFloat64, &SPiiPlusPulseWidth_);
 	//
+	createParam(SPiiPlusProfileExecModeString,            asynParamInt32,   &SPiiPlusProfileExecMode_);
+	createParam(SPiiPlusProfileSegmentModeString,         asynParamInt32,   &SPiiPlusProfileSegmentMode_);
+	createParam(SPiiPlusProfileRampModeString,            asynParamInt32,   &SPiiPlusProfileRampMode_);
+	createParam(SPiiPlusProfileRampPeriodString,          asynParamFloat64, &SPiiPlusProfileRampPeriod_);
+	createParam(SPiiPlusProfileUnderrunsString,           asynParamInt32,   &SPiiPlusProfileUnderruns_);
+	createParam(SPiiPlusProfileStarvationsString,         asynParamInt32,   &SPiiPlusProfileStarvations_);
+	createParam(SPiiPlusProfileStreamBytesString,         asynParamInt32,   &SPiiPlusProfileStreamBytes_);
+	createParam(SPiiPlusProfileBuildTimeString,           asynParamFloat64, &SPiiPlusProfileBuildTime_);
+	createParam(SPiiPlusProfileReadbackModeString,        asynParamInt32,   &SPiiPlusProfileReadbackMode_);
+	createParam(SPiiPlusProfileChainLengthString,         asynParamInt32,   &SPiiPlusProfileChainLength_);
+	createParam(SPiiPlusProfileChainedString,             asynParamInt32,   &SPiiPlusProfileChained_);
+	createParam(SPiiPlusProfileWaitLatencyString,         asynParamFloat64, &SPiiPlusProfileWaitLatency_);
+	//
 	createParam(SPiiPlusMFlagsString,                     asynParamInt32,   &SPiiPlusMFlags_);
 	createParam(SPiiPlusMFlagsXString,                    asynParamInt32,   &SPiiPlusMFlagsX_);
 	//
 	createParam(SPiiPlusTestString,                       asynParamInt32, &SPiiPlusTest_);
 	
 	// Initialize variables to avoid freeing random memory
-	fullProfileTimes_ = 0;
+	profileArena_ = NULL;
+	profileArenaStride_ = 0;
+	profileUserPositions_ = NULL;
 	profilePulses_ = NULL;
 	profilePulsesUser_ = NULL;
 	profilePulsePositions_ = NULL;
 	maxProfilePoints_ = 0;
 	
+	// The upload execution mode is unavailable until SPiiPlusConfigProfileBuffer is called
+	profileBuffer_ = -1;
+	for (int i=0; i<SPIIPLUS_PROFILE_SLOTS; i++)
+	{
+		profileSlots_[i].index = i;
+		sprintf(profileSlots_[i].pulseVar, "%s%i", SPIIPLUS_PULSE_VAR, i);
+		sprintf(profileSlots_[i].dataVar, "%s%i", SPIIPLUS_PROFILE_DATA_VAR, i);
+	}
+	nextSlot_ = -1;
+	execSlot_ = -1;
+	exec_ = NULL;
+	profileBuildsSkipped_ = 0;
+	setIntegerParam(SPiiPlusProfileExecMode_, SPIIPLUS_PROFILE_EXEC_POINT);
+	pathBufferSize_ = SPIIPLUS_PATH_BUFFER_SIZE;
+	profileSegmentMode_ = SPIIPLUS_PROFILE_SEGMENT_LINEAR;
+	setIntegerParam(SPiiPlusProfileSegmentMode_, SPIIPLUS_PROFILE_SEGMENT_LINEAR);
+	// The default ramp period gives MAX_ACCEL_SEGMENTS at an acceleration time of 0.2s
+	profileRampMode_ = SPIIPLUS_PROFILE_RAMP_LINEAR;
+	profileRampPeriod_ = 0.01;
+	setIntegerParam(SPiiPlusProfileRampMode_, SPIIPLUS_PROFILE_RAMP_LINEAR);
+	setDoubleParam(SPiiPlusProfileRampPeriod_, profileRampPeriod_);
+	mpointRows_ = 0;
+	mpointCols_ = 0;
+	setIntegerParam(SPiiPlusProfileUnderruns_, 0);
+	setIntegerParam(SPiiPlusProfileStarvations_, 0);
+	setIntegerParam(SPiiPlusProfileStreamBytes_, 0);
+	setDoubleParam(SPiiPlusProfileBuildTime_, 0.0);
+	setIntegerParam(SPiiPlusProfileReadbackMode_, SPIIPLUS_PROFILE_READBACK_FINAL);
+	setIntegerParam(SPiiPlusProfileChainLength_, 1);
+	setIntegerParam(SPiiPlusProfileChained_, 0);
+	setDoubleParam(SPiiPlusProfileWaitLatency_, 0.0);
+	readbackIncremental_ = false;
+	readbackCount_ = 0;
+	dcAxesPerChannel_ = 0;
+	
+	// The poll snapshot is disabled until SPiiPlusConfigSnapshot is called
+	snapshotBuffer_ = -1;
+	snapshotActive_ = false;
+	snapshotLoaded_ = false;
+	snapshotTime_ = 0.0;
+	snapshotStaleTime_ = SPIIPLUS_SNAPSHOT_STALE_MIN_TIME;
+	epicsTimeGetCurrent(&snapshotAdvanced_);
+	
+	// Read every tier on the first poll
+	slowPollDivisor_ = SPIIPLUS_SLOW_POLL_DIVISOR;
+	onDemandPollDivisor_ = SPIIPLUS_ON_DEMAND_POLL_DIVISOR;
+	slowPollCounter_ = 0;
+	onDemandPollCounter_ = 0;
+	slowPollRequested_ = true;
+	onDemandPollRequested_ = true;
+	pollWasMoving_ = false;
+	fastPollCount_ = 0;
+	slowPollCount_ = 0;
+	onDemandPollCount_ = 0;
+	
+	// Every axis is polled until records or profiles start using specific axes
+	for (int i=0; i<SPIIPLUS_MAX_AXES; i++)
+	{
+		axisActive_[i] = false;
+	}
+	roundTripBytes_ = SPIIPLUS_POLL_ROUND_TRIP_BYTES;
+	pollRangesDirty_ = true;
+	
+	movesDeferred_ = false;
+	
+	accelerationWrites_ = 0;
+	accelerationWritesSkipped_ = 0;
+	
 	// Query system info
 	cmd << "?VR";
 	pComm_->writeReadStr(cmd, firmwareVersion_);
@@ -187,13 +276,13 @@ SPiiPlusController::SPiiPlusController(const char* ACSPortName, const char* asyn
 		anyAxisVirtual_ = false;
 	}
 	
-	// Query setup parameters
-	pComm_->getIntegerArray((char *)motorFlags_, "MFLAGS", 0, numAxes_-1, 0, 0);
-	pComm_->getDoubleArray((char *)stepperFactor_, "STEPF", 0, numAxes_-1, 0, 0);
-	pComm_->getDoubleArray((char *)encoderFactor_, "EFAC", 0, numAxes_-1, 0, 0);
-	pComm_->getDoubleArray((char *)encoder2Factor_, "E2FAC", 0, numAxes_-1, 0, 0);
-	pComm_->getIntegerArray((char *)encoderType_, "E_TYPE", 0, numAxes_-1, 0, 0);
-	pComm_->getIntegerArray((char *)encoder2Type_, "E2_TYPE", 0, numAxes_-1, 0, 0);
+	// Query setup parameters (read once, so their commands aren't cached)
+	pComm_->getIntegerArray((char *)motorFlags_, "MFLAGS", 0, numAxes_-1, 0, 0, false);
+	pComm_->getDoubleArray((char *)stepperFactor_, "STEPF", 0, numAxes_-1, 0, 0, false);
+	pComm_->getDoubleArray((char *)encoderFactor_, "EFAC", 0, numAxes_-1, 0, 0, false);
+	pComm_->getDoubleArray((char *)encoder2Factor_, "E2FAC", 0, numAxes_-1, 0, 0, false);
+	pComm_->getIntegerArray((char *)encoderType_, "E_TYPE", 0, numAxes_-1, 0, 0, false);
+	pComm_->getIntegerArray((char *)encoder2Type_, "E2_TYPE", 0, numAxes_-1, 0, 0, false);
 	
 	for (int index = 0; index < numAxes; index += 1)
 	{
@@ -257,9 +346,6 @@ SPiiPlusController::SPiiPlusController(const char* ACSPortName, const char* asyn
 			pComm_->writeReadAck(cmd);
 			
 		}
-		
-		// Initialize this variable to avoid freeing random memory
-		pAxes_[index]->fullProfilePositions_ = 0;
 	}
 	
 	drvUser_ = (SPiiPlusDrvUser_t *) callocMustSucceed(1, sizeof(SPiiPlusDrvUser_t), functionName);
@@ -271,6 +357,12 @@ SPiiPlusController::SPiiPlusController(const char* ACSPortName, const char* asyn
 	// Create the event that wakes up the thread for profile moves
 	profileExecuteEvent_ = epicsEventMustCreate(epicsEventEmpty);
 	
+	// Create the event that the polls use to end the waits of profile moves
+	axisStateEvent_ = epicsEventMustCreate(epicsEventEmpty);
+	epicsTimeGetCurrent(&axisStateTime_);
+	axisStatePolled_ = true;
+	waitLatency_ = 0.0;
+	
 	// Create the thread that will execute profile moves
 	epicsThreadCreate("SPiiPlusProfile", 
 		epicsThreadPriorityLow,
@@ -287,6 +379,7 @@ asynStatus SPiiPlusController::drvUserCreate(asynUser *pasynUser,
 {
     static const char *functionName = "drvUserCreate";
     int index;
+    int addr;
     const char *drvInfoNew;
     
     pasynUser->drvUser = drvUser_;
@@ -295,6 +388,16 @@ asynStatus SPiiPlusController::drvUserCreate(asynUser *pasynUser,
        return asynDisabled;
     }
     
+    // Only the axes of motor records (which connect to MOTOR_STATUS) need to be polled; other records
+    // use addr for other things.  motorStatus_ is also the name of the polled status array.
+    if ((findParam(drvInfo, &index) == asynSuccess) && (index == asynMotorController::motorStatus_) &&
+        (pasynManager->getAddr(pasynUser, &addr) == asynSuccess) && (addr >= 0) && (addr < numAxes_))
+    {
+        lock();
+        setAxisActive(addr);
+        unlock();
+    }
+    
     // drvUserCreate(pasynUser=0x23e29e8, drvInfo=SPIIPLUS_READ_REAL_VAR, pptypeName=(nil), psize=(nil))
     //printf("drvUserCreate(pasynUser=%p, drvInfo=%s, pptypeName=%p, psize=%p)\n", pasynUser, drvInfo, pptypeName, psize);
     
@@ -547,6 +650,9 @@ SPiiPlusAxis* SPiiPlusController::getAxis(int axisNo)
 asynStatus SPiiPlusController::poll()
 {
 	asynStatus status;
+	std::stringstream cmd;
+	epicsTimeStamp now;
+	double snapshotTime;
 	static const char *functionName = "poll";
 	
 	/*
@@ -559,233 +665,833 @@ asynStatus SPiiPlusController::poll()
 	
 	asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: POLL_START\n", driverName, functionName);
 	
-	/* positions */
-	status = pComm_->getDoubleArray((char *)axisPosition_, "APOS", 0, numAxes_-1, 0, 0);
-	if (status != asynSuccess) return status;
-	
-	// RPOS = APOS if MFLAGS(index).#DEFCON=1
-	status = pComm_->getDoubleArray((char *)referencePosition_, "RPOS", 0, numAxes_-1, 0, 0);
-	if (status != asynSuccess) return status;
-	
-	status = pComm_->getDoubleArray((char *)encoderPosition_, "EPOS", 0, numAxes_-1, 0, 0);
-	if (status != asynSuccess) return status;
+	// A profile phase wait only trusts axis states read after it began (see waitAxisState).
+	// The waiter can't run until the axis polls are done, since the poller holds the lock.
+	if (!axisStatePolled_)
+	{
+		axisStatePolled_ = true;
+		epicsTimeGetCurrent(&axisStateTime_);
+		epicsEventSignal(axisStateEvent_);
+	}
 	
-	status = pComm_->getDoubleArray((char *)feedbackPosition_, "FPOS", 0, numAxes_-1, 0, 0);
-	if (status != asynSuccess) return status;
+	if (snapshotLoaded_ && !snapshotActive_)
+	{
+		// Go back to the snapshot once its program is seen updating the array again
+		epicsTimeGetCurrent(&now);
+		if (epicsTimeDiffInSeconds(&now, &snapshotAdvanced_) >= SPIIPLUS_SNAPSHOT_RETRY_PERIOD)
+		{
+			snapshotAdvanced_ = now;
+			cmd << "?" << SPIIPLUS_SNAPSHOT_VAR << "(" << SPIIPLUS_SNAPSHOT_TIME << ")(0)";
+			if ((pComm_->writeReadDouble(cmd, &snapshotTime) == asynSuccess) && (snapshotTime != snapshotTime_))
+			{
+				asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Snapshot program in buffer %i is running again; resuming poll snapshot\n", driverName, functionName, snapshotBuffer_);
+				snapshotTime_ = snapshotTime;
+				snapshotActive_ = true;
+			}
+		}
+	}
 	
-	status = pComm_->getDoubleArray((char *)feedback2Position_, "F2POS", 0, numAxes_-1, 0, 0);
-	if (status != asynSuccess) return status;
+	if (snapshotActive_)
+	{
+		// Everything is read with a single binary query when the snapshot program is running
+		status = pollSnapshot();
+		if (status != asynSuccess)
+		{
+			asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Poll snapshot failed; falling back to per-variable polling\n", driverName, functionName);
+			snapshotActive_ = false;
+			epicsTimeGetCurrent(&snapshotAdvanced_);
+			slowPollRequested_ = true;
+			onDemandPollRequested_ = true;
+		}
+	}
 	
-	if (virtualFeedbackPositionSupported_ && anyAxisVirtual_)
+	if (!snapshotActive_)
 	{
-		status = pComm_->getDoubleArray((char *)virtualFeedbackPosition_, "VPOS", 0, numAxes_-1, 0, 0);
-		if (status != asynSuccess) return status;
+		status = pollVariables();
+		if (status != asynSuccess)
+		{
+			// The controller may have been restarted, so nothing written before can be trusted
+			invalidateMotionParams();
+			return status;
+		}
 	}
 	
-	status = pComm_->getDoubleArray((char *)feedbackVelocity_, "FVEL", 0, numAxes_-1, 0, 0);
-	if (status != asynSuccess) return status;
+	asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: POLL_END\n", driverName, functionName);
 	
-	/* offsets */
-	// RPOS = 0 if MFLAGS(index).#DEFCON=1
-	status = pComm_->getDoubleArray((char *)referenceOffset_, "ROFFS", 0, numAxes_-1, 0, 0);
-	if (status != asynSuccess) return status;
+	return status;
+}
+
+/*
+ * Read the polled variables with one binary query per variable.  The variables are split into tiers:
+ *
+ *   fast:      read every poll (positions and statuses needed to track motion)
+ *   slow:      read every idle poll and every slowPollDivisor_ moving polls
+ *   on-demand: read after the driver changes one of the values, when motion ends
+ *              and every onDemandPollDivisor_ slow-tier reads
+ */
+asynStatus SPiiPlusController::pollVariables()
+{
+	asynStatus status;
+	bool moving;
+	int i;
+	std::vector <std::pair<int,int> >::iterator range;
+	// static const char *functionName = "pollVariables";
 	
-	status = pComm_->getDoubleArray((char *)encoderOffset_, "EOFFS", 0, numAxes_-1, 0, 0);
-	if (status != asynSuccess) return status;
+	if (pollRangesDirty_) updatePollRanges();
 	
-	status = pComm_->getDoubleArray((char *)encoder2Offset_, "E2OFFS", 0, numAxes_-1, 0, 0);
+	/* fast tier */
+	status = pollDoubleArray(axisPosition_, "APOS");
 	if (status != asynSuccess) return status;
 	
-	status = pComm_->getDoubleArray((char *)absoluteEncoderOffset_, "E_AOFFS", 0, numAxes_-1, 0, 0);
+	status = pollDoubleArray(feedbackPosition_, "FPOS");
 	if (status != asynSuccess) return status;
 	
-	// TODO: re-add E2_AOFFS query after querying the firmware version
-	// E2_AOFFS doesn't exist in firmware v2.70
-	//status = pComm_->getDoubleArray((char *)absoluteEncoder2Offset_, "E2_AOFFS", 0, numAxes_-1, 0, 0);
-	//if (status != asynSuccess) return status;
+	if (virtualFeedbackPositionSupported_ && anyAxisVirtual_)
+	{
+		status = pollDoubleArray(virtualFeedbackPosition_, "VPOS");
+		if (status != asynSuccess) return status;
+	}
 	
-	/* statuses */
-	status = pComm_->getIntegerArray((char *)axisStatus_, "AST", 0, numAxes_-1, 0, 0);
+	status = pollDoubleArray(feedbackVelocity_, "FVEL");
 	if (status != asynSuccess) return status;
 	
-	status = pComm_->getIntegerArray((char *)motorStatus_, "MST", 0, numAxes_-1, 0, 0);
+	status = pollIntegerArray(axisStatus_, "AST");
 	if (status != asynSuccess) return status;
 	
-	status = pComm_->getIntegerArray((char *)faultStatus_, "FAULT", 0, numAxes_-1, 0, 0);
+	status = pollIntegerArray(motorStatus_, "MST");
 	if (status != asynSuccess) return status;
 	
-	// MFLAGS need to be polled here for the homed status
-	status = pComm_->getIntegerArray((char *)motorFlags_, "MFLAGS", 0, numAxes_-1, 0, 0);
+	status = pollIntegerArray(faultStatus_, "FAULT");
 	if (status != asynSuccess) return status;
 	
-	// MFLAGSX probably only needs to be polled once at init (and manually). Move it if the poll takes too long.
-	status = pComm_->getIntegerArray((char *)motorFlagsX_, "MFLAGSX", 0, numAxes_-1, 0, 0);
-	if (status != asynSuccess) return status;
+	fastPollCount_++;
 	
-	// TODO: only get max values when idle polling
-	/* max values */
-	status = pComm_->getDoubleArray((char *)maxVelocity_, "XVEL", 0, numAxes_-1, 0, 0);
-	if (status != asynSuccess) return status;
-	status = pComm_->getDoubleArray((char *)maxAcceleration_, "XACC", 0, numAxes_-1, 0, 0);
-	if (status != asynSuccess) return status;
+	// Use the same motion bits as the axis poll method; axes that aren't polled keep stale values
+	moving = false;
+	for (range=pollRanges_.begin(); range!=pollRanges_.end(); range++)
+	{
+		for (i=range->first; i<=range->second; i++)
+		{
+			if ((motorStatus_[i] & SPIIPLUS_MOTOR_STATUS_MOVE) || (axisStatus_[i] & SPIIPLUS_AXIS_STATUS_MOVE))
+			{
+				moving = true;
+			}
+		}
+	}
 	
-	asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: POLL_END\n", driverName, functionName);
+	// Homing changes the offsets, so refresh everything once motion ends
+	if (pollWasMoving_ && !moving)
+	{
+		slowPollRequested_ = true;
+		onDemandPollRequested_ = true;
+	}
+	pollWasMoving_ = moving;
+	
+	/* slow tier */
+	slowPollCounter_++;
+	if (!moving || slowPollRequested_ || (slowPollCounter_ >= slowPollDivisor_))
+	{
+		// RPOS = APOS if MFLAGS(index).#DEFCON=1
+		status = pollDoubleArray(referencePosition_, "RPOS");
+		if (status != asynSuccess) return status;
+		
+		status = pollDoubleArray(encoderPosition_, "EPOS");
+		if (status != asynSuccess) return status;
+		
+		status = pollDoubleArray(feedback2Position_, "F2POS");
+		if (status != asynSuccess) return status;
+		
+		// MFLAGS need to be polled here for the homed status
+		status = pollIntegerArray(motorFlags_, "MFLAGS");
+		if (status != asynSuccess) return status;
+		
+		// ACC and DEC confirm that the values cached by the axes haven't been changed by something else
+		status = pollDoubleArray(acceleration_, "ACC");
+		if (status != asynSuccess) return status;
+		
+		status = pollDoubleArray(deceleration_, "DEC");
+		if (status != asynSuccess) return status;
+		
+		for (range=pollRanges_.begin(); range!=pollRanges_.end(); range++)
+		{
+			validateMotionParams(range->first, range->second);
+		}
+		
+		slowPollCounter_ = 0;
+		slowPollRequested_ = false;
+		slowPollCount_++;
+		
+		// The on-demand tier is also refreshed periodically to catch changes made outside of the IOC
+		onDemandPollCounter_++;
+		if ((onDemandPollDivisor_ > 0) && (onDemandPollCounter_ >= onDemandPollDivisor_))
+		{
+			onDemandPollRequested_ = true;
+		}
+	}
+	
+	/* on-demand tier */
+	if (onDemandPollRequested_)
+	{
+		/* offsets */
+		// RPOS = 0 if MFLAGS(index).#DEFCON=1
+		status = pollDoubleArray(referenceOffset_, "ROFFS");
+		if (status != asynSuccess) return status;
+		
+		status = pollDoubleArray(encoderOffset_, "EOFFS");
+		if (status != asynSuccess) return status;
+		
+		status = pollDoubleArray(encoder2Offset_, "E2OFFS");
+		if (status != asynSuccess) return status;
+		
+		status = pollDoubleArray(absoluteEncoderOffset_, "E_AOFFS");
+		if (status != asynSuccess) return status;
+		
+		// TODO: re-add E2_AOFFS query after querying the firmware version
+		// E2_AOFFS doesn't exist in firmware v2.70
+		//status = pollDoubleArray(absoluteEncoder2Offset_, "E2_AOFFS");
+		//if (status != asynSuccess) return status;
+		
+		status = pollIntegerArray(motorFlagsX_, "MFLAGSX");
+		if (status != asynSuccess) return status;
+		
+		/* max values */
+		status = pollDoubleArray(maxVelocity_, "XVEL");
+		if (status != asynSuccess) return status;
+		status = pollDoubleArray(maxAcceleration_, "XACC");
+		if (status != asynSuccess) return status;
+		
+		onDemandPollCounter_ = 0;
+		onDemandPollRequested_ = false;
+		onDemandPollCount_++;
+	}
 	
 	return status;
 }
 
-asynStatus SPiiPlusController::readGlobalIntVar(asynUser *pasynUser, epicsInt32 *value)
+/*
+ * Read one polled variable for every range of active axes.  The output array is indexed by axis.
+ */
+asynStatus SPiiPlusController::pollDoubleArray(epicsFloat64 *output, const char *var)
 {
-	asynStatus status;
-	std::stringstream cmd;
-	int tag;
-	
-	// Get the address, which is the tag of the global integer, rather than an axis index
-	pasynManager->getAddr(pasynUser, &tag);
+	asynStatus status = asynSuccess;
+	std::vector <std::pair<int,int> >::iterator range;
 	
-	// ?GETVAR(tag)
-	cmd << "?GETVAR(" << tag << ")";
-	status = pComm_->writeReadInt(cmd, value);
+	for (range=pollRanges_.begin(); range!=pollRanges_.end(); range++)
+	{
+		status = pComm_->getDoubleArray((char *)(output + range->first), var, range->first, range->second, 0, 0);
+		if (status != asynSuccess) return status;
+	}
 	
 	return status;
 }
 
-asynStatus SPiiPlusController::writeGlobalIntVar(asynUser *pasynUser, epicsInt32 value)
+asynStatus SPiiPlusController::pollIntegerArray(epicsInt32 *output, const char *var)
 {
-	asynStatus status;
-	std::stringstream cmd;
-	int tag;
-	
-	// Get the address, which is the tag of the global integer, rather than an axis index
-	pasynManager->getAddr(pasynUser, &tag);
+	asynStatus status = asynSuccess;
+	std::vector <std::pair<int,int> >::iterator range;
 	
-	// SETVAR(value, tag)
-	cmd << "SETVAR(" << value << "," << tag << ")";
-	status = pComm_->writeReadAck(cmd);
+	for (range=pollRanges_.begin(); range!=pollRanges_.end(); range++)
+	{
+		status = pComm_->getIntegerArray((char *)(output + range->first), var, range->first, range->second, 0, 0);
+		if (status != asynSuccess) return status;
+	}
 	
 	return status;
 }
 
-asynStatus SPiiPlusController::readGlobalRealVar(asynUser *pasynUser, epicsFloat64 *value)
+/*
+ * Deferring moves queues SPiiPlusAxis::move calls.  When moves are no longer deferred,
+ * the queued moves are started together by a single PTP/m command, which uses the VEL,
+ * ACC and DEC of each axis.  The motion parameters and the PTP/m command are sent in
+ * one batch.  Relative and absolute moves need separate commands, which are sent
+ * in the same batch.
+ */
+asynStatus SPiiPlusController::setDeferredMoves(bool deferMoves)
 {
 	asynStatus status;
+	SPiiPlusAxis *pAxis;
+	std::vector <int> absoluteAxes, relativeAxes;
+	std::vector <std::string> batch;
+	std::stringstream absolutePositions, relativePositions;
 	std::stringstream cmd;
-	int tag;
+	int i;
+	static const char *functionName = "setDeferredMoves";
 	
-	// Get the address, which is the tag of the global integer, rather than an axis index
-	pasynManager->getAddr(pasynUser, &tag);
+	if (deferMoves)
+	{
+		movesDeferred_ = true;
+		return asynSuccess;
+	}
 	
-	// ?GETVAR(tag)
-	cmd << "?GETVAR(" << tag << ")";
-	status = pComm_->writeReadDouble(cmd, value);
+	movesDeferred_ = false;
 	
-	return status;
-}
-
-asynStatus SPiiPlusController::writeGlobalRealVar(asynUser *pasynUser, epicsFloat64 value)
-{
-	asynStatus status;
-	std::stringstream cmd;
-	int tag;
+	for (i=0; i<numAxes_; i++)
+	{
+		pAxis = getAxis(i);
+		if ((pAxis == NULL) || !pAxis->deferredMove_) continue;
+		
+		pAxis->appendAccelerationCommands(batch, pAxis->deferredAcceleration_);
+		cmd << "VEL(" << i << ")=" << pAxis->deferredVelocity_;
+		batch.push_back(cmd.str());
+		cmd.str("");
+		
+		if (pAxis->deferredRelative_)
+		{
+			relativeAxes.push_back(i);
+			relativePositions << ", " << pAxis->deferredPosition_;
+		}
+		else
+		{
+			absoluteAxes.push_back(i);
+			absolutePositions << ", " << pAxis->deferredPosition_;
+		}
+	}
 	
-	// Get the address, which is the tag of the global integer, rather than an axis index
-	pasynManager->getAddr(pasynUser, &tag);
+	if (batch.empty())
+		return asynSuccess;
 	
-	// SETVAR(value, tag)
-	cmd << "SETVAR(" << value << "," << tag << ")";
-	status = pComm_->writeReadAck(cmd);
+	// PTP/m (axes), p1, p2, ...
+	if (!absoluteAxes.empty())
+	{
+		cmd << "PTP/m " << axesToString(absoluteAxes) << absolutePositions.str();
+		batch.push_back(cmd.str());
+		cmd.str("");
+	}
+	if (!relativeAxes.empty())
+	{
+		cmd << "PTP/rm " << axesToString(relativeAxes) << relativePositions.str();
+		batch.push_back(cmd.str());
+		cmd.str("");
+	}
 	
-	return status;
-}
-
-asynStatus SPiiPlusController::startProgram(asynUser *pasynUser, epicsFloat64 value)
-{
-	asynStatus status;
-	std::stringstream cmd;
-	int buffer;
-	static const char *functionName = "startProgram";
+	asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: starting %i deferred moves\n", driverName, functionName, (int)(absoluteAxes.size() + relativeAxes.size()));
 	
-	// Get the address, which is the buffer # containing the program, rather than an axis index
-	pasynManager->getAddr(pasynUser, &buffer);
-
-	asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: drvUser->programName = %s, drvUser->len = %i\n", driverName, functionName, ((SPiiPlusDrvUser_t *)pasynUser->drvUser)->programName, ((SPiiPlusDrvUser_t *)pasynUser->drvUser)->len);
+	status = pComm_->writeReadBatch(batch);
 	
-	// START buffer,label -or- START buffer,line_no
-	cmd << "START " << buffer << "," << ((SPiiPlusDrvUser_t *)pasynUser->drvUser)->programName;
-	status = pComm_->writeReadAck(cmd);
+	for (i=0; i<numAxes_; i++)
+	{
+		pAxis = getAxis(i);
+		if ((pAxis == NULL) || !pAxis->deferredMove_) continue;
+		
+		pAxis->deferredMove_ = false;
+		if (status != asynSuccess) pAxis->accelerationCached_ = false;
+	}
 	
 	return status;
 }
 
-asynStatus SPiiPlusController::stopProgram(asynUser *pasynUser, epicsFloat64 value)
+/*
+ * Forget the ACC/DEC cached by an axis when the polled values no longer match the
+ * value the driver wrote, e.g. because a program or another client changed them.
+ */
+void SPiiPlusController::validateMotionParams(int firstAxis, int lastAxis)
 {
-	asynStatus status;
-	std::stringstream cmd;
-	int buffer;
-	static const char *functionName = "stopProgram";
-	
-	// Get the address, which is the buffer # containing the program, rather than an axis index
-	pasynManager->getAddr(pasynUser, &buffer);
-	
-	asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: drvUser->programName = %s, drvUser->len = %i\n", driverName, functionName, ((SPiiPlusDrvUser_t *)pasynUser->drvUser)->programName, ((SPiiPlusDrvUser_t *)pasynUser->drvUser)->len);
-	// STOP buffer
-	cmd << "STOP " << buffer;
-	status = pComm_->writeReadAck(cmd);
+	SPiiPlusAxis *pAxis;
+	double tolerance;
+	int i;
+	static const char *functionName = "validateMotionParams";
 	
-	return status;
+	for (i=firstAxis; i<=lastAxis; i++)
+	{
+		pAxis = getAxis(i);
+		if ((pAxis == NULL) || !pAxis->accelerationCached_) continue;
+		
+		tolerance = fabs(pAxis->cachedAcceleration_) * SPIIPLUS_MOTION_PARAM_TOLERANCE;
+		if ((fabs(acceleration_[i] - pAxis->cachedAcceleration_) > tolerance) || (fabs(deceleration_[i] - pAxis->cachedAcceleration_) > tolerance))
+		{
+			asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: axis %i ACC/DEC changed outside of the driver\n", driverName, functionName, i);
+			pAxis->accelerationCached_ = false;
+		}
+	}
 }
 
-
-SPiiPlusAxis::SPiiPlusAxis(SPiiPlusController *pC, int axisNo)
-: asynMotorAxis(pC, axisNo),
-  pC_(pC)
+/*
+ * Force the next move of every axis to write ACC/DEC
+ */
+void SPiiPlusController::invalidateMotionParams()
 {
-	// Initialize variables to avoid freeing random memory
-	profilePositionsUser_ = NULL;
+	SPiiPlusAxis *pAxis;
+	int i;
 	
-	setIntegerParam(pC->motorStatusHasEncoder_, 1);
-	// Gain Support is required for setClosedLoop to be called
-	setIntegerParam(pC->motorStatusGainSupport_, 1);
+	for (i=0; i<numAxes_; i++)
+	{
+		pAxis = getAxis(i);
+		if (pAxis != NULL) pAxis->accelerationCached_ = false;
+	}
 }
 
-asynStatus SPiiPlusAxis::poll(bool* moving)
+void SPiiPlusController::setAxisActive(int axis)
 {
-	asynStatus status = asynSuccess;
-	SPiiPlusController* controller = (SPiiPlusController*) pC_;
-	//static const char *functionName = "poll";
-	std::stringstream cmd;
-	
-	// APOS (queried in controller poll method)
-	setDoubleParam(controller->motorPosition_, (controller->axisPosition_[axisNo_] / resolution_));
-	
-	if (dummy_)
+	if (!axisActive_[axis])
 	{
-		// APOS (queried in controller poll method)
-		setDoubleParam(controller->motorEncoderPosition_, (controller->axisPosition_[axisNo_] / resolution_));
-		// Faults are disabled for dummy axes
-		setIntegerParam(controller->motorStatusLowLimit_, 0);
-		setIntegerParam(controller->motorStatusHighLimit_, 0);
+		axisActive_[axis] = true;
+		pollRangesDirty_ = true;
 	}
-	else if (virtual_)
+}
+
+/*
+ * Group the active axes into the ranges that are read by pollVariables.  Two ranges are merged
+ * when reading the axes between them costs fewer bytes than the extra query would.
+ * Every axis is read if no axes are active yet (before iocInit).
+ */
+void SPiiPlusController::updatePollRanges()
+{
+	int i, gap;
+	static const char *functionName = "updatePollRanges";
+	
+	pollRanges_.clear();
+	// The commands of the old ranges won't be sent again
+	pComm_->clearFrameCache();
+	
+	for (i=0; i<numAxes_; i++)
 	{
-		if (controller->virtualFeedbackPositionSupported_)
+		if (!axisActive_[i]) continue;
+		
+		if (pollRanges_.empty())
 		{
-			// VPOS (queried in controller poll method)
-			setDoubleParam(controller->motorEncoderPosition_, controller->virtualFeedbackPosition_[axisNo_] / controller->encoderFactor_[axisNo_]);
+			pollRanges_.push_back(std::make_pair(i, i));
+			continue;
+		}
+		
+		// Doubles are the largest polled elements, so use them for the cost of the gap
+		gap = i - pollRanges_.back().second - 1;
+		if ((gap * (int)sizeof(epicsFloat64)) <= roundTripBytes_)
+		{
+			pollRanges_.back().second = i;
 		}
 		else
 		{
-			// APOS (queried in controller poll method)
-			setDoubleParam(controller->motorEncoderPosition_, (controller->axisPosition_[axisNo_] / resolution_));
+			pollRanges_.push_back(std::make_pair(i, i));
 		}
-		// Faults are disabled for virtual axes
-		setIntegerParam(controller->motorStatusLowLimit_, 0);
-		setIntegerParam(controller->motorStatusHighLimit_, 0);
 	}
-	else
+	
+	if (pollRanges_.empty())
 	{
-		// FPOS (queried in controller poll method) = FP * EFAC + EOFFS
-		// TODO: detect when there is no encoder and fix the encoder position at zero
+		pollRanges_.push_back(std::make_pair(0, numAxes_-1));
+	}
+	
+	for (i=0; i<(int)pollRanges_.size(); i++)
+	{
+		asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: poll range %i = (%i, %i)\n", driverName, functionName, i, pollRanges_[i].first, pollRanges_[i].second);
+	}
+	
+	pollRangesDirty_ = false;
+}
+
+asynStatus SPiiPlusController::configBinaryPort(const char *asynPortName)
+{
+	return pComm_->connectBinaryPort(asynPortName);
+}
+
+/*
+ * Configure the tiered poll schedule used when the poll snapshot isn't active.
+ * A slow divisor of 1 and an on-demand divisor of 1 read every variable every poll.
+ */
+asynStatus SPiiPlusController::configPolling(int slowPollDivisor, int onDemandPollDivisor, int roundTripBytes)
+{
+	static const char *functionName = "configPolling";
+	
+	if ((slowPollDivisor < 1) || (onDemandPollDivisor < 0) || (roundTripBytes < 0))
+	{
+		asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Invalid poll settings: slow=%i, on-demand=%i, round trip=%i\n", driverName, functionName, slowPollDivisor, onDemandPollDivisor, roundTripBytes);
+		return asynError;
+	}
+	
+	slowPollDivisor_ = slowPollDivisor;
+	onDemandPollDivisor_ = onDemandPollDivisor;
+	roundTripBytes_ = roundTripBytes;
+	pollRangesDirty_ = true;
+	slowPollRequested_ = true;
+	onDemandPollRequested_ = true;
+	
+	return asynSuccess;
+}
+
+/*
+ * Reserve a program buffer for the feeder program of the upload execution mode.  The matrix
+ * used by the feeder program is deleted, in case an earlier IOC created it with a different size.
+ */
+asynStatus SPiiPlusController::configProfileBuffer(int buffer)
+{
+	std::stringstream cmd;
+	int i;
+	static const char *functionName = "configProfileBuffer";
+	
+	profileBuffer_ = buffer;
+	loadedFeeder_.clear();
+	for (i=0; i<SPIIPLUS_PROFILE_SLOTS; i++)
+	{
+		profileSlots_[i].uploaded = false;
+		profileSlots_[i].hashValid = false;
+	}
+	
+	if (buffer < 0)
+	{
+		asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: Profile upload disabled\n", driverName, functionName);
+		return asynSuccess;
+	}
+	
+	// A feeder program left by an earlier IOC names the matrices, so the buffer is cleared first
+	cmd << "STOP " << buffer;
+	pComm_->writeReadAck(cmd);
+	cmd << "#" << buffer << "D";
+	pComm_->writeReadAck(cmd);
+	
+	// The matrices are declared by the first upload
+	for (i=0; i<SPIIPLUS_PROFILE_SLOTS; i++)
+	{
+		cmd << "#VGV " << profileSlots_[i].dataVar;
+		pComm_->writeReadAck(cmd);
+		profileSlots_[i].uploadCols = 0;
+	}
+	
+	return asynSuccess;
+}
+
+/*
+ * Read the array that is filled by the snapshot program and unpack it into the arrays
+ * that are normally populated by pollVariables.  The array has one row per variable
+ * and one column per axis.
+ */
+asynStatus SPiiPlusController::pollSnapshot()
+{
+	asynStatus status;
+	double snapshotTime;
+	epicsTimeStamp now;
+	int i;
+	static const char *functionName = "pollSnapshot";
+	
+	status = pComm_->getDoubleArray((char *)snapshotData_, SPIIPLUS_SNAPSHOT_VAR, 0, SPIIPLUS_SNAPSHOT_ROWS-1, 0, numAxes_-1);
+	if (status != asynSuccess) return status;
+	
+	// The program writes TIME after it has copied all of the axes.  A pass can take longer than a poll
+	// period, so the program is only taken to have stopped when TIME hasn't changed for several passes.
+	snapshotTime = snapshotData_[SPIIPLUS_SNAPSHOT_TIME*numAxes_];
+	epicsTimeGetCurrent(&now);
+	if (snapshotTime != snapshotTime_)
+	{
+		snapshotTime_ = snapshotTime;
+		snapshotAdvanced_ = now;
+	}
+	else if (epicsTimeDiffInSeconds(&now, &snapshotAdvanced_) > snapshotStaleTime_)
+	{
+		asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Snapshot program in buffer %i isn't running\n", driverName, functionName, snapshotBuffer_);
+		return asynError;
+	}
+	
+	/* positions */
+	memcpy(axisPosition_, snapshotData_+SPIIPLUS_SNAPSHOT_APOS*numAxes_, numAxes_*sizeof(epicsFloat64));
+	memcpy(referencePosition_, snapshotData_+SPIIPLUS_SNAPSHOT_RPOS*numAxes_, numAxes_*sizeof(epicsFloat64));
+	memcpy(encoderPosition_, snapshotData_+SPIIPLUS_SNAPSHOT_EPOS*numAxes_, numAxes_*sizeof(epicsFloat64));
+	memcpy(feedbackPosition_, snapshotData_+SPIIPLUS_SNAPSHOT_FPOS*numAxes_, numAxes_*sizeof(epicsFloat64));
+	memcpy(feedback2Position_, snapshotData_+SPIIPLUS_SNAPSHOT_F2POS*numAxes_, numAxes_*sizeof(epicsFloat64));
+	if (virtualFeedbackPositionSupported_)
+	{
+		memcpy(virtualFeedbackPosition_, snapshotData_+SPIIPLUS_SNAPSHOT_VPOS*numAxes_, numAxes_*sizeof(epicsFloat64));
+	}
+	memcpy(feedbackVelocity_, snapshotData_+SPIIPLUS_SNAPSHOT_FVEL*numAxes_, numAxes_*sizeof(epicsFloat64));
+	
+	/* offsets */
+	memcpy(referenceOffset_, snapshotData_+SPIIPLUS_SNAPSHOT_ROFFS*numAxes_, numAxes_*sizeof(epicsFloat64));
+	memcpy(encoderOffset_, snapshotData_+SPIIPLUS_SNAPSHOT_EOFFS*numAxes_, numAxes_*sizeof(epicsFloat64));
+	memcpy(encoder2Offset_, snapshotData_+SPIIPLUS_SNAPSHOT_E2OFFS*numAxes_, numAxes_*sizeof(epicsFloat64));
+	memcpy(absoluteEncoderOffset_, snapshotData_+SPIIPLUS_SNAPSHOT_E_AOFFS*numAxes_, numAxes_*sizeof(epicsFloat64));
+	
+	/* max values */
+	memcpy(maxVelocity_, snapshotData_+SPIIPLUS_SNAPSHOT_XVEL*numAxes_, numAxes_*sizeof(epicsFloat64));
+	memcpy(maxAcceleration_, snapshotData_+SPIIPLUS_SNAPSHOT_XACC*numAxes_, numAxes_*sizeof(epicsFloat64));
+	
+	/* motion parameters */
+	memcpy(acceleration_, snapshotData_+SPIIPLUS_SNAPSHOT_ACC*numAxes_, numAxes_*sizeof(epicsFloat64));
+	memcpy(deceleration_, snapshotData_+SPIIPLUS_SNAPSHOT_DEC*numAxes_, numAxes_*sizeof(epicsFloat64));
+	validateMotionParams(0, numAxes_-1);
+	
+	/* statuses (the program stores the integers in a real array; 32-bit integers are exact as doubles) */
+	for (i=0; i<numAxes_; i++)
+	{
+		axisStatus_[i] = (epicsInt32)snapshotData_[SPIIPLUS_SNAPSHOT_AST*numAxes_+i];
+		motorStatus_[i] = (epicsInt32)snapshotData_[SPIIPLUS_SNAPSHOT_MST*numAxes_+i];
+		faultStatus_[i] = (epicsInt32)snapshotData_[SPIIPLUS_SNAPSHOT_FAULT*numAxes_+i];
+		motorFlags_[i] = (epicsInt32)snapshotData_[SPIIPLUS_SNAPSHOT_MFLAGS*numAxes_+i];
+		motorFlagsX_[i] = (epicsInt32)snapshotData_[SPIIPLUS_SNAPSHOT_MFLAGSX*numAxes_+i];
+	}
+	
+	return status;
+}
+
+/*
+ * Load and start the ACSPL+ program that copies the polled variables of every axis
+ * into a single global array, so that each poll only requires one binary query.
+ * The per-variable poll is used if the program can't be loaded or stops running.
+ */
+asynStatus SPiiPlusController::configSnapshot(int buffer)
+{
+	asynStatus status;
+	std::vector <std::string> program;
+	std::stringstream line;
+	std::stringstream cmd;
+	double snapshotTime, lastSnapshotTime;
+	double cycleTime;
+	int i, row;
+	static const char *functionName = "configSnapshot";
+	
+	snapshotActive_ = false;
+	snapshotLoaded_ = false;
+	snapshotBuffer_ = buffer;
+	
+	if (buffer < 0)
+	{
+		asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: Poll snapshot disabled\n", driverName, functionName);
+		return asynSuccess;
+	}
+	
+	/*
+	 * Each axis is copied in a BLOCK so that its values are from the same controller cycle:
+	 *
+	 *   EPICS_SNAPSHOT:
+	 *   GLOBAL REAL EPICS_SNAPSHOT(21)(numAxes)
+	 *   WHILE 1
+	 *     BLOCK
+	 *       EPICS_SNAPSHOT(0)(0)=APOS(0)
+	 *       ...
+	 *     END
+	 *     ...
+	 *     EPICS_SNAPSHOT(20)(0)=TIME
+	 *   END
+	 *   STOP
+	 */
+	program.push_back(SPIIPLUS_SNAPSHOT_LABEL ":");
+	line << "GLOBAL REAL " << SPIIPLUS_SNAPSHOT_VAR << "(" << SPIIPLUS_SNAPSHOT_ROWS << ")(" << numAxes_ << ")";
+	program.push_back(line.str());
+	program.push_back("WHILE 1");
+	for (i=0; i<numAxes_; i++)
+	{
+		program.push_back("BLOCK");
+		for (row=0; row<SPIIPLUS_SNAPSHOT_TIME; row++)
+		{
+			// VPOS is a user-defined array that might not exist
+			if ((row == SPIIPLUS_SNAPSHOT_VPOS) && !virtualFeedbackPositionSupported_) continue;
+			
+			line.str("");
+			line << SPIIPLUS_SNAPSHOT_VAR << "(" << row << ")(" << i << ")=" << snapshotVariables[row] << "(" << i << ")";
+			program.push_back(line.str());
+		}
+		program.push_back("END");
+	}
+	line.str("");
+	line << SPIIPLUS_SNAPSHOT_VAR << "(" << SPIIPLUS_SNAPSHOT_TIME << ")(0)=" << snapshotVariables[SPIIPLUS_SNAPSHOT_TIME];
+	program.push_back(line.str());
+	program.push_back("END");
+	program.push_back("STOP");
+	
+	status = pComm_->loadProgram(buffer, program);
+	if (status != asynSuccess)
+	{
+		asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Unable to load the snapshot program into buffer %i; using per-variable polling\n", driverName, functionName, buffer);
+		return status;
+	}
+	
+	// START buffer,label
+	cmd << "START " << buffer << "," << SPIIPLUS_SNAPSHOT_LABEL;
+	status = pComm_->writeReadAck(cmd);
+	if (status != asynSuccess)
+	{
+		asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Unable to start the snapshot program in buffer %i; using per-variable polling\n", driverName, functionName, buffer);
+		return status;
+	}
+	
+	snapshotLoaded_ = true;
+	epicsTimeGetCurrent(&snapshotAdvanced_);
+	
+	// A pass takes a controller cycle per BLOCK and per line outside of them (CTIME is in ms)
+	cmd << "?CTIME";
+	status = pComm_->writeReadDouble(cmd, &cycleTime);
+	if (status || (cycleTime <= 0.0))
+		cycleTime = 1.0;
+	snapshotStaleTime_ = MAX(SPIIPLUS_SNAPSHOT_STALE_PASSES * (numAxes_ + 3) * cycleTime / 1000.0, SPIIPLUS_SNAPSHOT_STALE_MIN_TIME);
+	
+	// Confirm the program is updating the array before the poller starts to use it
+	cmd << "?" << SPIIPLUS_SNAPSHOT_VAR << "(" << SPIIPLUS_SNAPSHOT_TIME << ")(0)";
+	status = pComm_->writeReadDouble(cmd, &lastSnapshotTime);
+	epicsThreadSleep(snapshotStaleTime_);
+	cmd << "?" << SPIIPLUS_SNAPSHOT_VAR << "(" << SPIIPLUS_SNAPSHOT_TIME << ")(0)";
+	if (status == asynSuccess) status = pComm_->writeReadDouble(cmd, &snapshotTime);
+	if ((status != asynSuccess) || (snapshotTime == lastSnapshotTime))
+	{
+		asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Snapshot program in buffer %i isn't running; using per-variable polling until it is\n", driverName, functionName, buffer);
+		return asynError;
+	}
+	
+	snapshotTime_ = snapshotTime;
+	epicsTimeGetCurrent(&snapshotAdvanced_);
+	snapshotActive_ = true;
+	
+	return asynSuccess;
+}
+
+asynStatus SPiiPlusController::readGlobalIntVar(asynUser *pasynUser, epicsInt32 *value)
+{
+	asynStatus status;
+	std::stringstream cmd;
+	int tag;
+	
+	// Get the address, which is the tag of the global integer, rather than an axis index
+	pasynManager->getAddr(pasynUser, &tag);
+	
+	// ?GETVAR(tag)
+	cmd << "?GETVAR(" << tag << ")";
+	status = pComm_->writeReadInt(cmd, value);
+	
+	return status;
+}
+
+asynStatus SPiiPlusController::writeGlobalIntVar(asynUser *pasynUser, epicsInt32 value)
+{
+	asynStatus status;
+	std::stringstream cmd;
+	int tag;
+	
+	// Get the address, which is the tag of the global integer, rather than an axis index
+	pasynManager->getAddr(pasynUser, &tag);
+	
+	// SETVAR(value, tag)
+	cmd << "SETVAR(" << value << "," << tag << ")";
+	status = pComm_->writeReadAck(cmd);
+	
+	return status;
+}
+
+asynStatus SPiiPlusController::readGlobalRealVar(asynUser *pasynUser, epicsFloat64 *value)
+{
+	asynStatus status;
+	std::stringstream cmd;
+	int tag;
+	
+	// Get the address, which is the tag of the global integer, rather than an axis index
+	pasynManager->getAddr(pasynUser, &tag);
+	
+	// ?GETVAR(tag)
+	cmd << "?GETVAR(" << tag << ")";
+	status = pComm_->writeReadDouble(cmd, value);
+	
+	return status;
+}
+
+asynStatus SPiiPlusController::writeGlobalRealVar(asynUser *pasynUser, epicsFloat64 value)
+{
+	asynStatus status;
+	std::stringstream cmd;
+	int tag;
+	
+	// Get the address, which is the tag of the global integer, rather than an axis index
+	pasynManager->getAddr(pasynUser, &tag);
+	
+	// SETVAR(value, tag)
+	cmd << "SETVAR(" << value << "," << tag << ")";
+	status = pComm_->writeReadAck(cmd);
+	
+	return status;
+}
+
+asynStatus SPiiPlusController::startProgram(asynUser *pasynUser, epicsFloat64 value)
+{
+	asynStatus status;
+	std::stringstream cmd;
+	int buffer;
+	static const char *functionName = "startProgram";
+	
+	// Get the address, which is the buffer # containing the program, rather than an axis index
+	pasynManager->getAddr(pasynUser, &buffer);
+
+	asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: drvUser->programName = %s, drvUser->len = %i\n", driverName, functionName, ((SPiiPlusDrvUser_t *)pasynUser->drvUser)->programName, ((SPiiPlusDrvUser_t *)pasynUser->drvUser)->len);
+	
+	// START buffer,label -or- START buffer,line_no
+	cmd << "START " << buffer << "," << ((SPiiPlusDrvUser_t *)pasynUser->drvUser)->programName;
+	status = pComm_->writeReadAck(cmd);
+	
+	// The program could change the motion parameters of any axis
+	invalidateMotionParams();
+	
+	return status;
+}
+
+asynStatus SPiiPlusController::stopProgram(asynUser *pasynUser, epicsFloat64 value)
+{
+	asynStatus status;
+	std::stringstream cmd;
+	int buffer;
+	static const char *functionName = "stopProgram";
+	
+	// Get the address, which is the buffer # containing the program, rather than an axis index
+	pasynManager->getAddr(pasynUser, &buffer);
+	
+	asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: drvUser->programName = %s, drvUser->len = %i\n", driverName, functionName, ((SPiiPlusDrvUser_t *)pasynUser->drvUser)->programName, ((SPiiPlusDrvUser_t *)pasynUser->drvUser)->len);
+	// STOP buffer
+	cmd << "STOP " << buffer;
+	status = pComm_->writeReadAck(cmd);
+	
+	invalidateMotionParams();
+	
+	return status;
+}
+
+
+SPiiPlusAxis::SPiiPlusAxis(SPiiPlusController *pC, int axisNo)
+: asynMotorAxis(pC, axisNo),
+  pC_(pC)
+{
+	// Initialize variables to avoid freeing random memory
+	profilePositionsUser_ = NULL;
+	
+	deferredMove_ = false;
+	
+	// ACC/DEC are written by the first move
+	cachedAcceleration_ = 0.0;
+	accelerationCached_ = false;
+	
+	setIntegerParam(pC->motorStatusHasEncoder_, 1);
+	// Gain Support is required for setClosedLoop to be called
+	setIntegerParam(pC->motorStatusGainSupport_, 1);
+}
+
+asynStatus SPiiPlusAxis::poll(bool* moving)
+{
+	asynStatus status = asynSuccess;
+	SPiiPlusController* controller = (SPiiPlusController*) pC_;
+	//static const char *functionName = "poll";
+	std::stringstream cmd;
+	
+	// APOS (queried in controller poll method)
+	setDoubleParam(controller->motorPosition_, (controller->axisPosition_[axisNo_] / resolution_));
+	
+	if (dummy_)
+	{
+		// APOS (queried in controller poll method)
+		setDoubleParam(controller->motorEncoderPosition_, (controller->axisPosition_[axisNo_] / resolution_));
+		// Faults are disabled for dummy axes
+		setIntegerParam(controller->motorStatusLowLimit_, 0);
+		setIntegerParam(controller->motorStatusHighLimit_, 0);
+	}
+	else if (virtual_)
+	{
+		if (controller->virtualFeedbackPositionSupported_)
+		{
+			// VPOS (queried in controller poll method)
+			setDoubleParam(controller->motorEncoderPosition_, controller->virtualFeedbackPosition_[axisNo_] / controller->encoderFactor_[axisNo_]);
+		}
+		else
+		{
+			// APOS (queried in controller poll method)
+			setDoubleParam(controller->motorEncoderPosition_, (controller->axisPosition_[axisNo_] / resolution_));
+		}
+		// Faults are disabled for virtual axes
+		setIntegerParam(controller->motorStatusLowLimit_, 0);
+		setIntegerParam(controller->motorStatusHighLimit_, 0);
+	}
+	else
+	{
+		// FPOS (queried in controller poll method) = FP * EFAC + EOFFS
+		// TODO: detect when there is no encoder and fix the encoder position at zero
 		setDoubleParam(controller->motorEncoderPosition_, controller->feedbackPosition_[axisNo_] / controller->encoderFactor_[axisNo_]);
 		
 		// FAULT (queried in controller poll method)
@@ -814,7 +1520,7 @@ asynStatus SPiiPlusAxis::poll(bool* moving)
 	
 	// AST (queried in controller poll method)
 	
-	pegReady_ = controller->axisStatus_[axisNo_] & SPIIPLUS_AXIS_STATUS_PEGREADY;
+	int pegReady = controller->axisStatus_[axisNo_] & SPIIPLUS_AXIS_STATUS_PEGREADY;
 	
 	int enabled;
 	int motion;
@@ -856,7 +1562,15 @@ asynStatus SPiiPlusAxis::poll(bool* moving)
 	
 	callParamCallbacks();
 	
-	moving_ = *moving;
+	// Wake a profile waiting for this axis to stop or for PEGREADY
+	if (((motion != 0) != (moving_ != 0)) || ((pegReady != 0) != (pegReady_ != 0)))
+	{
+		epicsTimeGetCurrent(&controller->axisStateTime_);
+		epicsEventSignal(controller->axisStateEvent_);
+	}
+	
+	moving_ = (motion != 0);
+	pegReady_ = pegReady;
 	
 	if (motion)    { *moving = true; }
 	else           { *moving = false; }
@@ -935,6 +1649,9 @@ asynStatus SPiiPlusAxis::setMaxVelocity(double maxVelocity)
 	cmd << "XVEL(" << axisNo_ << ")=" << (maxVelocity / motorRecResolution * resolution_);
 	status = controller->pComm_->writeReadAck(cmd);
 	
+	// Read back the new value on the next poll
+	controller->onDemandPollRequested_ = true;
+	
 	return status;
 }
 
@@ -952,9 +1669,41 @@ asynStatus SPiiPlusAxis::setMaxAcceleration(double maxAcceleration)
 	cmd << "XACC(" << axisNo_ << ")=" << (maxAcceleration / motorRecResolution * resolution_);
 	status = controller->pComm_->writeReadAck(cmd);
 	
+	// Read back the new value on the next poll
+	controller->onDemandPollRequested_ = true;
+	
+	// The controller limits ACC and DEC to XACC
+	accelerationCached_ = false;
+	
 	return status;
 }
 
+/*
+ * Add the ACC and DEC commands to a batch, unless the controller already has the requested acceleration
+ */
+void SPiiPlusAxis::appendAccelerationCommands(std::vector <std::string>& batch, double acceleration)
+{
+	SPiiPlusController* controller = (SPiiPlusController*) pC_;
+	std::stringstream cmd;
+	double value = acceleration * resolution_;
+	
+	if (accelerationCached_ && (value == cachedAcceleration_))
+	{
+		controller->accelerationWritesSkipped_++;
+		return;
+	}
+	
+	cmd << "ACC(" << axisNo_ << ")=" << value;
+	batch.push_back(cmd.str());
+	cmd.str("");
+	cmd << "DEC(" << axisNo_ << ")=" << value;
+	batch.push_back(cmd.str());
+	
+	// The caller clears the cache if the batch fails
+	cachedAcceleration_ = value;
+	accelerationCached_ = true;
+	controller->accelerationWrites_++;
+}
 
 asynStatus SPiiPlusAxis::move(double position, int relative, double minVelocity, double maxVelocity, double acceleration)
 {
@@ -962,29 +1711,37 @@ asynStatus SPiiPlusAxis::move(double position, int relative, double minVelocity,
 	asynStatus status;
 	double deviceUnits;
 	std::stringstream cmd;
+	std::vector<std::string> batch;
 	
-	//cmd << "XACC(" << axisNo_ << ")=" << ((acceleration + 10) * resolution_);
-	//status = writeReadAck(controller, cmd);
-	cmd << "ACC(" << axisNo_ << ")=" << (acceleration * resolution_);
-	status = controller->pComm_->writeReadAck(cmd);
-	cmd << "DEC(" << axisNo_ << ")=" << (acceleration * resolution_);
-	status = controller->pComm_->writeReadAck(cmd);
+	if (controller->movesDeferred_)
+	{
+		// The move is sent with the other deferred moves by SPiiPlusController::setDeferredMoves
+		deferredPosition_ = position * resolution_;
+		deferredVelocity_ = maxVelocity * resolution_;
+		deferredAcceleration_ = acceleration;
+		deferredRelative_ = relative;
+		deferredMove_ = true;
+		return asynSuccess;
+	}
 	
-	//cmd << "XVEL(" << axisNo_ << ")=" << ((maxVelocity + 10) * resolution_);
+	//cmd << "XACC(" << axisNo_ << ")=" << ((acceleration + 10) * resolution_);
 	//status = writeReadAck(controller, cmd);
-	cmd << "VEL(" << axisNo_ << ")=" << (maxVelocity * resolution_);
-	status = controller->pComm_->writeReadAck(cmd);
+	appendAccelerationCommands(batch, acceleration);
 	
+	// Pass the velocity to the PTP command, rather than sending a separate VEL command
 	if (relative)
 	{
-		cmd << "PTP/r " << axisNo_ << ", " << (position * resolution_);
-		status = controller->pComm_->writeReadAck(cmd);
+		cmd << "PTP/rv " << axisNo_ << ", " << (position * resolution_) << ", " << (maxVelocity * resolution_);
 	}
 	else
 	{
-		cmd << "PTP " << axisNo_ << ", " << (position * resolution_);
-		status = controller->pComm_->writeReadAck(cmd);
+		cmd << "PTP/v " << axisNo_ << ", " << (position * resolution_) << ", " << (maxVelocity * resolution_);
 	}
+	batch.push_back(cmd.str());
+	
+	// Send the commands in a single transaction
+	status = controller->pComm_->writeReadBatch(batch);
+	if (status != asynSuccess) accelerationCached_ = false;
 	
 	return status;
 }
@@ -996,18 +1753,18 @@ asynStatus SPiiPlusAxis::moveVelocity(double minVelocity, double maxVelocity, do
 	asynStatus status;
 	double deviceUnits;
 	std::stringstream cmd;
+	std::vector<std::string> batch;
 
-	cmd << "ACC(" << axisNo_ << ")=" << (acceleration * resolution_);
-	status = controller->pComm_->writeReadAck(cmd);
-
-	cmd << "DEC(" << axisNo_ << ")=" << (acceleration * resolution_);
-	status = controller->pComm_->writeReadAck(cmd);
+	appendAccelerationCommands(batch, acceleration);
 
 	char motionDirection = maxVelocity > 0 ? '+' : '-';
 
 	// Pass the jog velocity to the jog command, rather than change the normal velocity
 	cmd << "JOG/v " << axisNo_ << ", " << (abs(maxVelocity) * resolution_) << ", " << motionDirection;
-	status = controller->pComm_->writeReadAck(cmd);
+	batch.push_back(cmd.str());
+	
+	status = controller->pComm_->writeReadBatch(batch);
+	if (status != asynSuccess) accelerationCached_ = false;
 
 	return status;
 }
@@ -1033,6 +1790,8 @@ asynStatus SPiiPlusAxis::setPosition(double position)
 	  // The controller automatically updates APOS and FPOS when RPOS is updated 
 	  cmd << "SET RPOS(" << axisNo_ << ")=" << (position * resolution_);
 	  status = controller->pComm_->writeReadAck(cmd);
+	  controller->slowPollRequested_ = true;
+	  controller->onDemandPollRequested_ = true;
 	}
 	else
 	{
@@ -1068,6 +1827,8 @@ asynStatus SPiiPlusAxis::setEncoderOffset(double newEncoderOffset)
 	// SET FPOS(n) = FPOS(n) - EOFFS(n) + newEncoderOffset
 	cmd << "SET FPOS(" << axisNo_ << ")=FPOS(" << axisNo_ << ")-EOFFS(" << axisNo_ << ")" << sign << newEncoderOffset;
 	status = controller->pComm_->writeReadAck(cmd);
+	controller->slowPollRequested_ = true;
+	controller->onDemandPollRequested_ = true;
 	
 	if (status != asynSuccess)
 	{
@@ -1105,6 +1866,8 @@ asynStatus SPiiPlusAxis::setEncoder2Offset(double newEncoder2Offset)
 	// SET F2POS(n) = F2POS(n) - E2OFFS(n) + newEncoder2Offset
 	cmd << "SET F2POS(" << axisNo_ << ")=F2POS(" << axisNo_ << ")-E2OFFS(" << axisNo_ << ")" << sign << newEncoder2Offset;
 	status = controller->pComm_->writeReadAck(cmd);
+	controller->slowPollRequested_ = true;
+	controller->onDemandPollRequested_ = true;
 	
 	if (status != asynSuccess)
 	{
@@ -1136,6 +1899,7 @@ asynStatus SPiiPlusAxis::setClosedLoop(bool closedLoop)
 	SPiiPlusController* controller = (SPiiPlusController*) pC_;
 	asynStatus status=asynSuccess;
 	std::stringstream cmd;
+	std::vector<std::string> batch;
 	
 	if (!dummy_ && !virtual_)
 	{
@@ -1150,7 +1914,8 @@ asynStatus SPiiPlusAxis::setClosedLoop(bool closedLoop)
 		{
 			cmd << "DISABLE " << axisNo_;
 		}
-		status = controller->pComm_->writeReadAck(cmd);
+		batch.push_back(cmd.str());
+		status = controller->pComm_->writeReadBatch(batch);
 	}
 	
 	return status;
@@ -1287,6 +2052,10 @@ asynStatus SPiiPlusAxis::home(double minVelocity, double maxVelocity, double acc
 		
 		//asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: home command = %s\n", driverName, functionName, cmd.str().c_str());
 		status = controller->pComm_->writeReadAck(cmd);
+		
+		// The homed flag and offsets are also refreshed when the homing motion ends
+		controller->slowPollRequested_ = true;
+		controller->onDemandPollRequested_ = true;
 	}
 	return status;
 }
@@ -1362,13 +2131,16 @@ asynStatus SPiiPlusAxis::correctProfile(size_t numPoints)
   return (asynStatus)status;
 }
 
-/** Function to correct the readback and following error positions for a profile move. 
-  * Called by SPiiPlusController::readbackProfile
-  * This converts from controller units to steps and then the readbackProfile method
-  * from the base class converts from steps to EPICS user units
-  * \param[in] numPoints The number of positions in the array.
+/** Function to convert the readback and following error positions of a profile move to user units.
+  * Called by SPiiPlusController::readSamples, possibly several times per profile as samples arrive.
+  * Only the new elements are converted, because the conversion is done in place, and then the
+  * arrays are posted with all of the elements read so far.  The conversion is the same as the
+  * base class (which always converts pC->profileNumReadbacks_ elements), after converting from
+  * controller units to steps.
+  * \param[in] first The first element that hasn't been converted.
+  * \param[in] last The number of elements that have been read.
   */
-asynStatus SPiiPlusAxis::readbackProfile(size_t numPoints)
+asynStatus SPiiPlusAxis::readbackProfile(size_t first, size_t last)
 {
   size_t i;
   double resolution;
@@ -1379,22 +2151,27 @@ asynStatus SPiiPlusAxis::readbackProfile(size_t numPoints)
   static const char *functionName = "readbackProfile";
   
   asynPrint(pasynUser_, ASYN_TRACE_FLOW,
-            "%s:%s: axis=%d, resolution=%f\n",
-            driverName, functionName, axisNo_, resolution_);
+            "%s:%s: axis=%d, resolution=%f, first=%d, last=%d\n",
+            driverName, functionName, axisNo_, resolution_, (int)first, (int)last);
 
-  for (i=0; i<numPoints; i++)
+  status |= pC_->getDoubleParam(axisNo_, pC_->profileMotorResolution_, &resolution);
+  status |= pC_->getDoubleParam(axisNo_, pC_->profileMotorOffset_, &offset);
+  status |= pC_->getIntegerParam(axisNo_, pC_->profileMotorDirection_, &direction);
+  if (status) return asynError;
+  
+  // Controller units -> steps -> user units
+  scale = resolution / resolution_;
+  if (direction != 0) scale = -scale;
+  for (i=first; i<last; i++)
   {
-    // Convert controller units into steps
-    profileReadbacks_[i] = profileReadbacks_[i] / resolution_;
-    profileFollowingErrors_[i] = profileFollowingErrors_[i] / resolution_;
+    profileReadbacks_[i] = profileReadbacks_[i] * scale + offset;
+    profileFollowingErrors_[i] = profileFollowingErrors_[i] * scale;
   }
   
-  // Call the base class to convert from steps to user units
-  // Note: the base class only updates pC->profileNumReadbacks_ elements of the arrays
-  asynMotorAxis::readbackProfile();
+  pC_->doCallbacksFloat64Array(profileReadbacks_,       last, pC_->profileReadbacks_,       axisNo_);
+  pC_->doCallbacksFloat64Array(profileFollowingErrors_, last, pC_->profileFollowingErrors_, axisNo_);
   
-  // The base class always returns asynSuccess, so this method will too
-  return (asynStatus)status;
+  return asynSuccess;
 }
 
 /** Reports on status of the axis
@@ -1432,6 +2209,7 @@ void SPiiPlusAxis::report(FILE *fp, int level)
   fprintf(fp, "  homing method: %i\n", homingMethod);
   fprintf(fp, "  max velocity: %lf\n", controller->maxVelocity_[axisNo_]);
   fprintf(fp, "  max acceleration: %lf\n", controller->maxAcceleration_[axisNo_]);
+  fprintf(fp, "  acceleration: %lf, deceleration: %lf\n", controller->acceleration_[axisNo_], controller->deceleration_[axisNo_]);
   fprintf(fp, "  virtual: %s\n", virtual_ ? "Yes" : "No");
   fprintf(fp, "Encoder info for axis %i:\n", axisNo_);
   fprintf(fp, "  encoder type: %i\n", controller->encoderType_[axisNo_]);
@@ -1534,31 +2312,233 @@ std::string SPiiPlusController::positionsToString(int positionIndex)
   return outputStr.str();
 }
 
+/*
+ * Format the POINT command of every point of the full profile into pointStream_, so that
+ * executing the profile only copies commands from memory.  The positions (and velocities of
+ * spline profiles) are formatted like positionsToString (%g) and the times are in ms.
+ */
+void SPiiPlusController::buildPointStream(int segmentMode)
+{
+  char numStr[40];
+  std::string header;
+  int ptIdx;
+  int len;
+  unsigned int j;
+  
+  header = "POINT " + axesToString(profileAxes_);
+  
+  pointStream_.clear();
+  pointStreamOffsets_.clear();
+  pointStreamOffsets_.reserve(fullProfileSize_+1);
+  
+  for (ptIdx=0; ptIdx<fullProfileSize_; ptIdx++)
+  {
+    pointStreamOffsets_.push_back(pointStream_.size());
+    pointStream_.insert(pointStream_.end(), header.begin(), header.end());
+    for (j=0; j<profileAxes_.size(); j++)
+    {
+      len = sprintf(numStr, (j == 0) ? ", %g" : ",%g", pAxes_[profileAxes_[j]]->fullProfilePositions_[ptIdx]);
+      pointStream_.insert(pointStream_.end(), numStr, numStr+len);
+    }
+    // PVSPLINE points also have the velocity of each axis at the end of the segment
+    for (j=0; (segmentMode == SPIIPLUS_PROFILE_SEGMENT_SPLINE) && (j<profileAxes_.size()); j++)
+    {
+      len = sprintf(numStr, ",%g", pAxes_[profileAxes_[j]]->fullProfileVelocities_[ptIdx]);
+      pointStream_.insert(pointStream_.end(), numStr, numStr+len);
+    }
+    len = sprintf(numStr, ", %ld\r", lround(fullProfileTimes_[ptIdx] * 1000.0));
+    pointStream_.insert(pointStream_.end(), numStr, numStr+len);
+  }
+  pointStreamOffsets_.push_back(pointStream_.size());
+}
+
+/*
+ * Send count points of the executing profile, starting at index first, to the PATH point buffer.
+ * In point mode the POINT commands are contiguous in the slot's point stream, so each batch is written straight
+ * from the stream.  In MPOINT mode the points are sent with a single MPOINT command.
+ */
+asynStatus SPiiPlusController::sendPoints(int first, int count, int execMode)
+{
+  if (execMode == SPIIPLUS_PROFILE_EXEC_MPOINT)
+    return sendMatrixPoints(first, count);
+  
+  return sendPointStream(exec_->pointStream, exec_->pointStreamOffsets, first, count);
+}
+
+/*
+ * Send count POINT commands of a stream (see buildPointStream), starting at index first, in
+ * batches of SPIIPLUS_POINT_BATCH_SIZE.
+ */
+asynStatus SPiiPlusController::sendPointStream(const std::vector <char>& stream, const std::vector <size_t>& offsets, int first, int count)
+{
+  static const char *functionName = "sendPointStream";
+  asynStatus status = asynSuccess;
+  size_t start, end;
+  int ptIdx;
+  int numInBatch;
+  
+  for (ptIdx=first; ptIdx<(first+count); ptIdx+=numInBatch)
+  {
+    numInBatch = MIN(SPIIPLUS_POINT_BATCH_SIZE, first+count-ptIdx);
+    start = offsets[ptIdx];
+    end = offsets[ptIdx+numInBatch];
+    
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: sending %i points\n", driverName, functionName, numInBatch);
+    // The '\r' after the last command is left for the output EOS
+    if (pComm_->writeReadBlock(&stream[start], end-start-1, numInBatch) != asynSuccess)
+      status = asynError;
+  }
+  
+  return status;
+}
+
+/*
+ * Declare the matrix used by sendMatrixPoints, with a row per profile axis plus a row for
+ * the time, and a column per point of the PATH buffer.  It is only redeclared when its
+ * size changes; the first declaration deletes a matrix an earlier IOC may have left.
+ */
+asynStatus SPiiPlusController::declareMpointMatrix()
+{
+  std::stringstream cmd;
+  asynStatus status;
+  int rows;
+  
+  rows = exec_->axes.size() + 1;
+  if ((rows == mpointRows_) && (pathBufferSize_ == mpointCols_))
+    return asynSuccess;
+  
+  cmd << "#VGV " << SPIIPLUS_PROFILE_MPOINT_VAR;
+  pComm_->writeReadAck(cmd);
+  
+  cmd << "GLOBAL REAL " << SPIIPLUS_PROFILE_MPOINT_VAR << "(" << rows << ")(" << pathBufferSize_ << ")";
+  status = pComm_->writeReadAck(cmd);
+  if (status)
+  {
+    mpointRows_ = 0;
+    mpointCols_ = 0;
+    return status;
+  }
+  
+  mpointRows_ = rows;
+  mpointCols_ = pathBufferSize_;
+  return asynSuccess;
+}
+
+/*
+ * Write count profile points, starting at index first, to the columns of the MPOINT matrix
+ * and add them to the PATH buffer with one MPOINT command, so a refill takes two
+ * transactions regardless of its size.
+ */
+asynStatus SPiiPlusController::sendMatrixPoints(int first, int count)
+{
+  static const char *functionName = "sendMatrixPoints";
+  std::stringstream cmd;
+  asynStatus status;
+  unsigned int j;
+  int ptIdx;
+  
+  if (count <= 0)
+    return asynSuccess;
+  
+  mpointMatrix_.resize(mpointRows_ * count);
+  for (j=0; j<exec_->axes.size(); j++)
+  {
+    for (ptIdx=0; ptIdx<count; ptIdx++)
+    {
+      mpointMatrix_[j*count + ptIdx] = exec_->position(j, first+ptIdx);
+    }
+  }
+  // The last row is the segment time in ms
+  for (ptIdx=0; ptIdx<count; ptIdx++)
+  {
+    mpointMatrix_[(mpointRows_-1)*count + ptIdx] = lround(exec_->time(first+ptIdx) * 1000.0);
+  }
+  
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: sending %i points\n", driverName, functionName, count);
+  
+  // declareMpointMatrix created the matrix, so the existence check can be skipped
+  status = pComm_->putDoubleArray(&mpointMatrix_[0], SPIIPLUS_PROFILE_MPOINT_VAR, 0, mpointRows_-1, 0, count-1, false);
+  if (status)
+    return status;
+  
+  cmd << "MPOINT " << axesToString(exec_->axes) << ", " << SPIIPLUS_PROFILE_MPOINT_VAR << ", " << count;
+  return pComm_->writeReadAck(cmd);
+}
+
+/*
+ * The motion time (s) of the points of the executing profile from index first up to, but not including, last.
+ */
+double SPiiPlusController::bufferedTime(int first, int last)
+{
+  double time = 0.0;
+  int ptIdx;
+  
+  for (ptIdx=MAX(first, 0); ptIdx<MIN(last, exec_->size); ptIdx++)
+  {
+    time += exec_->time(ptIdx);
+  }
+  
+  return time;
+}
+
+/*
+ * Point the profile views at the arena for the current profile axes.  Each row is the time
+ * of a point followed by the positions and then the velocities of the profile axes, in
+ * the order of profileAxes_, so the rows are only as long as the profile needs.
+ */
+void SPiiPlusController::layoutProfileArena()
+{
+  unsigned int j;
+  size_t numProfileAxes;
+  
+  numProfileAxes = profileAxes_.size();
+  profileArenaStride_ = 1 + 2*numProfileAxes;
+  
+  fullProfileTimes_.attach(profileArena_, profileArenaStride_);
+  for (j=0; j<numProfileAxes; j++)
+  {
+    pAxes_[profileAxes_[j]]->fullProfilePositions_.attach(profileArena_ + 1 + j, profileArenaStride_);
+    pAxes_[profileAxes_[j]]->fullProfileVelocities_.attach(profileArena_ + 1 + numProfileAxes + j, profileArenaStride_);
+  }
+}
+
 asynStatus SPiiPlusController::initializeProfile(size_t maxProfilePoints, size_t maxProfilePulses)
 {
   int axis;
   SPiiPlusAxis *pAxis;
   asynStatus status;
   int i;
+  int dcRows;
   std::stringstream cmd;
   // static const char *functionName = "initializeProfile";
   
   /*
-   * Create point and time arrays that have extra elements for the 
-   * acceleration and deceleration, not including the starting position
+   * Create the profile arena, which has a row per point of the full profile (with extra
+   * rows for the acceleration and deceleration, not including the starting position).
+   * A row holds the time and the position and velocity of every profile axis, so it is
+   * sized for the case where all of the axes are used.  buildProfile lays out the rows.
+   * Each profile slot has its own arena, so a build can fill one while the other executes.
    */
-  if (fullProfileTimes_) free(fullProfileTimes_);
-  fullProfileTimes_ = (double *)calloc(maxProfilePoints+(2*MAX_ACCEL_SEGMENTS)-1, sizeof(double));
+  for (i=0; i<SPIIPLUS_PROFILE_SLOTS; i++)
+  {
+    if (profileSlots_[i].arena) free(profileSlots_[i].arena);
+    profileSlots_[i].arena = (double *)calloc((maxProfilePoints+(2*MAX_ACCEL_SEGMENTS)-1) * (1+2*numAxes_), sizeof(double));
+    profileSlots_[i].stride = 0;
+    profileSlots_[i].hashValid = false;
+  }
+  profileArena_ = NULL;
+  profileArenaStride_ = 0;
+  nextSlot_ = -1;
+  
+  // The user-specified positions are written one axis at a time, so each axis gets a contiguous slice
+  if (profileUserPositions_) free(profileUserPositions_);
+  profileUserPositions_ = (double *)calloc(maxProfilePoints * numAxes_, sizeof(double));
   
   for (axis=0; axis<numAxes_; axis++) {
     pAxis = getAxis(axis);
     if (!pAxis) continue;
     
-    if (pAxis->fullProfilePositions_) free(pAxis->fullProfilePositions_);
-    pAxis->fullProfilePositions_ = (double *)calloc(maxProfilePoints+(2*MAX_ACCEL_SEGMENTS)-1, sizeof(double));
-    
-    if (pAxis->profilePositionsUser_) free(pAxis->profilePositionsUser_);
-    pAxis->profilePositionsUser_ = (double *)calloc(maxProfilePoints, sizeof(double));
+    pAxis->profilePositionsUser_ = profileUserPositions_ + axis*maxProfilePoints;
   }
   
   // This sets maxProfilePoints_
@@ -1578,15 +2558,30 @@ asynStatus SPiiPlusController::initializeProfile(size_t maxProfilePoints, size_t
   if (profilePulsePositions_) free(profilePulsePositions_);
   profilePulsePositions_ = (double *)calloc(maxProfilePulses, sizeof(double));
   
-  // Create the arrays in the controller to hold the data that is recorded during profile moves
-  for (i=0; i<SPIIPLUS_MAX_DC_AXES; i++)
+  // The pulse positions of the array pulse mode, one array per slot; builds only send the positions that are used
+  for (i=0; i<SPIIPLUS_PROFILE_SLOTS; i++)
+  {
+    // The upload matrices are sized by maxProfilePoints, so they are redeclared by the next upload
+    profileSlots_[i].uploaded = false;
+    profileSlots_[i].uploadCols = 0;
+    
+    cmd << "#VGV " << profileSlots_[i].pulseVar;
+    pComm_->writeReadAck(cmd);
+    cmd << "GLOBAL REAL " << profileSlots_[i].pulseVar << "(" << maxProfilePulses << ")";
+    pComm_->writeReadAck(cmd);
+  }
+  
+  // Create the arrays in the controller to hold the data that is recorded during profile moves.
+  // Each array has a position row and a position error row for every axis its channel records.
+  dcRows = 2 * ((numAxes_ + SPIIPLUS_MAX_DC_CHANNELS - 1) / SPIIPLUS_MAX_DC_CHANNELS);
+  for (i=0; i<SPIIPLUS_MAX_DC_CHANNELS; i++)
   {
     // Delete the array, if it exists, in case maxProfilePoints changed
     cmd << "#VGV DC_DATA_" << (i+1);
     pComm_->writeReadAck(cmd);
     
     // Data recorded with the DC command will reside in DC_DATA_{1,2,3,4,5,6,7,8} 2D arrays
-    cmd << "GLOBAL REAL DC_DATA_" << (i+1) << " (3)(" << maxProfilePoints << ")";
+    cmd << "GLOBAL REAL DC_DATA_" << (i+1) << " (" << dcRows << ")(" << maxProfilePoints << ")";
     pComm_->writeReadAck(cmd);
   }
   
@@ -1647,11 +2642,77 @@ asynStatus SPiiPlusController::definePulses(int pulseAxis, int moveMode, size_t
     }
   }
   
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
-            "%s:%s: scale=%f, offset=%f, resolution_=%f, profilePulsesUser_[0]=%f, profilePulses_[0]=%f\n",
-            driverName, functionName, scale, offset, axis->resolution_, profilePulsesUser_[0], profilePulses_[0]);
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s:%s: scale=%f, offset=%f, resolution_=%f, profilePulsesUser_[0]=%f, profilePulses_[0]=%f\n",
+            driverName, functionName, scale, offset, axis->resolution_, profilePulsesUser_[0], profilePulses_[0]);
+  
+  return asynSuccess;
+}
+
+// 64-bit FNV-1a
+#define SPIIPLUS_FNV_OFFSET 14695981039346656037ULL
+#define SPIIPLUS_FNV_PRIME  1099511628211ULL
+
+static void hashBytes(uint64_t *hash, const void *data, size_t size)
+{
+  const unsigned char *bytes = (const unsigned char *)data;
+  size_t i;
+  
+  for (i=0; i<size; i++)
+  {
+    *hash ^= bytes[i];
+    *hash *= SPIIPLUS_FNV_PRIME;
+  }
+}
+
+/*
+ * Hash everything a build depends on: the settings (the build parameters), the axis set, the
+ * times, the positions and limits of the profile axes, and the pulse positions with the
+ * conversion of the pulse axis.  Relative profiles start from the positions given by
+ * profileOrigin, which are checked against the soft limits, so they are included too.
+ */
+uint64_t SPiiPlusController::hashProfile(const double *settings, int numSettings, int moveMode, int numPoints, int pulseAxis, int numPulses)
+{
+  uint64_t hash = SPIIPLUS_FNV_OFFSET;
+  double axisValues[7];
+  double pulseValues[3];
+  int direction;
+  unsigned int j;
+  SPiiPlusAxis *axis;
+  
+  numPoints = MAX(0, MIN(numPoints, (int)maxProfilePoints_));
+  numPulses = MAX(0, MIN(numPulses, (int)maxProfilePulses_));
+  
+  hashBytes(&hash, settings, numSettings*sizeof(double));
+  hashBytes(&hash, profileTimes_, numPoints*sizeof(double));
+  
+  for (j=0; j<profileAxes_.size(); j++)
+  {
+    axis = pAxes_[profileAxes_[j]];
+    axisValues[0] = profileAxes_[j];
+    axisValues[1] = maxVelocity_[profileAxes_[j]];
+    axisValues[2] = maxAcceleration_[profileAxes_[j]];
+    axisValues[3] = axis->resolution_;
+    axisValues[4] = axisValues[5] = 0.0;
+    getDoubleParam(profileAxes_[j], motorLowLimit_, &axisValues[4]);
+    getDoubleParam(profileAxes_[j], motorHighLimit_, &axisValues[5]);
+    axisValues[6] = 0.0;
+    if (moveMode == PROFILE_MOVE_MODE_RELATIVE)
+      axisValues[6] = profileOrigin(profileAxes_[j]);
+    hashBytes(&hash, axisValues, sizeof(axisValues));
+    hashBytes(&hash, axis->profilePositions_, numPoints*sizeof(double));
+  }
+  
+  direction = 0;
+  pulseValues[0] = pulseValues[1] = 0.0;
+  getDoubleParam(pulseAxis, motorRecResolution_, &pulseValues[0]);
+  getDoubleParam(pulseAxis, motorRecOffset_, &pulseValues[1]);
+  getIntegerParam(pulseAxis, motorRecDirection_, &direction);
+  pulseValues[2] = direction;
+  hashBytes(&hash, pulseValues, sizeof(pulseValues));
+  hashBytes(&hash, profilePulsesUser_, numPulses*sizeof(double));
   
-  return asynSuccess;
+  return hash;
 }
 
 /** Function to build a coordinated move of multiple axes. */
@@ -1662,7 +2723,6 @@ asynStatus SPiiPlusController::buildProfile()
   unsigned int idx;
   int status;
   bool buildOK=true;
-  //bool verifyOK=true;
   int moveMode;
   int numPoints;
   int timeMode;
@@ -1673,35 +2733,37 @@ asynStatus SPiiPlusController::buildProfile()
   int numPulses;
   int startPulses;
   int endPulses;
-  double pulseAxisCurrentPos;
-  double pulseAxisCurrentRawPos;
   //int numElements;
   //double trajVel;
   //double D0, D1, T0, T1;
   char message[MAX_MESSAGE_LEN];
   int buildStatus;
-  double maxVelocity;
   double maxAcceleration;
-  //double maxVelocityActual=0.0;
-  //double maxAccelerationActual=0.0;
-  //double minPositionActual=0.0, maxPositionActual=0.0;
-  //double minProfile, maxProfile;
-  //double lowLimit, highLimit;
-  //double minJerkTime, maxJerkTime;
   double preTimeMax, postTimeMax;
   double preVelocity[SPIIPLUS_MAX_AXES], postVelocity[SPIIPLUS_MAX_AXES];
   double preTime, postTime;
+  double rampFactor;
+  double rampPeriod;
+  double cycleTime;
   double preDistance, postDistance;
   std::string axisList;
   int useAxis;
+  int execMode;
+  int segmentMode;
+  int rampMode;
   std::stringstream cmd;
   SPiiPlusAxis *pPulseAxis;
   SPiiPlusAxis *axis;
+  epicsTimeStamp buildStart, buildEnd;
+  uint64_t hash;
+  SPiiPlusProfileSlot *slot;
   static const char *functionName = "buildProfile";
   
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
             "%s:%s: entry\n",
             driverName, functionName);
+  
+  epicsTimeGetCurrent(&buildStart);
             
   // Call the base class method which will build the time array if needed
   asynMotorController::buildProfile();
@@ -1723,26 +2785,34 @@ asynStatus SPiiPlusController::buildProfile()
   getIntegerParam(profileNumPulses_,   &numPulses);
   getIntegerParam(profileStartPulses_, &startPulses);
   getIntegerParam(profileEndPulses_,   &endPulses);
-  getDoubleParam(pulseAxis,  motorPosition_,      &pulseAxisCurrentRawPos);
+  getIntegerParam(SPiiPlusProfileExecMode_,    &execMode);
+  getIntegerParam(SPiiPlusProfileSegmentMode_, &segmentMode);
+  getIntegerParam(SPiiPlusProfileRampMode_,    &rampMode);
+  getDoubleParam(SPiiPlusProfileRampPeriod_,   &rampPeriod);
+  
+  // runProfile waits for the PEGREADY bit of the pulse axis, which may not be a profile axis
+  if ((pulseAxis >= 0) && (pulseAxis < numAxes_))
+    setAxisActive(pulseAxis);
   
   // 
   profileAxes_.clear();
-  memset(profileAccelTimes_, 0, MAX_ACCEL_SEGMENTS*sizeof(double));
-  memset(profileDecelTimes_, 0, MAX_ACCEL_SEGMENTS*sizeof(double));
+  profileAccelTimes_.clear();
+  profileDecelTimes_.clear();
   
   for (i=0; i<numAxes_; i++) {
     // Zero the velocity arrays
     preVelocity[i] = 0.;
     postVelocity[i] = 0.;
-    // Zero the accel/decel arrays
-    memset(pAxes_[i]->profileAccelPositions_, 0, MAX_ACCEL_SEGMENTS*sizeof(double));
-    memset(pAxes_[i]->profileDecelPositions_, 0, MAX_ACCEL_SEGMENTS*sizeof(double));
+    // Empty the accel/decel arrays
+    pAxes_[i]->profileAccelPositions_.clear();
+    pAxes_[i]->profileDecelPositions_.clear();
     // Check which axes should be used
     getIntegerParam(i, profileUseAxis_, &useAxis);
     asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: %i axis will be used: %i\n", driverName, functionName, i, useAxis);
     if (useAxis)
     {
       profileAxes_.push_back(i);
+      setAxisActive(i);
       
       if (moveMode == PROFILE_MOVE_MODE_RELATIVE)
       {
@@ -1761,6 +2831,79 @@ asynStatus SPiiPlusController::buildProfile()
     goto done;
   }
   
+  // The feeder program and the MPOINT matrix only hold positions
+  if ((segmentMode == SPIIPLUS_PROFILE_SEGMENT_SPLINE) && (execMode != SPIIPLUS_PROFILE_EXEC_POINT))
+  {
+    strcpy(message, "Spline segments require the Point execution mode");
+    buildOK = false;
+    goto done;
+  }
+  
+  // Repeated scan lines often build the same profile; its products and the data in the controller can be reused
+  {
+    double settings[] = {(double)moveMode, (double)numPoints, (double)timeMode, timePerPoint, accelTime, (double)pulseMode,
+                         (double)pulseAxis, (double)numPulses, (double)startPulses, (double)endPulses, (double)execMode,
+                         (double)segmentMode, (double)rampMode, rampPeriod};
+    hash = hashProfile(settings, sizeof(settings)/sizeof(settings[0]), moveMode, numPoints, pulseAxis, numPulses);
+  }
+  for (i=0; i<SPIIPLUS_PROFILE_SLOTS; i++)
+  {
+    if (profileSlots_[i].hashValid && (hash == profileSlots_[i].hash))
+    {
+      nextSlot_ = i;
+      profileBuildsSkipped_++;
+      sprintf(message, "Profile unchanged; reusing the build in slot %i", i);
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: %s\n", driverName, functionName, message);
+      goto done;
+    }
+  }
+  
+  /*
+   * Build into the slot that isn't executing, so the next profile can be built and uploaded
+   * while the current one runs.  When nothing is executing, the slot of the last build is
+   * kept, so an unchanged profile can still reuse it.  The lock is released while the slot's
+   * arrays are sent to the controller, so nextSlot_ never refers to the slot being built.
+   */
+  if (execSlot_ >= 0)
+    slot = &profileSlots_[(execSlot_ + 1) % SPIIPLUS_PROFILE_SLOTS];
+  else if (nextSlot_ >= 0)
+    slot = &profileSlots_[(nextSlot_ + 1) % SPIIPLUS_PROFILE_SLOTS];
+  else
+    slot = &profileSlots_[0];
+  if (nextSlot_ == slot->index)
+    nextSlot_ = -1;
+  slot->hashValid = false;
+  slot->moveMode = moveMode;
+  slot->execMode = execMode;
+  slot->numPoints = numPoints;
+  slot->numPulses = numPulses;
+  slot->startPulses = startPulses;
+  slot->endPulses = endPulses;
+  slot->pulseMode = pulseMode;
+  slot->pulseAxis = pulseAxis;
+  profileArena_ = slot->arena;
+  
+  if (!profileArena_)
+  {
+    strcpy(message, "No profile arrays (SPiiPlusCreateProfile)");
+    buildOK = false;
+    goto done;
+  }
+  layoutProfileArena();
+  
+  /* Ramp segments shorter than a few controller cycles can't be followed, so the
+   * segment period is at least SPIIPLUS_MIN_SEGMENT_CYCLES cycles (CTIME is in ms). */
+  cmd << "?CTIME";
+  status = pComm_->writeReadDouble(cmd, &cycleTime);
+  if (status || (cycleTime <= 0.0))
+  {
+    cycleTime = 1.0;
+  }
+  rampPeriod = MAX(rampPeriod, SPIIPLUS_MIN_SEGMENT_CYCLES * cycleTime / 1000.0);
+  
+  // An S-curve ramp needs more time than a linear ramp to stay within the same acceleration
+  rampFactor = (rampMode == SPIIPLUS_PROFILE_RAMP_SCURVE) ? SPIIPLUS_SCURVE_PEAK_ACCEL : 1.0;
+  
   asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: axisList = %s\n", driverName, functionName, axesToString(profileAxes_).c_str());
   sprintf(message, "Selected axes: %s", motorsToString(profileAxes_).c_str()); 
   setStringParam(profileBuildMessage_, message);
@@ -1801,19 +2944,11 @@ asynStatus SPiiPlusController::buildProfile()
     // j != axis index
     idx = profileAxes_[j];
      
-    // Query the max velocity and acceleration
-    cmd << "?XVEL(" << idx << ")";
-    status = pComm_->writeReadDouble(cmd, &maxVelocity);
-    if (status) {
-      buildOK = false;
-      sprintf(message, "Error getting XVEL, status=%d\n", status);
-      goto done;
-    }
-    cmd << "?XACC(" << idx << ")";
-    status = pComm_->writeReadDouble(cmd, &maxAcceleration);
-    if (status) {
+    // XACC is read by the on-demand poll, which is refreshed whenever the driver changes it
+    maxAcceleration = maxAcceleration_[idx];
+    if (maxAcceleration <= 0.0) {
       buildOK = false;
-      sprintf(message, "Error getting XACC, status=%d\n", status);
+      sprintf(message, "Invalid XACC for axis %d: %g", idx, maxAcceleration);
       goto done;
     }
     
@@ -1832,7 +2967,7 @@ asynStatus SPiiPlusController::buildProfile()
     }
     // Use the 2nd element of the times array instead of the 1st; the 1st will be used for the preDistance move.
     preVelocity[idx] = preDistance/profileTimes_[1];
-    preTime = fabs(preVelocity[idx]) / maxAcceleration;
+    preTime = rampFactor * fabs(preVelocity[idx]) / maxAcceleration;
     preTimeMax = MAX(preTimeMax, preTime);
     // Use the acceleration specified by the user, if it is less than the max acceleration
     preTimeMax = MAX(preTimeMax, accelTime);
@@ -1846,7 +2981,7 @@ asynStatus SPiiPlusController::buildProfile()
       postDistance = pAxes_[idx]->profilePositions_[numPoints-1];
     }
     postVelocity[idx] = postDistance/profileTimes_[numPoints-1];
-    postTime = fabs(postVelocity[idx]) / maxAcceleration;
+    postTime = rampFactor * fabs(postVelocity[idx]) / maxAcceleration;
     postTimeMax = MAX(postTimeMax, postTime);
     // Use the acceleration specified by the user, if it is less than the max acceleration
     postTimeMax = MAX(postTimeMax, accelTime);
@@ -1858,8 +2993,16 @@ asynStatus SPiiPlusController::buildProfile()
   }
   
   // calculate the number of acceleration segments
-  numAccelSegments_ = getNumAccelSegments(preTimeMax);
-  numDecelSegments_ = getNumAccelSegments(postTimeMax);
+  numAccelSegments_ = getNumAccelSegments(preTimeMax, rampPeriod);
+  numDecelSegments_ = getNumAccelSegments(postTimeMax, rampPeriod);
+  
+  // A single spline segment accelerates from rest to the velocity of the first segment (or
+  // decelerates from the last segment) at a constant rate, so linear ramps don't need more
+  if ((segmentMode == SPIIPLUS_PROFILE_SEGMENT_SPLINE) && (rampMode == SPIIPLUS_PROFILE_RAMP_LINEAR))
+  {
+    numAccelSegments_ = MIN(numAccelSegments_, 1);
+    numDecelSegments_ = MIN(numDecelSegments_, 1);
+  }
   
   // populate the profileAccelTimes_ and profileDecelTimes_ arrays
   createAccDecTimes(preTimeMax, postTimeMax);
@@ -1890,7 +3033,7 @@ asynStatus SPiiPlusController::buildProfile()
     }
     
     // populate the profileAccelPositions_ and profileDecelPositions_ arrays
-    createAccDecPositions(pAxes_[idx], moveMode, numPoints, preTimeMax, postTimeMax, preVelocity[idx], postVelocity[idx]);
+    createAccDecPositions(pAxes_[idx], moveMode, numPoints, preTimeMax, postTimeMax, preVelocity[idx], postVelocity[idx], rampMode);
 
     // For debugging
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s:\taxis = %i\n", driverName, functionName, idx);
@@ -1906,6 +3049,18 @@ asynStatus SPiiPlusController::buildProfile()
   // populate the fullProfileTimes_ and fullProfilePositions_ arrays
   assembleFullProfile(numPoints);
   
+  if (segmentMode == SPIIPLUS_PROFILE_SEGMENT_SPLINE)
+  {
+    calculateSplineVelocities(moveMode);
+  }
+  
+  // Reject profiles that exceed XVEL, XACC or the soft limits before anything is sent to the controller
+  if (!validateProfile(moveMode, numPoints, segmentMode, message))
+  {
+    buildOK = false;
+    goto done;
+  }
+  
   // sanity check the full profile
   //for (j=0; j<profileAxes_.size(); j++)
   //{
@@ -1931,8 +3086,13 @@ asynStatus SPiiPlusController::buildProfile()
   
   // Convert pulse positions in EPICS user units to SPiiPlus units
   definePulses(pulseAxis, moveMode, numPulses);
-  // Convert the raw position of the pulse axis into SPiiPlus units (needed for relative profiles) 
-  pulseAxisCurrentPos = pulseAxisCurrentRawPos * pPulseAxis->resolution_;
+  
+  /*
+   * The pulse positions of a relative profile are from the position of the pulse axis when the
+   * profile starts, which armPEG adds.  The axis may still be moving when the profile is built
+   * during the execution of another one, or when the profile is chained.
+   */
+  slot->relativePulses.clear();
   
   if (pulseMode == 0)
   {
@@ -1961,8 +3121,8 @@ asynStatus SPiiPlusController::buildProfile()
         totalDistance += pPulseAxis->profilePositions_[i];
       }
       
-      // The start position is the motor's current position
-      pulseStartPos_ = pulseAxisCurrentPos;
+      // The start position is the motor's position when the profile starts
+      pulseStartPos_ = 0.0;
       
       // The end position is the starting position + the user-specified displacement
       pulseEndPos_ = pulseStartPos_ + totalDistance;
@@ -1978,28 +3138,39 @@ asynStatus SPiiPlusController::buildProfile()
     // so that problems aren't introduced by users who increase the number of 
     // pulses between building an executing the profileMove?
     
+    if ((numPulses < 1) || (numPulses > (int)maxProfilePulses_)) {
+      buildOK = false;
+      sprintf(message, "Invalid number of pulses: %d", numPulses);
+      goto done;
+    }
+    
     // profilePulses_ is in the correct format for absolute mode, but not relative mode
     if (moveMode == PROFILE_MOVE_MODE_RELATIVE)
     {
-      double current_pos = pulseAxisCurrentPos;
+      double current_pos = 0.0;
       
-      // Convert the pulse displacements to absolute positions
+      // Convert the pulse displacements to positions from the start, which armPEG sends
+      slot->relativePulses.resize(numPulses);
       for (i=0; i<numPulses; i++)
       {
-        profilePulses_[i] = current_pos + profilePulses_[i];
-        current_pos = profilePulses_[i];
+        current_pos += profilePulses_[i];
+        slot->relativePulses[i] = current_pos;
       }
     }
     
     // Send the pulse array now to minimize delays when executing the profile.
-    // NOTE: maxProfilePulses is used instead of numPulses because the global
-    // variable might not exist in the controller yet and the user can modify
-    // The number of pulses at any time.
-    status = pComm_->putDoubleArray(profilePulses_, "pulsePos", 0, maxProfilePulses_-1, 0, 0);
-    if (status) {
-      buildOK = false;
-      sprintf(message, "Error writing pulse positions, status=%d\n", status);
-      goto done;
+    // initializeProfile declared the pulse array of each slot with maxProfilePulses
+    // elements, so only the pulses that are used are sent.
+    if (moveMode == PROFILE_MOVE_MODE_ABSOLUTE)
+    {
+      unlock();
+      status = pComm_->putDoubleArray(profilePulses_, slot->pulseVar, 0, numPulses-1, 0, 0, false);
+      lock();
+      if (status) {
+        buildOK = false;
+        sprintf(message, "Error writing pulse positions, status=%d\n", status);
+        goto done;
+      }
     }
   }
   else if (pulseMode == 2)
@@ -2022,8 +3193,8 @@ asynStatus SPiiPlusController::buildProfile()
     }
     else
     {
-      // The start position is the pulse axis's current start position + displacements to the user-specified pulse start
-      pulseStartPos_ = pulseAxisCurrentPos;
+      // The start position is the pulse axis's start position + displacements to the user-specified pulse start
+      pulseStartPos_ = 0.0;
       for (i=0; i<startPulses; i++)
       {
         pulseStartPos_ += pPulseAxis->profilePositions_[i];
@@ -2056,6 +3227,38 @@ asynStatus SPiiPlusController::buildProfile()
   
   asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s:\tfullProfileSize_ = %i, maxProfilePoints_ = %li, dataCollectionInterval_ = %f\n", driverName, functionName, fullProfileSize_, maxProfilePoints_, dataCollectionInterval_);
 
+  // Upload the profile now, so that executing it doesn't require a command per point
+  slot->uploaded = false;
+  if (execMode == SPIIPLUS_PROFILE_EXEC_UPLOAD)
+  {
+    status = uploadProfile(slot, message);
+    if (status) {
+      buildOK = false;
+      goto done;
+    }
+    slot->uploaded = true;
+  }
+  
+  if (execMode == SPIIPLUS_PROFILE_EXEC_POINT)
+  {
+    buildPointStream(segmentMode);
+  }
+  else
+  {
+    // The point stream isn't needed, so free its memory
+    std::vector <char>().swap(pointStream_);
+    pointStreamOffsets_.clear();
+  }
+  
+  // The next execute runs this build
+  profileSegmentMode_ = segmentMode;
+  profileRampMode_ = rampMode;
+  profileRampPeriod_ = rampPeriod;
+  publishProfile(slot);
+  slot->hash = hash;
+  slot->hashValid = true;
+  nextSlot_ = slot->index;
+  
   // TODO: clear the data arrays heare instead of in runProfile?
   
   // POINT commands have this syntax: POINT (0,1,5), 1000,2000,3000, 500
@@ -2063,6 +3266,13 @@ asynStatus SPiiPlusController::buildProfile()
   // Verfiy the profile (check speed, accel, limit violations)
   
   done:
+  // A failed build leaves nothing to execute
+  if (!buildOK)
+    nextSlot_ = -1;
+  // Report the memory and time used by the build, for sizing MAX_POINTS
+  epicsTimeGetCurrent(&buildEnd);
+  setIntegerParam(SPiiPlusProfileStreamBytes_, (nextSlot_ >= 0) ? (int)profileSlots_[nextSlot_].pointStream.size() : 0);
+  setDoubleParam(SPiiPlusProfileBuildTime_, epicsTimeDiffInSeconds(&buildEnd, &buildStart));
   buildStatus = (buildOK) ? PROFILE_STATUS_SUCCESS : PROFILE_STATUS_FAILURE;
   setIntegerParam(profileBuildStatus_, buildStatus);
   setStringParam(profileBuildMessage_, message);
@@ -2085,18 +3295,307 @@ asynStatus SPiiPlusController::buildProfile()
   return asynSuccess;
 }
 
-int SPiiPlusController::getNumAccelSegments(double time)
+/*
+ * Write the rows of the profile arena into the global matrix of the slot with a single binary
+ * write and create the feeder program, which passes the points to PATH as the point buffer
+ * empties, so executing the profile only requires polling.  Column 0 of the matrix is the
+ * time (s) and columns 1 to the number of axes are the positions:
+ *
+ *   EPICS_PROFILE:
+ *   GLOBAL INT EPICS_PROFILE_LOADED
+ *   GLOBAL INT EPICS_PROFILE_SLOT
+ *   GLOBAL INT EPICS_PROFILE_SIZE
+ *   PATH/tw (0,1)
+ *   WHILE EPICS_PROFILE_LOADED < EPICS_PROFILE_SIZE
+ *     TILL GSFREE(0) > 0
+ *     BLOCK
+ *       IF EPICS_PROFILE_SLOT = 0
+ *         POINT (0,1), EPICS_PROFILE_DATA0(EPICS_PROFILE_LOADED)(1), EPICS_PROFILE_DATA0(EPICS_PROFILE_LOADED)(2), FLOOR(EPICS_PROFILE_DATA0(EPICS_PROFILE_LOADED)(0)*1000+0.5)
+ *       END
+ *       IF EPICS_PROFILE_SLOT = 1
+ *         POINT (0,1), EPICS_PROFILE_DATA1(EPICS_PROFILE_LOADED)(1), EPICS_PROFILE_DATA1(EPICS_PROFILE_LOADED)(2), FLOOR(EPICS_PROFILE_DATA1(EPICS_PROFILE_LOADED)(0)*1000+0.5)
+ *       END
+ *       EPICS_PROFILE_LOADED=EPICS_PROFILE_LOADED+1
+ *     END
+ *   END
+ *   ENDS (0,1)
+ *   STOP
+ *
+ * runProfile sets the slot and the size, so the program only depends on the axes and the move
+ * mode, and the profiles of a raster, which alternate between the slots, share it.  The buffer
+ * may be running the program of the other slot, so the program is kept in the slot and
+ * runProfile loads it if it differs from the one in the buffer.
+ */
+asynStatus SPiiPlusController::uploadProfile(SPiiPlusProfileSlot *slot, char *message)
+{
+  std::vector <std::string>& program = slot->feederProgram;
+  std::stringstream line;
+  std::stringstream cmd;
+  asynStatus status;
+  int maxSize, maxCols;
+  int moveMode;
+  const char *globals[] = {SPIIPLUS_PROFILE_LOADED_VAR, SPIIPLUS_PROFILE_SLOT_VAR, SPIIPLUS_PROFILE_SIZE_VAR};
+  unsigned int i, j;
+  //static const char *functionName = "uploadProfile";
+  
+  if (profileBuffer_ < 0)
+  {
+    strcpy(message, "Upload mode requires a buffer (SPiiPlusConfigProfileBuffer)");
+    return asynError;
+  }
+  
+  getIntegerParam(profileMoveMode_, &moveMode);
+  
+  /*
+   * The feeder program names the matrix of every slot, so they are all declared before it is
+   * loaded.  They are declared with the largest profile size and a row long enough for every
+   * axis, so they are only redeclared after configProfileBuffer or initializeProfile, and the
+   * feeder program that names them is unloaded first.
+   */
+  maxSize = maxProfilePoints_ + (2*MAX_ACCEL_SEGMENTS) - 1;
+  maxCols = 1 + 2*numAxes_;
+  
+  for (i=0; i<SPIIPLUS_PROFILE_SLOTS; i++)
+  {
+    if (profileSlots_[i].uploadCols == maxCols)
+      continue;
+    
+    if (!loadedFeeder_.empty())
+    {
+      if (execSlot_ >= 0)
+      {
+        sprintf(message, "Unable to redeclare %s while a profile is executed", profileSlots_[i].dataVar);
+        return asynError;
+      }
+      cmd << "#" << profileBuffer_ << "D";
+      pComm_->writeReadAck(cmd);
+      loadedFeeder_.clear();
+    }
+    
+    cmd << "#VGV " << profileSlots_[i].dataVar;
+    pComm_->writeReadAck(cmd);
+    
+    cmd << "GLOBAL REAL " << profileSlots_[i].dataVar << "(" << maxSize << ")(" << maxCols << ")";
+    status = pComm_->writeReadAck(cmd);
+    if (status)
+    {
+      profileSlots_[i].uploadCols = 0;
+      sprintf(message, "Error creating %s, status=%d", profileSlots_[i].dataVar, status);
+      return status;
+    }
+    profileSlots_[i].uploadCols = maxCols;
+  }
+  
+  // The rows are contiguous in the arena, so they are written without copying
+  unlock();
+  status = pComm_->putDoubleArray(profileArena_, slot->dataVar, 0, fullProfileSize_-1, 0, profileArenaStride_-1, false);
+  lock();
+  if (status)
+  {
+    sprintf(message, "Error writing %s, status=%d", slot->dataVar, status);
+    return status;
+  }
+  
+  // runProfile sets these before it starts the program
+  program.clear();
+  program.push_back(SPIIPLUS_PROFILE_LABEL ":");
+  for (i=0; i<sizeof(globals)/sizeof(globals[0]); i++)
+  {
+    cmd << "GLOBAL INT " << globals[i];
+    status = pComm_->writeReadAck(cmd);
+    if (status)
+    {
+      sprintf(message, "Error creating %s, status=%d", globals[i], status);
+      return status;
+    }
+    program.push_back(std::string("GLOBAL INT ") + globals[i]);
+  }
+  
+  line.str("");
+  line << ((moveMode == PROFILE_MOVE_MODE_ABSOLUTE) ? "PATH/tw " : "PATH/twr ") << axesToString(profileAxes_);
+  program.push_back(line.str());
+  program.push_back("WHILE " SPIIPLUS_PROFILE_LOADED_VAR " < " SPIIPLUS_PROFILE_SIZE_VAR);
+  line.str("");
+  line << "TILL GSFREE(" << profileAxes_[0] << ") > 0";
+  program.push_back(line.str());
+  program.push_back("BLOCK");
+  for (i=0; i<SPIIPLUS_PROFILE_SLOTS; i++)
+  {
+    const char *dataVar = profileSlots_[i].dataVar;
+    
+    line.str("");
+    line << "IF " << SPIIPLUS_PROFILE_SLOT_VAR << " = " << i;
+    program.push_back(line.str());
+    line.str("");
+    line << "POINT " << axesToString(profileAxes_);
+    for (j=0; j<profileAxes_.size(); j++)
+    {
+      line << ", " << dataVar << "(" << SPIIPLUS_PROFILE_LOADED_VAR << ")(" << (j+1) << ")";
+    }
+    // POINT takes the segment time in ms, rounded like the other execution modes round it (times are positive)
+    line << ", FLOOR(" << dataVar << "(" << SPIIPLUS_PROFILE_LOADED_VAR << ")(0)*1000+0.5)";
+    program.push_back(line.str());
+    program.push_back("END");
+  }
+  program.push_back(SPIIPLUS_PROFILE_LOADED_VAR "=" SPIIPLUS_PROFILE_LOADED_VAR "+1");
+  program.push_back("END");
+  program.push_back("END");
+  line.str("");
+  line << "ENDS " << axesToString(profileAxes_);
+  program.push_back(line.str());
+  program.push_back("STOP");
+  
+  return asynSuccess;
+}
+
+/*
+ * Move the products of a successful build into its slot, which runProfile executes.  The
+ * profile axes keep the start and flyback positions of the build, so they are copied into the
+ * slot in the order of its axes.  The slot takes the point stream, which buildPointStream
+ * recreates for the next build.
+ */
+void SPiiPlusController::publishProfile(SPiiPlusProfileSlot *slot)
+{
+  unsigned int j;
+  
+  slot->axes = profileAxes_;
+  slot->stride = profileArenaStride_;
+  slot->size = fullProfileSize_;
+  slot->numAccelSegments = numAccelSegments_;
+  slot->numDecelSegments = numDecelSegments_;
+  slot->startPos.resize(profileAxes_.size());
+  slot->flybackPos.resize(profileAxes_.size());
+  for (j=0; j<profileAxes_.size(); j++)
+  {
+    slot->startPos[j] = pAxes_[profileAxes_[j]]->profileStartPos_;
+    slot->flybackPos[j] = pAxes_[profileAxes_[j]]->profileFlybackPos_;
+  }
+  slot->pulseStartPos = pulseStartPos_;
+  slot->pulseEndPos = pulseEndPos_;
+  slot->pulseSpacing = pulseSpacing_;
+  slot->dataCollectionInterval = dataCollectionInterval_;
+  slot->segmentMode = profileSegmentMode_;
+  
+  slot->pointStream.swap(pointStream_);
+  slot->pointStreamOffsets.swap(pointStreamOffsets_);
+  std::vector <char>().swap(pointStream_);
+  pointStreamOffsets_.clear();
+}
+
+/*
+ * Whether a profile can follow another one in the same PATH motion.  The feeder program of
+ * the upload mode ends the motion, and the pulse output is only rearmed between the
+ * profiles, so they need the same axes, modes and pulse axis.
+ */
+bool SPiiPlusController::canChainProfile(const SPiiPlusProfileSlot *from, const SPiiPlusProfileSlot *to)
+{
+  return (from->execMode != SPIIPLUS_PROFILE_EXEC_UPLOAD) && (to->execMode == from->execMode) &&
+         (to->axes == from->axes) && (to->moveMode == from->moveMode) && (to->segmentMode == from->segmentMode) &&
+         (to->pulseMode == from->pulseMode) && (to->pulseAxis == from->pulseAxis);
+}
+
+// Fraction of a rest-to-rest transition covered at fraction s of its time
+static double transitionFraction(double s)
+{
+  return s * s * (3.0 - 2.0 * s);
+}
+
+/*
+ * Format the POINT commands that take the profile axes from the end of one profile to the
+ * start of the next profile of a chain into transitionStream_.  Both ends are at rest, so
+ * each axis follows d*(3s^2 - 2s^3), whose peak velocity is 1.5*d/T and peak acceleration
+ * is 6*d/T^2, and the duration T keeps both within 90% of XVEL and XACC.  Returns the number
+ * of points, which is 0 if the next profile starts where the first one ends.
+ */
+int SPiiPlusController::buildTransition(const SPiiPlusProfileSlot *from, const SPiiPlusProfileSlot *to)
+{
+  char numStr[40];
+  std::string header;
+  std::vector <double> distance(to->axes.size());
+  double duration = 0.0;
+  double s, prev;
+  double value;
+  long segmentMs;
+  int numSegments;
+  int ptIdx;
+  int len;
+  unsigned int j;
+  
+  transitionStream_.clear();
+  transitionOffsets_.clear();
+  
+  for (j=0; j<to->axes.size(); j++)
+  {
+    // A relative profile starts from the flyback position of the previous one, as it would without the chain
+    if (to->moveMode == PROFILE_MOVE_MODE_ABSOLUTE)
+      distance[j] = to->startPos[j] - from->position(j, from->size-1);
+    else
+      distance[j] = from->flybackPos[j] + to->startPos[j];
+    
+    if (maxAcceleration_[to->axes[j]] > 0.0)
+      duration = MAX(duration, sqrt(6.0 * fabs(distance[j]) / (0.9 * maxAcceleration_[to->axes[j]])));
+    if (maxVelocity_[to->axes[j]] > 0.0)
+      duration = MAX(duration, 1.5 * fabs(distance[j]) / (0.9 * maxVelocity_[to->axes[j]]));
+  }
+  if (duration <= 0.0)
+    return 0;
+  
+  // The segments are at least as long as the ramp segments of the profiles; POINT takes whole ms
+  numSegments = (int)ceil(duration / profileRampPeriod_);
+  numSegments = MAX(2, MIN(SPIIPLUS_MAX_TRANSITION_SEGMENTS, numSegments));
+  segmentMs = (long)ceil(duration * 1000.0 / numSegments);
+  duration = segmentMs * numSegments / 1000.0;
+  
+  header = "POINT " + axesToString(to->axes);
+  transitionOffsets_.reserve(numSegments+1);
+  
+  for (ptIdx=1; ptIdx<=numSegments; ptIdx++)
+  {
+    s = (double)ptIdx / numSegments;
+    prev = (double)(ptIdx-1) / numSegments;
+    
+    transitionOffsets_.push_back(transitionStream_.size());
+    transitionStream_.insert(transitionStream_.end(), header.begin(), header.end());
+    for (j=0; j<to->axes.size(); j++)
+    {
+      // Relative points are the displacement of the segment
+      if (to->moveMode == PROFILE_MOVE_MODE_ABSOLUTE)
+        value = from->position(j, from->size-1) + distance[j] * transitionFraction(s);
+      else
+        value = distance[j] * (transitionFraction(s) - transitionFraction(prev));
+      len = sprintf(numStr, (j == 0) ? ", %g" : ",%g", value);
+      transitionStream_.insert(transitionStream_.end(), numStr, numStr+len);
+    }
+    // PVSPLINE points also have the velocity at the end of the segment
+    for (j=0; (to->segmentMode == SPIIPLUS_PROFILE_SEGMENT_SPLINE) && (j<to->axes.size()); j++)
+    {
+      len = sprintf(numStr, ",%g", distance[j] * 6.0 * s * (1.0 - s) / duration);
+      transitionStream_.insert(transitionStream_.end(), numStr, numStr+len);
+    }
+    len = sprintf(numStr, ", %ld\r", segmentMs);
+    transitionStream_.insert(transitionStream_.end(), numStr, numStr+len);
+  }
+  transitionOffsets_.push_back(transitionStream_.size());
+  
+  return numSegments;
+}
+
+int SPiiPlusController::getNumAccelSegments(double time, double rampPeriod)
 {
   long numSegments;
-  // The following value was chosen somewhat arbitrarily -- it gives MAX_ACCEL_SEGMENTS at an acceleration time of 0.2s
-  double minPeriod = 0.01;
   
-  numSegments = lround(time / minPeriod);
+  // rampPeriod is the larger of the ramp period parameter and the minimum segment time of the controller
+  numSegments = lround(time / rampPeriod);
   
   if (numSegments > MAX_ACCEL_SEGMENTS)
   {
     numSegments = MAX_ACCEL_SEGMENTS;
   }
+  // A ramp shorter than half a period still needs a segment
+  if ((numSegments < 1) && (time > 0.0))
+  {
+    numSegments = 1;
+  }
   
   return numSegments;
 }
@@ -2106,6 +3605,9 @@ void SPiiPlusController::createAccDecTimes(double preTimeMax, double postTimeMax
   int i;
   //static const char *functionName = "createAccDecTimes";
   
+  profileAccelTimes_.resize(numAccelSegments_);
+  profileDecelTimes_.resize(numDecelSegments_);
+  
   // Use a constant time for accel/decel segments
   for (i=0; i<numAccelSegments_; i++)
   {
@@ -2117,30 +3619,57 @@ void SPiiPlusController::createAccDecTimes(double preTimeMax, double postTimeMax
   }
 }
 
-void SPiiPlusController::createAccDecPositions(SPiiPlusAxis* axis, int moveMode, int numPoints, double preTimeMax, double postTimeMax, double preVelocity, double postVelocity)
+/*
+ * Fraction of v*T travelled after the normalized time (0 to 1) of a ramp of duration T
+ * between rest and the velocity v.  Linear ramps have a constant acceleration.  S-curve
+ * ramps follow the velocity v*(3t^2-2t^3), which starts and ends with zero acceleration,
+ * so the jerk is finite and the peak acceleration is SPIIPLUS_SCURVE_PEAK_ACCEL times
+ * that of a linear ramp.  Both cover 0.5*v*T.
+ */
+double SPiiPlusController::rampDistance(double fraction, bool decel, int rampMode)
+{
+  if (rampMode == SPIIPLUS_PROFILE_RAMP_SCURVE)
+  {
+    if (decel)
+      return fraction - pow(fraction, 3) + 0.5 * pow(fraction, 4);
+    else
+      return pow(fraction, 3) - 0.5 * pow(fraction, 4);
+  }
+  else
+  {
+    if (decel)
+      return fraction - 0.5 * pow(fraction, 2);
+    else
+      return 0.5 * pow(fraction, 2);
+  }
+}
+
+void SPiiPlusController::createAccDecPositions(SPiiPlusAxis* axis, int moveMode, int numPoints, double preTimeMax, double postTimeMax, double preVelocity, double postVelocity, int rampMode)
 {
   int i;
-  double time;
-  double time2;
-  double time1;
+  double fraction2;
+  double fraction1;
   //static const char *functionName = "createAccDecPositions";
   
+  axis->profileAccelPositions_.resize(numAccelSegments_);
+  axis->profileDecelPositions_.resize(numDecelSegments_);
+  
   if (moveMode == PROFILE_MOVE_MODE_ABSOLUTE)
   {
     // Acceleration (absolute)
     for (i=0; i<numAccelSegments_; i++)
     {
-      time = preTimeMax * (i+1) / numAccelSegments_;
+      fraction2 = (double)(i+1) / numAccelSegments_;
       // position during accel period = starting position of user profile - acceleration distance + distance traveled in i acceleration segments
-      axis->profileAccelPositions_[i] = axis->profilePositions_[0] - axis->profilePreDistance_ + 0.5 * (preVelocity / preTimeMax) * pow(time, 2);
+      axis->profileAccelPositions_[i] = axis->profilePositions_[0] - axis->profilePreDistance_ + preVelocity * preTimeMax * rampDistance(fraction2, false, rampMode);
     }
     
     // Deceleration (absolute)
     for (i=0; i<numDecelSegments_; i++)
     {
-      time = postTimeMax * (i+1) / numDecelSegments_;
+      fraction2 = (double)(i+1) / numDecelSegments_;
       // position during decel period = ending position of user profile + distance traveled in i deceleration segments
-      axis->profileDecelPositions_[i] = axis->profilePositions_[numPoints-1] + postVelocity * time - 0.5 * (postVelocity / postTimeMax) * pow(time, 2);
+      axis->profileDecelPositions_[i] = axis->profilePositions_[numPoints-1] + postVelocity * postTimeMax * rampDistance(fraction2, true, rampMode);
     }
   }
   else
@@ -2148,21 +3677,173 @@ void SPiiPlusController::createAccDecPositions(SPiiPlusAxis* axis, int moveMode,
     // Acceleration (relative)
     for (i=0; i<numAccelSegments_; i++)
     {
-      // position during accel period = 0.5 * a * (t2^2 - t1^2)
-      time2 = preTimeMax*(i+1)/numAccelSegments_;
-      time1 = preTimeMax*i/numAccelSegments_;
-      axis->profileAccelPositions_[i] = 0.5 * (preVelocity / preTimeMax) * (pow(time2, 2) - pow(time1, 2));
+      // position during accel period = distance at t2 - distance at t1
+      fraction2 = (double)(i+1) / numAccelSegments_;
+      fraction1 = (double)i / numAccelSegments_;
+      axis->profileAccelPositions_[i] = preVelocity * preTimeMax * (rampDistance(fraction2, false, rampMode) - rampDistance(fraction1, false, rampMode));
     }
     
     // Deceleration (relative)
     for (i=0; i<numDecelSegments_; i++)
     {
-      // position during decel period = vf * (t2 - t1) - 0.5 * a * (t2^2 - t1^2)
-      time2 = postTimeMax*(i+1)/numDecelSegments_;
-      time1 = postTimeMax*i/numDecelSegments_;
-      axis->profileDecelPositions_[i] = postVelocity * (time2 - time1) - 0.5 * (postVelocity / postTimeMax) * (pow(time2, 2) - pow(time1, 2));
+      fraction2 = (double)(i+1) / numDecelSegments_;
+      fraction1 = (double)i / numDecelSegments_;
+      axis->profileDecelPositions_[i] = postVelocity * postTimeMax * (rampDistance(fraction2, true, rampMode) - rampDistance(fraction1, true, rampMode));
+    }
+  }
+}
+
+/*
+ * Check the full profile of every profile axis against XVEL, XACC and the soft limits of
+ * the motor record.  The positions are first converted to absolute positions, starting at
+ * the start position, so the same sweep works for absolute and relative profiles.  Each
+ * point k is the end of segment k-1 (point 0 is the start position); the acceleration at
+ * a point is the change of the average velocities of the adjacent segments over the time
+ * between their midpoints, and the profile starts and ends at rest.  The arrays are
+ * contiguous and padded at both ends so the loops that fill them have no branches.
+ * Returns false and describes the first violating point (and the lowest axis at that
+ * point) in message.
+ */
+bool SPiiPlusController::validateProfile(int moveMode, int numPoints, int segmentMode, char *message)
+{
+  int i, n, violation;
+  int firstPoint, firstAxis, firstViolation;
+  unsigned int j;
+  int idx;
+  double lowLimit, highLimit;
+  double firstValue = 0.0, firstLimit = 0.0;
+  bool checkLimits;
+  double *t, *p, *v, *a;
+  SPiiPlusAxis *axis;
+  char where[MAX_MESSAGE_LEN];
+  static const char *violationNames[] = {"", "the low soft limit", "the high soft limit", "XVEL", "XACC"};
+  static const char *functionName = "validateProfile";
+  
+  n = fullProfileSize_;
+  // Segment times with a zero-length segment at rest before and after the profile
+  checkTimes_.assign(n+2, 0.0);
+  checkPositions_.resize(n+1);
+  checkVelocities_.resize(n+2);
+  checkAccelerations_.resize(n+1);
+  t = &checkTimes_[0];
+  p = &checkPositions_[0];
+  v = &checkVelocities_[0];
+  a = &checkAccelerations_[0];
+  for (i=0; i<n; i++)
+  {
+    t[i+1] = fullProfileTimes_[i];
+  }
+  
+  firstPoint = n+1;
+  firstAxis = -1;
+  firstViolation = 0;
+  
+  for (j=0; j<profileAxes_.size(); j++)
+  {
+    idx = profileAxes_[j];
+    axis = pAxes_[idx];
+    
+    if (moveMode == PROFILE_MOVE_MODE_ABSOLUTE)
+    {
+      p[0] = axis->profileStartPos_;
+      for (i=0; i<n; i++)
+      {
+        p[i+1] = axis->fullProfilePositions_[i];
+      }
+    }
+    else
+    {
+      // Relative profiles start from where the axis is when they are executed
+      p[0] = profileOrigin(idx) + axis->profileStartPos_;
+      for (i=0; i<n; i++)
+      {
+        p[i+1] = p[i] + axis->fullProfilePositions_[i];
+      }
+    }
+    
+    v[0] = 0.0;
+    v[n+1] = 0.0;
+    for (i=1; i<=n; i++)
+    {
+      v[i] = (p[i] - p[i-1]) / t[i];
+    }
+    for (i=0; i<=n; i++)
+    {
+      a[i] = (v[i+1] - v[i]) / (0.5 * (t[i] + t[i+1]));
+    }
+    
+    // The motor record disables the soft limits when they are equal; they are in steps
+    checkLimits = (getDoubleParam(idx, motorLowLimit_, &lowLimit) == asynSuccess) &&
+                  (getDoubleParam(idx, motorHighLimit_, &highLimit) == asynSuccess) &&
+                  (lowLimit != highLimit);
+    lowLimit *= axis->resolution_;
+    highLimit *= axis->resolution_;
+    if (lowLimit > highLimit)
+    {
+      std::swap(lowLimit, highLimit);
+    }
+    
+    // Only points before the first violation found so far need to be scanned
+    for (i=0; i<=n && i<firstPoint; i++)
+    {
+      violation = 0;
+      if (checkLimits && (p[i] < lowLimit))
+      {
+        violation = 1;
+        firstValue = p[i];
+        firstLimit = lowLimit;
+      }
+      else if (checkLimits && (p[i] > highLimit))
+      {
+        violation = 2;
+        firstValue = p[i];
+        firstLimit = highLimit;
+      }
+      else if ((maxVelocity_[idx] > 0.0) && (fabs(v[i]) > maxVelocity_[idx]))
+      {
+        violation = 3;
+        firstValue = fabs(v[i]);
+        firstLimit = maxVelocity_[idx];
+      }
+      else if ((segmentMode == SPIIPLUS_PROFILE_SEGMENT_SPLINE) && (i > 0) && (maxVelocity_[idx] > 0.0) && (fabs(axis->fullProfileVelocities_[i-1]) > maxVelocity_[idx]))
+      {
+        violation = 3;
+        firstValue = fabs(axis->fullProfileVelocities_[i-1]);
+        firstLimit = maxVelocity_[idx];
+      }
+      else if (fabs(a[i]) > maxAcceleration_[idx])
+      {
+        violation = 4;
+        firstValue = fabs(a[i]);
+        firstLimit = maxAcceleration_[idx];
+      }
+      
+      if (violation)
+      {
+        firstPoint = i;
+        firstAxis = idx;
+        firstViolation = violation;
+        break;
+      }
     }
   }
+  
+  if (firstAxis < 0)
+    return true;
+  
+  // Point numAccelSegments_ of the full profile is the first user-specified point
+  i = firstPoint - numAccelSegments_;
+  if (i < 0)
+    strcpy(where, "in the acceleration ramp");
+  else if (i > numPoints-1)
+    strcpy(where, "in the deceleration ramp");
+  else
+    sprintf(where, "at point %d", i);
+  
+  sprintf(message, "Axis %d exceeds %s %s (%g vs %g)", firstAxis, violationNames[firstViolation], where, firstValue, firstLimit);
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, message);
+  
+  return false;
 }
 
 void SPiiPlusController::assembleFullProfile(int numPoints)
@@ -2204,12 +3885,70 @@ void SPiiPlusController::assembleFullProfile(int numPoints)
     fullProfileTimes_[profileIdx] = profileDecelTimes_[i];
     for (j=0; j<profileAxes_.size(); j++)
     {
-      pAxes_[profileAxes_[j]]->fullProfilePositions_[profileIdx] = pAxes_[profileAxes_[j]]->profileDecelPositions_[i];
+      pAxes_[profileAxes_[j]]->fullProfilePositions_[profileIdx] = pAxes_[profileAxes_[j]]->profileDecelPositions_[i];
+    }
+    profileIdx++;
+  }
+  // fullProfileSize_ == profileIdx at this point
+  fullProfileSize_ = numAccelSegments_ + (numPoints-1) + numDecelSegments_;
+}
+
+/*
+ * Calculate the velocity of each axis at the end of each segment of the full profile, for
+ * PVSPLINE motion.  Between two segments of the user-specified profile the velocity is the
+ * average of their velocities, weighted by the duration of the other segment.  The ramps
+ * end and start at the velocity of the first and last segments, and the profile ends at rest.
+ */
+void SPiiPlusController::calculateSplineVelocities(int moveMode)
+{
+  int i;
+  unsigned int j;
+  double prevPos;
+  double segVel, nextSegVel;
+  SPiiPlusAxis *axis;
+  //static const char *functionName = "calculateSplineVelocities";
+  
+  for (j=0; j<profileAxes_.size(); j++)
+  {
+    axis = pAxes_[profileAxes_[j]];
+    prevPos = (moveMode == PROFILE_MOVE_MODE_ABSOLUTE) ? axis->profileStartPos_ : 0.0;
+    
+    for (i=0; i<fullProfileSize_; i++)
+    {
+      if (i == (fullProfileSize_-1))
+      {
+        axis->fullProfileVelocities_[i] = 0.0;
+        break;
+      }
+      
+      // Relative profiles contain the displacement of each segment
+      if (moveMode == PROFILE_MOVE_MODE_ABSOLUTE)
+      {
+        segVel = (axis->fullProfilePositions_[i] - prevPos) / fullProfileTimes_[i];
+        nextSegVel = (axis->fullProfilePositions_[i+1] - axis->fullProfilePositions_[i]) / fullProfileTimes_[i+1];
+      }
+      else
+      {
+        segVel = axis->fullProfilePositions_[i] / fullProfileTimes_[i];
+        nextSegVel = axis->fullProfilePositions_[i+1] / fullProfileTimes_[i+1];
+      }
+      
+      if (i == (numAccelSegments_-1))
+      {
+        axis->fullProfileVelocities_[i] = nextSegVel;
+      }
+      else if (i == (fullProfileSize_-numDecelSegments_-1))
+      {
+        axis->fullProfileVelocities_[i] = segVel;
+      }
+      else
+      {
+        axis->fullProfileVelocities_[i] = (segVel * fullProfileTimes_[i+1] + nextSegVel * fullProfileTimes_[i]) / (fullProfileTimes_[i] + fullProfileTimes_[i+1]);
+      }
+      
+      prevPos = axis->fullProfilePositions_[i];
     }
-    profileIdx++;
   }
-  // fullProfileSize_ == profileIdx at this point
-  fullProfileSize_ = numAccelSegments_ + (numPoints-1) + numDecelSegments_;
 }
 
 void SPiiPlusController::sanityCheckProfile()
@@ -2346,41 +4085,117 @@ asynStatus SPiiPlusController::runProfile()
   std::stringstream positionStr;
   std::stringstream commandStr;
   std::stringstream cmd;
-  SPiiPlusAxis *pAxis;
   int ptExecIdx;
   int ptLoadedIdx;
   int ptFree;
-  int ptIdx;
-  std::string posData;
+  int numToLoad;
+  double refillPeriod;
+  int underruns=0;
+  int starvations=0;
+  bool starving=false;
+  int execMode;
+  int firstAxis, numInChannel;
+  int readbackMode;
+  int chainLength;
+  int recordLength=1;
+  double recordInterval;
+  int chained=1;
+  int transitionPoints=0;
+  int numTransition;
+  bool pegPending=false;
+  double pulseOrigin=0.0;
+  epicsTimeStamp lastRead;
   static const char *functionName = "runProfile";
   
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: start\n", driverName, functionName);
 
-  if (profileAxes_.size() == 0)
+  /*
+   * Take the slot of the last build.  buildProfile builds the next profile into the other
+   * slot, so the slot doesn't change until the execution is done.
+   */
+  lock();
+  if (nextSlot_ < 0)
   {
-    strcpy(message, "No axes selected");
+    unlock();
+    strcpy(message, "No profile has been built");
+    executeOK = false;
+    goto done;
+  }
+  execSlot_ = nextSlot_;
+  exec_ = &profileSlots_[execSlot_];
+  // profileOrigin gives the next build the positions this profile starts from
+  exec_->origin.resize(exec_->axes.size());
+  for (j=0; j<exec_->axes.size(); j++)
+  {
+    getDoubleParam(exec_->axes[j], motorPosition_, &position);
+    exec_->origin[j] = position * pAxes_[exec_->axes[j]]->resolution_;
+  }
+  unlock();
+  
+  // The parameters the profile was built with, which may have changed for the next build
+  execMode = exec_->execMode;
+  moveMode = exec_->moveMode;
+  startPulses = exec_->startPulses;
+  endPulses = exec_->endPulses;
+  numPoints = exec_->numPoints;
+  numPulses = exec_->numPulses;
+  pulseMode = exec_->pulseMode;
+  pulseAxis = exec_->pulseAxis;
+  
+  if ((execMode == SPIIPLUS_PROFILE_EXEC_UPLOAD) && !exec_->uploaded)
+  {
+    strcpy(message, "The profile wasn't uploaded; build it in upload mode");
+    executeOK = false;
+    goto done;
+  }
+  if ((execMode == SPIIPLUS_PROFILE_EXEC_POINT) && (exec_->pointStreamOffsets.size() != (size_t)(exec_->size+1)))
+  {
+    strcpy(message, "The profile wasn't built in point mode");
+    executeOK = false;
+    goto done;
+  }
+  if ((execMode != SPIIPLUS_PROFILE_EXEC_POINT) && (exec_->segmentMode == SPIIPLUS_PROFILE_SEGMENT_SPLINE))
+  {
+    strcpy(message, "Spline segments require the Point execution mode");
     executeOK = false;
     goto done;
   }
   
-  asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: axisList = %s\n", driverName, functionName, axesToString(profileAxes_).c_str());
+  // A running program can't be replaced, so the feeder program of the slot is loaded now, unless it is already there
+  if ((execMode == SPIIPLUS_PROFILE_EXEC_UPLOAD) && (exec_->feederProgram != loadedFeeder_))
+  {
+    loadedFeeder_.clear();
+    status = pComm_->loadProgram(profileBuffer_, exec_->feederProgram);
+    if (status)
+    {
+      sprintf(message, "Error loading the feeder program into buffer %i", profileBuffer_);
+      executeOK = false;
+      goto done;
+    }
+    loadedFeeder_ = exec_->feederProgram;
+  }
+  
+  asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: slot = %i, axisList = %s\n", driverName, functionName, execSlot_, axesToString(exec_->axes).c_str());
   
   lock();
-  // These are also used by buildProfile
-  getIntegerParam(profileStartPulses_, &startPulses);
-  getIntegerParam(profileEndPulses_,   &endPulses);
-  getIntegerParam(profileNumPoints_,   &numPoints);
-  getIntegerParam(profileNumPulses_,   &numPulses);
-  getIntegerParam(SPiiPlusPulseMode_,  &pulseMode);
-  getIntegerParam(SPiiPlusPulseAxis_,  &pulseAxis);
   // These aren't used by buildProfile
   getStringParam(SPiiPlusPEGEngEncCode_,     pegEngEncCode);
   getStringParam(SPiiPlusPEGOutAssignCode_,  pegOutAssignCode);
   getIntegerParam(SPiiPlusPOUTSOutputIndex_, &outputIndex);
   getStringParam(SPiiPlusPOUTSBitCode_,      poutsBitCode);
   getDoubleParam(SPiiPlusPulseWidth_,        &pulseWidth);
-  
-  sprintf(message, "Selected axes: %s", motorsToString(profileAxes_).c_str()); 
+  // The pulse positions of a relative profile are from the position of the pulse axis now, before the move to the start
+  getDoubleParam(pulseAxis, motorPosition_,  &pulseOrigin);
+  pulseOrigin *= getAxis(pulseAxis)->resolution_;
+  // Executes queued while the profile runs are appended to it, up to chainLength profiles in all
+  getIntegerParam(SPiiPlusProfileChainLength_, &chainLength);
+  if ((chainLength < 1) || (execMode == SPIIPLUS_PROFILE_EXEC_UPLOAD))
+    chainLength = 1;
+  setIntegerParam(SPiiPlusProfileChained_, chained);
+  waitLatency_ = 0.0;
+  setDoubleParam(SPiiPlusProfileWaitLatency_, waitLatency_);
+  
+  sprintf(message, "Selected axes: %s", motorsToString(exec_->axes).c_str()); 
   setStringParam(profileExecuteMessage_, message);
   setIntegerParam(profileExecuteState_, PROFILE_EXECUTE_MOVE_START);
   setIntegerParam(profileExecuteStatus_, PROFILE_STATUS_UNDEFINED);
@@ -2388,11 +4203,12 @@ asynStatus SPiiPlusController::runProfile()
   // Set the readback status to undefined so the user can see that a new read should be done when this move is done executing
   setIntegerParam(profileReadbackStatus_, PROFILE_STATUS_UNDEFINED);
   
+  setIntegerParam(SPiiPlusProfileUnderruns_, underruns);
+  setIntegerParam(SPiiPlusProfileStarvations_, starvations);
+  
   callParamCallbacks();
   unlock();
   
-  getIntegerParam(profileMoveMode_, &moveMode);
-  
   // move motors to the starting position
   if (moveMode == PROFILE_MOVE_MODE_ABSOLUTE)
   {
@@ -2402,13 +4218,11 @@ asynStatus SPiiPlusController::runProfile()
   {
     cmd << "PTP/mr ";
   }
-  for (j=0; j<profileAxes_.size(); j++)
+  for (j=0; j<exec_->axes.size(); j++)
   {
-    pAxis = getAxis(profileAxes_[j]);
-    
-    position = pAxis->profileStartPos_;
+    position = exec_->startPos[j];
     
-    if (profileAxes_[j] == profileAxes_.front())
+    if (exec_->axes[j] == exec_->axes.front())
     {
       positionStr << position;
     }
@@ -2417,7 +4231,7 @@ asynStatus SPiiPlusController::runProfile()
       positionStr << ',' << position;
     }
   }
-  cmd << axesToString(profileAxes_) << ", " << positionStr.str();
+  cmd << axesToString(exec_->axes) << ", " << positionStr.str();
   status = pComm_->writeReadAck(cmd);
   // Should this be done after every command in this method?
   if (status)
@@ -2444,48 +4258,65 @@ asynStatus SPiiPlusController::runProfile()
   unlock();
   
   /* configure data recording, which will start when the GO command is issued */
-  int axesToRecord;
-  if (profileAxes_.size() > 8)
-    axesToRecord = 8;
-  else
-    axesToRecord = profileAxes_.size();
-  for (i=0; i<axesToRecord; i++)
+  /*
+   * The recording covers the profiles that are queued when it starts: this one, and the next
+   * one if it was already executed and can be appended.  The execute stays queued for the
+   * refill loop.  Profiles that are appended later are recorded until the arrays are full.
+   */
+  recordInterval = exec_->dataCollectionInterval;
+  lock();
+  if ((chainLength > 1) && (epicsEventTryWait(profileExecuteEvent_) == epicsEventWaitOK))
+  {
+    epicsEventSignal(profileExecuteEvent_);
+    if ((nextSlot_ >= 0) && (nextSlot_ != execSlot_) && canChainProfile(exec_, &profileSlots_[nextSlot_]))
+    {
+      recordLength = 2;
+      recordInterval += profileSlots_[nextSlot_].dataCollectionInterval;
+    }
+  }
+  unlock();
+  
+  // The profile axes are spread over the channels, so up to SPIIPLUS_MAX_DC_CHANNELS axes get a channel each
+  recordedAxes_ = exec_->axes;
+  dcAxesPerChannel_ = (recordedAxes_.size() + SPIIPLUS_MAX_DC_CHANNELS - 1) / SPIIPLUS_MAX_DC_CHANNELS;
+  for (i=0; i<dcChannels(); i++)
   {
     // Zero the data array
     cmd << "FILL(0,DC_DATA_" << (i+1) << ")";
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, cmd.str().c_str());
     status = pComm_->writeReadAck(cmd);
     
-    // DC/sw DC_DATA_#,maxProfilePoints_,3,FPOS(a),PE(a),TIME
-    if (pAxes_[profileAxes_[i]]->dummy_)
-    {
-      // use the desired position for dummy axes, since FPOS and PE are always zero
-      posData = "APOS";
-    }
-    else if (pAxes_[profileAxes_[i]]->virtual_)
+    // DC/sw a,DC_DATA_#,maxProfilePoints_,period,FPOS(a),PE(a),FPOS(b),PE(b),...
+    // The collection is synchronized to the first axis of the channel; all of the profile axes start together
+    numInChannel = dcChannelAxes(i, &firstAxis);
+    cmd << "DC/sw " << exec_->axes[firstAxis] << ",DC_DATA_" << (i+1) << "," << maxProfilePoints_ << ",";
+    // The period spreads the samples over the durations of the recorded profiles
+    cmd << lround(recordInterval * 1000.0);
+    for (j=firstAxis; (int)j<firstAxis+numInChannel; j++)
     {
-      if (virtualFeedbackPositionSupported_)
-      {
-        // use the virtual feedback position for virtual axes
-        posData = "VPOS";
-      }
-      else
-      {
-        // use the desired position for virtual axes when virtual feedback positions are not supported
-        posData = "APOS";
-      }
-    }
-    else
-    {
-      // use the feedback position for real motors
-      posData = "FPOS";
+      cmd << "," << dcPositionSource(exec_->axes[j]) << "(" << exec_->axes[j] << "),PE(" << exec_->axes[j] << ")";
     }
-    cmd << "DC/sw " << profileAxes_[i] << ",DC_DATA_" << (i+1) << "," << maxProfilePoints_ << ",";
-    cmd << lround(dataCollectionInterval_ * 1000.0) << "," << posData << "(" << profileAxes_[i] << "),PE(" << profileAxes_[i] << "),TIME";
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, cmd.str().c_str());
     status = pComm_->writeReadAck(cmd);
   }
   
+  // In the incremental readback mode the samples are read while the profile is executed
+  getIntegerParam(SPiiPlusProfileReadbackMode_, &readbackMode);
+  readbackIncremental_ = (readbackMode == SPIIPLUS_PROFILE_READBACK_INCREMENTAL);
+  readbackCount_ = 0;
+  if (readbackIncremental_)
+  {
+    for (i=0; i<numAxes_; i++) {
+      memset(pAxes_[i]->profileReadbacks_,       0, maxProfilePoints_*sizeof(double));
+      memset(pAxes_[i]->profileFollowingErrors_, 0, maxProfilePoints_*sizeof(double));
+    }
+    lock();
+    setIntegerParam(profileNumReadbacks_, 0);
+    callParamCallbacks();
+    unlock();
+  }
+  epicsTimeGetCurrent(&lastRead);
+  
   /*
    *  There is a bug in the controller firmware that prevents synchronized data 
    * collection from starting when a the GO is issued for the PTP/tw move.  If 
@@ -2495,7 +4326,7 @@ asynStatus SPiiPlusController::runProfile()
    * the PTP/tw command, but that isn't implemented.
    */
   // Ugly hack: A GO is needed here to start data collection.
-  cmd << "GO " << axesToString(profileAxes_);
+  cmd << "GO " << axesToString(exec_->axes);
   status = pComm_->writeReadAck(cmd);
   
   // Configure pulse output (does this need to happen before data recording is setup/started?)
@@ -2538,63 +4369,27 @@ asynStatus SPiiPlusController::runProfile()
   asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, cmd.str().c_str());
   status = pComm_->writeReadAck(cmd);
   
-  if ((pulseMode == 0) || (pulseMode == 2))
-  {
-    // PEG_I axis, width, first_point, interval, last_point
-    //asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: startPulsePos=%f, endPulsePos=%f, numElements=%i, pulseInterval=%f\n", driverName, functionName, pulseStartPos_, pulseEndPos_, numPulses, pulseSpacing_);
-    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: startPulsePos=%f, endPulsePos=%f, numElements=%i, pulseInterval=%f\n", driverName, functionName, pulseStartPos_, pulseEndPos_, numPulses, pulseSpacing_);
-    cmd << "PEG_I " << pulseAxis << ", " << pulseWidth << ", " << pulseStartPos_ << ", " << pulseSpacing_ << ", " << pulseEndPos_;
-    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, cmd.str().c_str());
-    status = pComm_->writeReadAck(cmd);
-    // Should a failed PEG_I command cause the scan to fail?  Yes, for now.
-    if (status)
-    {
-      executeOK = false;
-      strcpy(message, "Aborting due to PEG_I error");
-      goto done;
-    }
-  }
-  else if (pulseMode == 1)
-  {
-    // PEG_R peg_engine width mode first_index last_index POS_ARRAY
-    
-    // TODO: is 0x4444 the correct mode? Is pulseAxis the correct peg_engine argument?
-    // NOTE: ASSIGNPEG's /f switch is also required
-    cmd << "PEG_R/d " << pulseAxis << ", " << pulseWidth << ", " << "0x4444" << ", " << "0" << ", " << (numPulses-1) << ", " << "pulsePos";
-    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, cmd.str().c_str());
-    status = pComm_->writeReadAck(cmd);
-    // Should a failed PEG_R command cause the scan to fail?  Yes, for now.
-    if (status)
-    {
-      executeOK = false;
-      strcpy(message, "Aborting due to PEG_R error");
-      goto done;
-    }
-  }
-  else if (pulseMode == 3)
+  status = armPEG(exec_, pulseWidth, pulseOrigin);
+  // Should a failed PEG_I or PEG_R command cause the scan to fail?  Yes, for now.
+  if (status)
   {
-    // What should happen here?
+    executeOK = false;
+    strcpy(message, (pulseMode == 1) ? "Aborting due to PEG_R error" : "Aborting due to PEG_I error");
+    goto done;
   }
   
   if (pulseMode != 3)
   {
     // Wait for PEGREADY 
-    while (pAxes_[pulseAxis]->pegReady_ == 0)
+    wakeupPoller();
+    if (!waitAxisState(pulseAxis))
     {
-      //asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: axisStatus(%i).#PEGREAD = %i\n", driverName, functionName, pulseAxis, pAxes_[pulseAxis]->pegReady_);
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: axisStatus(%i).#PEGREAD = %i\n", driverName, functionName, pulseAxis, pAxes_[pulseAxis]->pegReady_);
-      // Sleep to give the poller time to reread the the axis status
-      epicsThreadSleep(0.1);
-      
-      if (halted_)
-      {
-        aborted = true;
-        executeOK = false;
-        status = stopDataCollection();
-        status = stopPEG(pulseAxis);
-        strcpy(message, "Aborted during wait for PEGREADY");
-        goto done;
-      }
+      aborted = true;
+      executeOK = false;
+      status = stopDataCollection();
+      status = stopPEG(pulseAxis);
+      strcpy(message, "Aborted during wait for PEGREADY");
+      goto done;
     }
   }
   
@@ -2612,43 +4407,58 @@ asynStatus SPiiPlusController::runProfile()
   callParamCallbacks();
   unlock();
   
-  // Send the command to start the coordinated motion, but wait for the GO command to move motors
-  if (moveMode == PROFILE_MOVE_MODE_ABSOLUTE)
-  {
-    cmd << "PATH/tw ";
-  }
-  else
-  {
-    cmd << "PATH/twr ";
-  }
-  cmd << axesToString(profileAxes_);
-  //asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, cmd.str().c_str());
-  status = pComm_->writeReadAck(cmd);
-  
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: point buffer fill start\n", driverName, functionName);
-  
-  // Fill the point buffer, which can only hold 50 points
-  for (ptIdx = 0; ptIdx < MIN(50, fullProfileSize_); ptIdx++)
+  if (execMode == SPIIPLUS_PROFILE_EXEC_UPLOAD)
   {
-    // Create and send the point command (should this be ptIdx+1?)
-    cmd << "POINT " << axesToString(profileAxes_) << ", " << positionsToString(ptIdx) << ", " << lround(fullProfileTimes_[ptIdx] * 1000.0);
-    //asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, cmd.str().c_str());
+    // The feeder program starts the PATH motion and passes the uploaded points of the slot to it
+    cmd << SPIIPLUS_PROFILE_LOADED_VAR << "=0";
     status = pComm_->writeReadAck(cmd);
+    cmd << SPIIPLUS_PROFILE_SLOT_VAR << "=" << exec_->index;
+    if (status == asynSuccess) status = pComm_->writeReadAck(cmd);
+    cmd << SPIIPLUS_PROFILE_SIZE_VAR << "=" << exec_->size;
+    if (status == asynSuccess) status = pComm_->writeReadAck(cmd);
+    cmd << "START " << profileBuffer_ << "," << SPIIPLUS_PROFILE_LABEL;
+    if (status == asynSuccess) status = pComm_->writeReadAck(cmd);
+    if (status)
+    {
+      executeOK = false;
+      status = stopDataCollection();
+      status = stopPEG(pulseAxis);
+      strcpy(message, "Unable to start the feeder program");
+      goto done;
+    }
+    
+    // Wait for the point buffer to be filled before starting the motion
+    while (ptLoadedIdx < MIN(pathBufferSize_, exec_->size))
+    {
+      if (halted_)
+      {
+        aborted = true;
+        executeOK = false;
+        status = stopDataCollection();
+        status = stopPEG(pulseAxis);
+        strcpy(message, "Aborted during profile move");
+        goto done;
+      }
+      
+      epicsThreadSleep(0.01);
+      
+      cmd << "?" << SPIIPLUS_PROFILE_LOADED_VAR;
+      status = pComm_->writeReadInt(cmd, &ptLoadedIdx);
+      if (status)
+      {
+        executeOK = false;
+        status = stopDataCollection();
+        status = stopPEG(pulseAxis);
+        strcpy(message, "Unable to read the feeder program progress");
+        goto done;
+      }
+    }
     
-    // Increment the counter of points that have been loaded
-    ptLoadedIdx++;
-  }
-  
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: point buffer fill end\n", driverName, functionName);
-  
-  if (fullProfileSize_ > 50)
-  {
     // Send the GO command
-    cmd << "GO " << axesToString(profileAxes_);
-    //asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, cmd.str().c_str());
+    cmd << "GO " << axesToString(exec_->axes);
     status = pComm_->writeReadAck(cmd);
     
-    while (ptLoadedIdx < fullProfileSize_)
+    while (ptLoadedIdx < exec_->size)
     {
       if (halted_)
       {
@@ -2663,33 +4473,28 @@ asynStatus SPiiPlusController::runProfile()
       // Sleep for a short period of time
       epicsThreadSleep(0.1);
       
-      // Query the number of free points in the buffer (the first axis in the vector is the lead axis)
-      cmd << "?GSFREE(" << profileAxes_[0] << ")";
-      status = pComm_->writeReadInt(cmd, &ptFree);
-      
-      // Increment the counter of points that have been executed
-      ptExecIdx += ptFree;
-      
-      // load the rest of the points as needed
-      for (ptIdx=ptLoadedIdx; ptIdx<(ptLoadedIdx+ptFree); ptIdx++)
+      // The executed points are the points the program has loaded, less the points still in the buffer
+      cmd << "?" << SPIIPLUS_PROFILE_LOADED_VAR;
+      status = pComm_->writeReadInt(cmd, &ptLoadedIdx);
+      cmd << "?GSFREE(" << exec_->axes[0] << ")";
+      if (status == asynSuccess) status = pComm_->writeReadInt(cmd, &ptFree);
+      if (status)
       {
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: sending another point\n", driverName, functionName);
-        
-        // Create and send the point command (should this be ptIdx+1?)
-        cmd << "POINT " << axesToString(profileAxes_) << ", " << positionsToString(ptIdx) << ", " << lround(fullProfileTimes_[ptIdx] * 1000.0);
-        //asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, cmd.str().c_str());
-        status = pComm_->writeReadAck(cmd);
+        executeOK = false;
+        strcpy(message, "Unable to read the feeder program progress");
+        goto done;
       }
+      ptExecIdx = ptLoadedIdx - (pathBufferSize_ - ptFree);
       
-      // Increment the counter of points that have been loaded
-      ptLoadedIdx += ptFree;
+      if (readbackIncremental_)
+        updateReadbacks(&lastRead, false);
       
       lock();
       // Only report the current point of the user-specified array
-      if (ptExecIdx > numAccelSegments_)
+      if (ptExecIdx > exec_->numAccelSegments)
       {
-        setIntegerParam(profileCurrentPoint_, ptExecIdx-numAccelSegments_);
-        setIntegerParam(profileActualPulses_, calculateCurrentPulse(ptExecIdx-numAccelSegments_, startPulses, endPulses, numPulses, pulseMode));
+        setIntegerParam(profileCurrentPoint_, ptExecIdx-exec_->numAccelSegments);
+        setIntegerParam(profileActualPulses_, calculateCurrentPulse(ptExecIdx-exec_->numAccelSegments, startPulses, endPulses, numPulses, pulseMode));
       }
       else
       {
@@ -2699,27 +4504,215 @@ asynStatus SPiiPlusController::runProfile()
       callParamCallbacks();
       unlock();
     }
-    
-    // End the point sequence
-    cmd << "ENDS " << axesToString(profileAxes_);
-    //asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, cmd.str().c_str());
-    status = pComm_->writeReadAck(cmd);
   }
   else
   {
-    // End the point sequence
-    cmd << "ENDS " << axesToString(profileAxes_);
+    // Send the command to start the coordinated motion, but wait for the GO command to move motors
+    cmd << ((exec_->segmentMode == SPIIPLUS_PROFILE_SEGMENT_SPLINE) ? "PVSPLINE" : "PATH");
+    if (moveMode == PROFILE_MOVE_MODE_ABSOLUTE)
+    {
+      cmd << "/tw ";
+    }
+    else
+    {
+      cmd << "/twr ";
+    }
+    cmd << axesToString(exec_->axes);
     //asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, cmd.str().c_str());
     status = pComm_->writeReadAck(cmd);
+  
+    // The point buffer is empty, so the number of free points is its depth
+    cmd << "?GSFREE(" << exec_->axes[0] << ")";
+    if ((pComm_->writeReadInt(cmd, &ptFree) == asynSuccess) && (ptFree > 0))
+    {
+      pathBufferSize_ = ptFree;
+    }
     
-    // Send the GO command
-    cmd << "GO " << axesToString(profileAxes_);
-    //asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, cmd.str().c_str());
-    status = pComm_->writeReadAck(cmd);
+    if (execMode == SPIIPLUS_PROFILE_EXEC_MPOINT)
+    {
+      status = declareMpointMatrix();
+      if (status)
+      {
+        executeOK = false;
+        status = stopDataCollection();
+        status = stopPEG(pulseAxis);
+        sprintf(message, "Unable to declare %s", SPIIPLUS_PROFILE_MPOINT_VAR);
+        goto done;
+      }
+    }
+    
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: point buffer fill start (%i points)\n", driverName, functionName, pathBufferSize_);
+    
+    // Fill the point buffer
+    numToLoad = MIN(pathBufferSize_, exec_->size);
+    status = sendPoints(0, numToLoad, execMode);
+    ptLoadedIdx = numToLoad;
+    
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: point buffer fill end\n", driverName, functionName);
+    
+    if ((exec_->size > pathBufferSize_) || (chainLength > 1))
+    {
+      // Send the GO command
+      cmd << "GO " << axesToString(exec_->axes);
+      //asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, cmd.str().c_str());
+      status = pComm_->writeReadAck(cmd);
+    
+      /*
+       * Refill the buffer until every point is loaded.  While the chain is shorter than
+       * chainLength, the buffer is polled until the last point is executed, and an execute
+       * that is queued by then appends its profile to the motion instead of ending it.  The
+       * indices are then relative to the first point of the new profile, so the points of the
+       * transition to it are at negative indices.
+       */
+      while ((ptLoadedIdx < exec_->size) || ((chained < chainLength) && (ptExecIdx < exec_->size)))
+      {
+        if (halted_)
+        {
+          aborted = true;
+          executeOK = false;
+          status = stopDataCollection();
+          status = stopPEG(pulseAxis);
+          strcpy(message, "Aborted during profile move");
+          goto done;
+        }
+      
+        // Sleep until the motion in the buffer drains to the low watermark
+        refillPeriod = bufferedTime(ptExecIdx, ptLoadedIdx) * (1.0 - SPIIPLUS_REFILL_WATERMARK);
+        refillPeriod = MAX(SPIIPLUS_REFILL_MIN_PERIOD, MIN(SPIIPLUS_REFILL_MAX_PERIOD, refillPeriod));
+        epicsThreadSleep(refillPeriod);
+      
+        // Query the number of free points in the buffer (the first axis in the vector is the lead axis)
+        cmd << "?GSFREE(" << exec_->axes[0] << ")";
+        status = pComm_->writeReadInt(cmd, &ptFree);
+        if (status)
+          ptFree = 0;
+      
+        // An empty buffer means the motion may have run out of points before this refill
+        if ((ptFree >= pathBufferSize_) && (ptLoadedIdx < exec_->size))
+        {
+          underruns++;
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: point buffer underrun at point %i\n", driverName, functionName, ptExecIdx);
+        }
+      
+        // The executed points are the loaded points, less the points still in the buffer
+        if (status == asynSuccess)
+          ptExecIdx = ptLoadedIdx - (pathBufferSize_ - ptFree);
+        
+        // Append the profile of an execute that was queued while this one ran
+        if ((ptLoadedIdx >= exec_->size) && (chained < chainLength) && (epicsEventTryWait(profileExecuteEvent_) == epicsEventWaitOK))
+        {
+          lock();
+          if ((nextSlot_ >= 0) && canChainProfile(exec_, &profileSlots_[nextSlot_]))
+          {
+            transitionPoints = buildTransition(exec_, &profileSlots_[nextSlot_]);
+            // A relative profile starts where the previous one ends, after its flyback
+            pulseOrigin += profileDisplacement(exec_, pulseAxis);
+            profileSlots_[nextSlot_].origin.resize(exec_->axes.size());
+            for (j=0; j<exec_->axes.size(); j++)
+            {
+              profileSlots_[nextSlot_].origin[j] = (moveMode == PROFILE_MOVE_MODE_RELATIVE) ?
+                exec_->origin[j] + profileDisplacement(exec_, exec_->axes[j]) : exec_->flybackPos[j];
+            }
+            ptExecIdx -= exec_->size + transitionPoints;
+            ptLoadedIdx = -transitionPoints;
+            execSlot_ = nextSlot_;
+            exec_ = &profileSlots_[execSlot_];
+            numPoints = exec_->numPoints;
+            numPulses = exec_->numPulses;
+            startPulses = exec_->startPulses;
+            endPulses = exec_->endPulses;
+            chained++;
+            pegPending = (pulseMode != 3);
+            setIntegerParam(SPiiPlusProfileChained_, chained);
+            callParamCallbacks();
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: chained slot %i with %i transition points\n", driverName, functionName, execSlot_, transitionPoints);
+          }
+          else
+          {
+            // profileThread runs the execute once this profile is done
+            epicsEventSignal(profileExecuteEvent_);
+            chainLength = chained;
+          }
+          unlock();
+        }
+        
+        // The pulses of the next profile are armed once the points of the previous one are executed
+        if (pegPending && (ptExecIdx >= -transitionPoints))
+        {
+          pegPending = false;
+          stopPEG(pulseAxis);
+          if (armPEG(exec_, pulseWidth, pulseOrigin) != asynSuccess)
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Unable to arm the pulses of slot %i\n", driverName, functionName, execSlot_);
+        }
+      
+        // load the rest of the points as needed, starting with the transition
+        numToLoad = MIN(ptFree, exec_->size - ptLoadedIdx);
+        if (ptLoadedIdx < 0)
+        {
+          numTransition = MIN(numToLoad, -ptLoadedIdx);
+          status = sendPointStream(transitionStream_, transitionOffsets_, ptLoadedIdx + transitionPoints, numTransition);
+          ptLoadedIdx += numTransition;
+          numToLoad -= numTransition;
+        }
+        status = sendPoints(ptLoadedIdx, numToLoad, execMode);
+      
+        // Increment the counter of points that have been loaded
+        ptLoadedIdx += numToLoad;
+      
+        if (readbackIncremental_)
+          updateReadbacks(&lastRead, false);
+      
+        lock();
+        // Count the polls that find the lead axis newly starved (AST.#STARV)
+        if (axisStatus_[exec_->axes[0]] & SPIIPLUS_AXIS_STATUS_STARV)
+        {
+          if (!starving)
+            starvations++;
+          starving = true;
+        }
+        else
+        {
+          starving = false;
+        }
+        setIntegerParam(SPiiPlusProfileUnderruns_, underruns);
+        setIntegerParam(SPiiPlusProfileStarvations_, starvations);
+        // Only report the current point of the user-specified array
+        if (ptExecIdx > exec_->numAccelSegments)
+        {
+          setIntegerParam(profileCurrentPoint_, ptExecIdx-exec_->numAccelSegments);
+          setIntegerParam(profileActualPulses_, calculateCurrentPulse(ptExecIdx-exec_->numAccelSegments, startPulses, endPulses, numPulses, pulseMode));
+        }
+        else
+        {
+          setIntegerParam(profileCurrentPoint_, 0);
+          setIntegerParam(profileActualPulses_, 0);
+        }
+        callParamCallbacks();
+        unlock();
+      }
+    
+      // End the point sequence
+      cmd << "ENDS " << axesToString(exec_->axes);
+      //asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, cmd.str().c_str());
+      status = pComm_->writeReadAck(cmd);
+    }
+    else
+    {
+      // End the point sequence
+      cmd << "ENDS " << axesToString(exec_->axes);
+      //asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, cmd.str().c_str());
+      status = pComm_->writeReadAck(cmd);
+    
+      // Send the GO command
+      cmd << "GO " << axesToString(exec_->axes);
+      //asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, cmd.str().c_str());
+      status = pComm_->writeReadAck(cmd);
+    }
+  
   }
   
   // Wait for the remaining points to be executed
-  while (ptExecIdx < fullProfileSize_)
+  while (ptExecIdx < exec_->size)
   {
     if (halted_)
     {
@@ -2735,24 +4728,27 @@ asynStatus SPiiPlusController::runProfile()
     epicsThreadSleep(0.1);
     
     // Query the number of free points in the buffer
-    cmd << "?GSFREE(" << profileAxes_[0] << ")";
+    cmd << "?GSFREE(" << exec_->axes[0] << ")";
     status = pComm_->writeReadInt(cmd, &ptFree);
     
     // Update the number of points that have been executed
-    ptExecIdx = fullProfileSize_ - 50 + ptFree;
+    ptExecIdx = exec_->size - pathBufferSize_ + ptFree;
+    
+    if (readbackIncremental_)
+      updateReadbacks(&lastRead, false);
     
     lock();
     // Stop updating current point when numPoints is reached
-    if (ptExecIdx < numAccelSegments_)
+    if (ptExecIdx < exec_->numAccelSegments)
     {
       // This only gets executed if the user-specified profile has very few points in it
       setIntegerParam(profileCurrentPoint_, 0);
       setIntegerParam(profileActualPulses_, 0);
     }
-    else if ((ptExecIdx >= numAccelSegments_) && (ptExecIdx < numAccelSegments_+numPoints))
+    else if ((ptExecIdx >= exec_->numAccelSegments) && (ptExecIdx < exec_->numAccelSegments+numPoints))
     {
-      setIntegerParam(profileCurrentPoint_, ptExecIdx-numAccelSegments_);
-      setIntegerParam(profileActualPulses_, calculateCurrentPulse(ptExecIdx-numAccelSegments_, startPulses, endPulses, numPulses, pulseMode));
+      setIntegerParam(profileCurrentPoint_, ptExecIdx-exec_->numAccelSegments);
+      setIntegerParam(profileActualPulses_, calculateCurrentPulse(ptExecIdx-exec_->numAccelSegments, startPulses, endPulses, numPulses, pulseMode));
     }
     else
     {
@@ -2764,6 +4760,15 @@ asynStatus SPiiPlusController::runProfile()
   }
   
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: profile move is done\n", driverName, functionName);
+  
+  // A chain that ended before the second recorded profile would leave the data collection running
+  if (chained < recordLength)
+    stopDataCollection();
+  
+  // Catch up with the samples collected since the last incremental read
+  if (readbackIncremental_)
+    updateReadbacks(&lastRead, true);
+  
   if (pulseMode != 3)
   {
     // Stop PEG to avoid extra triggers when moving to the flyback position
@@ -2789,13 +4794,11 @@ asynStatus SPiiPlusController::runProfile()
     cmd << "PTP/mr ";
   }
   // Create the comma-separated list of final positions
-  for (j=0; j<profileAxes_.size(); j++)
+  for (j=0; j<exec_->axes.size(); j++)
   {
-    pAxis = getAxis(profileAxes_[j]);
+    position = exec_->flybackPos[j];
     
-    position = pAxis->profileFlybackPos_;
-    
-    if (profileAxes_[j] == profileAxes_.front())
+    if (exec_->axes[j] == exec_->axes.front())
     {
       positionStr << position;
     }
@@ -2805,7 +4808,7 @@ asynStatus SPiiPlusController::runProfile()
     }
   }
   // Send the group move command
-  cmd << axesToString(profileAxes_) << ", " << positionStr.str();
+  cmd << axesToString(exec_->axes) << ", " << positionStr.str();
   status = pComm_->writeReadAck(cmd);
 
   // Wait for the motors to get there
@@ -2837,54 +4840,248 @@ asynStatus SPiiPlusController::runProfile()
   setIntegerParam(profileExecuteState_, PROFILE_EXECUTE_DONE);
   callParamCallbacks();
   halted_ = false;
+  execSlot_ = -1;
+  exec_ = NULL;
   unlock();
   return executeOK ? asynSuccess : asynError; 
 }
 
 asynStatus SPiiPlusController::waitMotors()
 {
-  unsigned int j;
-  SPiiPlusAxis* pAxis;
-  int moving;
   static const char *functionName = "waitMotors";
   
-  while (1) {
-    epicsThreadSleep(0.1);
-    
-    // assume no motors are moving
-    moving = 0;
-    for (j=0; j<profileAxes_.size(); j++)
+  // The caller checks halted_ after the wait
+  if (waitAxisState(-1))
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: motors are done moving\n", driverName, functionName);
+  return asynSuccess;
+}
+
+/*
+ * Wait until the polls report that the profile axes are done moving (pegAxis < 0) or that
+ * pegAxis is PEGREADY.  The states are only trusted once a poll has started after the wait
+ * began, since the command that changes them was just sent.  The polls signal axisStateEvent_
+ * when that poll starts and when the state of an axis changes, so the wait ends within one
+ * poll of the change.  The timeout is only a fallback, since abortProfile signals the event
+ * too.  Returns false if the profile was halted.
+ */
+bool SPiiPlusController::waitAxisState(int pegAxis)
+{
+  unsigned int j;
+  bool done;
+  epicsTimeStamp now;
+  double latency;
+  static const char *functionName = "waitAxisState";
+  
+  lock();
+  axisStatePolled_ = false;
+  unlock();
+  epicsEventTryWait(axisStateEvent_);
+  
+  while (1)
+  {
+    lock();
+    done = axisStatePolled_;
+    if (pegAxis >= 0)
+    {
+      done = done && (pAxes_[pegAxis]->pegReady_ != 0);
+    }
+    else
     {
-      pAxis = getAxis(profileAxes_[j]);
-      moving |= pAxis->moving_;
+      for (j=0; done && (j<exec_->axes.size()); j++)
+        done = (pAxes_[exec_->axes[j]]->moving_ == 0);
+    }
+    if (done)
+    {
+      epicsTimeGetCurrent(&now);
+      latency = epicsTimeDiffInSeconds(&now, &axisStateTime_);
+      if (latency > waitLatency_)
+      {
+        waitLatency_ = latency;
+        setDoubleParam(SPiiPlusProfileWaitLatency_, waitLatency_);
+        callParamCallbacks();
+      }
     }
-    if (moving == 0) break;
+    unlock();
+    
+    if (done) return true;
+    if (halted_) return false;
+    
+    if (epicsEventWaitWithTimeout(axisStateEvent_, SPIIPLUS_AXIS_STATE_TIMEOUT) == epicsEventWaitTimeout)
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: no axis state change for %.1f s\n", driverName, functionName, SPIIPLUS_AXIS_STATE_TIMEOUT);
   }
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: motors are done moving\n", driverName, functionName);
-  return asynSuccess;
 }
 
 asynStatus SPiiPlusController::stopDataCollection()
 {
-  asynStatus status;
+  asynStatus status = asynSuccess;
   std::stringstream cmd;
   int i;
-  int axesToRecord;
+  int firstAxis;
   // static const char *functionName = "stopDataCollection";  
   
-  if (profileAxes_.size() > 8)
-    axesToRecord = 8;
-  else
-    axesToRecord = profileAxes_.size();
-  for (i=0; i<axesToRecord; i++)
+  for (i=0; i<dcChannels(); i++)
   {
-    cmd << "STOPDC/s " << profileAxes_[i];
+    dcChannelAxes(i, &firstAxis);
+    cmd << "STOPDC/s " << recordedAxes_[firstAxis];
     status = pComm_->writeReadAck(cmd);
   }
   
   return status;
 }
 
+/*
+ * The number of data collection channels used by the last execution of a profile.
+ */
+int SPiiPlusController::dcChannels()
+{
+  if (dcAxesPerChannel_ == 0)
+    return 0;
+  
+  return (recordedAxes_.size() + dcAxesPerChannel_ - 1) / dcAxesPerChannel_;
+}
+
+/*
+ * The number of profile axes recorded by a data collection channel.  firstAxis receives the
+ * index in recordedAxes_ of the first of them, which is also the axis the channel is synchronized to.
+ * DC_DATA_{channel+1} has the position and position error rows of each of them, in order.
+ */
+int SPiiPlusController::dcChannelAxes(int channel, int *firstAxis)
+{
+  *firstAxis = channel * dcAxesPerChannel_;
+  
+  return MIN(dcAxesPerChannel_, (int)recordedAxes_.size() - *firstAxis);
+}
+
+/*
+ * The variable that records the position of an axis during a profile move.
+ */
+const char *SPiiPlusController::dcPositionSource(int axis)
+{
+  if (pAxes_[axis]->dummy_)
+  {
+    // use the desired position for dummy axes, since FPOS and PE are always zero
+    return "APOS";
+  }
+  else if (pAxes_[axis]->virtual_)
+  {
+    // use the virtual feedback position for virtual axes when it is supported, the desired position otherwise
+    return virtualFeedbackPositionSupported_ ? "VPOS" : "APOS";
+  }
+  
+  // use the feedback position for real motors
+  return "FPOS";
+}
+
+/*
+ * Arm the pulse output of a profile: PEG_I in the fixed and trajectory point pulse modes and
+ * PEG_R with the pulse array of the slot in the array mode.  runProfile assigns the PEG engine
+ * and outputs first.  The pulse positions of a relative profile are from pulseOrigin, the
+ * position of the pulse axis when the profile starts, so its pulse array is sent now.
+ */
+asynStatus SPiiPlusController::armPEG(const SPiiPlusProfileSlot *slot, double pulseWidth, double pulseOrigin)
+{
+  asynStatus status;
+  std::vector <double> pulses;
+  std::stringstream cmd;
+  double startPos = slot->pulseStartPos;
+  double endPos = slot->pulseEndPos;
+  unsigned int i;
+  static const char *functionName = "armPEG";
+  
+  if (slot->moveMode == PROFILE_MOVE_MODE_RELATIVE)
+  {
+    startPos += pulseOrigin;
+    endPos += pulseOrigin;
+  }
+  
+  if ((slot->pulseMode == 0) || (slot->pulseMode == 2))
+  {
+    // PEG_I axis, width, first_point, interval, last_point
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: startPulsePos=%f, endPulsePos=%f, numElements=%i, pulseInterval=%f\n", driverName, functionName, startPos, endPos, slot->numPulses, slot->pulseSpacing);
+    cmd << "PEG_I " << slot->pulseAxis << ", " << pulseWidth << ", " << startPos << ", " << slot->pulseSpacing << ", " << endPos;
+  }
+  else if (slot->pulseMode == 1)
+  {
+    if (slot->moveMode == PROFILE_MOVE_MODE_RELATIVE)
+    {
+      pulses.resize(slot->relativePulses.size());
+      for (i=0; i<pulses.size(); i++)
+        pulses[i] = pulseOrigin + slot->relativePulses[i];
+      status = pComm_->putDoubleArray(&pulses[0], slot->pulseVar, 0, slot->numPulses-1, 0, 0, false);
+      if (status)
+        return status;
+    }
+    
+    // PEG_R peg_engine width mode first_index last_index POS_ARRAY
+    
+    // TODO: is 0x4444 the correct mode? Is pulseAxis the correct peg_engine argument?
+    // NOTE: ASSIGNPEG's /f switch is also required
+    cmd << "PEG_R/d " << slot->pulseAxis << ", " << pulseWidth << ", " << "0x4444" << ", " << "0" << ", " << (slot->numPulses-1) << ", " << slot->pulseVar;
+  }
+  else
+  {
+    // None Mode
+    return asynSuccess;
+  }
+  
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName, functionName, cmd.str().c_str());
+  return pComm_->writeReadAck(cmd);
+}
+
+/*
+ * The displacement of an axis over a relative profile, from its position before the move to
+ * the start of the profile to its position after the flyback, which is where the next profile
+ * of a chain starts.  Zero for axes that aren't profile axes.
+ */
+double SPiiPlusController::profileDisplacement(const SPiiPlusProfileSlot *slot, int axis)
+{
+  double displacement;
+  unsigned int j;
+  int i;
+  
+  for (j=0; j<slot->axes.size(); j++)
+  {
+    if (slot->axes[j] != axis)
+      continue;
+    
+    // Relative points are the displacement of the segment
+    displacement = slot->startPos[j] + slot->flybackPos[j];
+    for (i=0; i<slot->size; i++)
+      displacement += slot->position(j, i);
+    return displacement;
+  }
+  
+  return 0.0;
+}
+
+/*
+ * The position a relative profile that is built now starts from, in controller units.  While
+ * a profile is executed, the next one starts where it flies back to: its origin plus its
+ * displacement if it is relative, its flyback position if it is absolute.  Otherwise, and for
+ * axes that the executing profile doesn't move, it is the current position.
+ */
+double SPiiPlusController::profileOrigin(int axis)
+{
+  double position;
+  unsigned int j;
+  
+  if (execSlot_ >= 0)
+  {
+    for (j=0; j<exec_->axes.size(); j++)
+    {
+      if (exec_->axes[j] != axis)
+        continue;
+      
+      if (exec_->moveMode == PROFILE_MOVE_MODE_RELATIVE)
+        return exec_->origin[j] + profileDisplacement(exec_, axis);
+      return exec_->flybackPos[j];
+    }
+  }
+  
+  getDoubleParam(axis, motorPosition_, &position);
+  return position * pAxes_[axis]->resolution_;
+}
+
 asynStatus SPiiPlusController::stopPEG(int pulseAxis)
 {
   asynStatus status;
@@ -2909,28 +5106,135 @@ asynStatus SPiiPlusController::abortProfile()
     
   if (executeState != PROFILE_EXECUTE_DONE)
   {
-    cmd << "HALT " << axesToString(profileAxes_);
-    status = pComm_->writeReadAck(cmd);
+    // Only the executing slot is halted; a profile built in the other slot is kept
+    if (exec_)
+    {
+      cmd << "HALT " << axesToString(exec_->axes);
+      status = pComm_->writeReadAck(cmd);
+      
+      // Keep the feeder program from adding points after the halt
+      if (exec_->uploaded)
+      {
+        cmd << "STOP " << profileBuffer_;
+        pComm_->writeReadAck(cmd);
+      }
+    }
     
     halted_ = true;
+    
+    // End a profile phase wait now rather than at its timeout
+    epicsEventSignal(axisStateEvent_);
   }
   
   return status;
 }
 
+/*
+ * Read the samples from readbackCount_ up to, but not including, last from the data
+ * collection array of every channel.  DC_DATA_{c+1} has a position row and a position
+ * error row for each profile axis of channel c (see dcChannelAxes), which are read straight
+ * into the arrays of those axes, with the queries for all of the channels in one pipelined
+ * batch.  The new samples are converted to user units and the arrays are posted, so partial
+ * data is visible.
+ */
+asynStatus SPiiPlusController::readSamples(int last)
+{
+  asynStatus status;
+  int first, count;
+  int channel, firstAxis, numInChannel;
+  unsigned int j;
+  std::vector<doubleArrayRead_t> reads(dcChannels());
+  SPiiPlusAxis* pAxis;
+  static const char *functionName = "readSamples";
+  
+  first = readbackCount_;
+  last = MIN(last, (int)maxProfilePoints_);
+  count = last - first;
+  if ((count <= 0) || reads.empty())
+    return asynSuccess;
+  
+  for (channel=0; channel<(int)reads.size(); channel++)
+  {
+    numInChannel = dcChannelAxes(channel, &firstAxis);
+    sprintf(reads[channel].var, "DC_DATA_%i", channel+1);
+    reads[channel].idx1start = 0;
+    reads[channel].idx1end = 2*numInChannel - 1;
+    reads[channel].idx2start = first;
+    reads[channel].idx2end = last - 1;
+    reads[channel].rowSize = maxProfilePoints_ - first;
+    for (j=firstAxis; (int)j<firstAxis+numInChannel; j++)
+    {
+      pAxis = pAxes_[recordedAxes_[j]];
+      reads[channel].rows.push_back(pAxis->profileReadbacks_ + first);
+      reads[channel].rows.push_back(pAxis->profileFollowingErrors_ + first);
+    }
+  }
+  
+  status = pComm_->getDoubleArrays(reads);
+  if (status != asynSuccess)
+  {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Error reading samples %i to %i of %i channels\n", driverName, functionName, first, last-1, (int)reads.size());
+    return status;
+  }
+  
+  lock();
+  for (j=0; j<recordedAxes_.size(); j++)
+  {
+    pAxes_[recordedAxes_[j]]->readbackProfile(first, last);
+  }
+  readbackCount_ = last;
+  setIntegerParam(profileNumReadbacks_, last);
+  callParamCallbacks();
+  unlock();
+  
+  return asynSuccess;
+}
+
+/*
+ * Read the samples collected since the last read, if SPIIPLUS_READBACK_PERIOD has elapsed
+ * (or force is true).  The number of samples is the smallest DCN of the channels, so
+ * a sample is only read once every axis has collected it.  Errors are only reported,
+ * since readbackProfile reads any samples that were missed.
+ */
+void SPiiPlusController::updateReadbacks(epicsTimeStamp *lastRead, bool force)
+{
+  epicsTimeStamp now;
+  std::stringstream cmd;
+  int channel, firstAxis;
+  int numSamples, channelSamples;
+  static const char *functionName = "updateReadbacks";
+  
+  epicsTimeGetCurrent(&now);
+  if (!force && (epicsTimeDiffInSeconds(&now, lastRead) < SPIIPLUS_READBACK_PERIOD))
+    return;
+  *lastRead = now;
+  
+  numSamples = maxProfilePoints_;
+  for (channel=0; channel<dcChannels(); channel++)
+  {
+    // DCN is indexed by the axis the channel is synchronized to
+    dcChannelAxes(channel, &firstAxis);
+    cmd << "?DCN(" << recordedAxes_[firstAxis] << ")";
+    if (pComm_->writeReadInt(cmd, &channelSamples) != asynSuccess)
+    {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Unable to read DCN(%i)\n", driverName, functionName, recordedAxes_[firstAxis]);
+      return;
+    }
+    numSamples = MIN(numSamples, channelSamples);
+  }
+  
+  readSamples(numSamples);
+}
+
 asynStatus SPiiPlusController::readbackProfile()
 {
   char message[MAX_MESSAGE_LEN];
   bool readbackOK=true;
-  char* buffer=NULL;
   int readbackStatus;
-  int status;
+  int status = asynSuccess;
   int i; 
   unsigned int j;
-  std::stringstream cmd;
-  char var[MAX_MESSAGE_LEN];
-  int bytesPerDim;
-  SPiiPlusAxis* pAxis;
+  bool recorded[SPIIPLUS_MAX_AXES];
   static const char *functionName = "readbackProfile";
 
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
@@ -2943,53 +5247,54 @@ asynStatus SPiiPlusController::readbackProfile()
   setIntegerParam(profileReadbackStatus_, PROFILE_STATUS_UNDEFINED);
   callParamCallbacks();
   
-  if (profileAxes_.size() == 0)
+  if (recordedAxes_.size() == 0)
   {
-    strcpy(message, "No axes selected");
+    strcpy(message, "No profile has been executed");
     readbackOK = false;
     goto done;
   }
   
-  asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: axisList = %s\n", driverName, functionName, axesToString(profileAxes_).c_str());
-  sprintf(message, "Selected axes: %s", motorsToString(profileAxes_).c_str()); 
+  asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: axisList = %s\n", driverName, functionName, axesToString(recordedAxes_).c_str());
+  sprintf(message, "Selected axes: %s", motorsToString(recordedAxes_).c_str()); 
   setStringParam(profileReadbackMessage_, message);
   callParamCallbacks();
   
-  /* Erase the readback and error arrays */
-  for (i=0; i<numAxes_; i++) {
-    memset(pAxes_[i]->profileReadbacks_,       0, maxProfilePoints_*sizeof(double));
-    memset(pAxes_[i]->profileFollowingErrors_, 0, maxProfilePoints_*sizeof(double));
+  /* Erase the readback and error arrays, unless the samples were read while the profile was executed */
+  if (!readbackIncremental_)
+  {
+    readbackCount_ = 0;
+    for (i=0; i<numAxes_; i++) {
+      memset(pAxes_[i]->profileReadbacks_,       0, maxProfilePoints_*sizeof(double));
+      memset(pAxes_[i]->profileFollowingErrors_, 0, maxProfilePoints_*sizeof(double));
+    }
   }
   
-  buffer = (char *)calloc(MAX_BINARY_READ_LEN, sizeof(char));
+  if (maxProfilePoints_ == 0)
+  {
+    strcpy(message, "Profile not initialized");
+    readbackOK = false;
+    goto done;
+  }
   
-  for (j=0; j<profileAxes_.size(); j++)
+  // Read the samples that haven't been read yet (all of them, unless the readback was incremental)
+  status = readSamples(maxProfilePoints_);
+  if (status != asynSuccess)
   {
-    pAxis = getAxis(j);
-    
-    sprintf(var, "DC_DATA_%i", j+1);
-    status = pComm_->getDoubleArray(buffer, var, 0, 2, 0, (maxProfilePoints_-1));
-    if (status != asynSuccess)
-    {
-      readbackOK = false;
-      goto done;
-    }
-    
-    bytesPerDim = maxProfilePoints_ * sizeof(double);
-    // Position
-    memcpy(pAxis->profileReadbacks_, buffer, bytesPerDim);
-    // Postion error
-    memcpy(pAxis->profileFollowingErrors_, buffer+bytesPerDim, bytesPerDim);
-    // Time
-    //memcpy(pAxis->profileTimes_, buffer+bytesPerDim*2, bytesPerDim);
+    readbackOK = false;
+    goto done;
   }
   
   done:
-  if (buffer) free(buffer);
   setIntegerParam(profileNumReadbacks_, maxProfilePoints_);
-  /* Convert from controller to user units and post the arrays */
+  /* Post the (erased) arrays of the axes that weren't recorded */
+  for (i=0; i<numAxes_; i++) {
+    recorded[i] = false;
+  }
+  for (j=0; j<recordedAxes_.size(); j++) {
+    recorded[recordedAxes_[j]] = true;
+  }
   for (i=0; i<numAxes_; i++) {
-    pAxes_[i]->readbackProfile(maxProfilePoints_);
+    if (!recorded[i] && !readbackIncremental_) pAxes_[i]->readbackProfile(0, maxProfilePoints_);
   }
   readbackStatus = readbackOK ?  PROFILE_STATUS_SUCCESS : PROFILE_STATUS_FAILURE;
   setIntegerParam(profileReadbackStatus_, readbackStatus);
@@ -3011,7 +5316,8 @@ asynStatus SPiiPlusController::readbackProfile()
 asynStatus SPiiPlusController::test()
 {
   asynStatus status;
-  char* buffer=NULL;
+  // Each query asks for 3 doubles
+  epicsFloat64 buffer[3];
   //double* data=NULL;
   //long maxDoubles;
   //long dataSize;
@@ -3020,8 +5326,6 @@ asynStatus SPiiPlusController::test()
   
   asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: calling test function\n", driverName, functionName);
   
-  buffer = (char *)calloc(MAX_BINARY_READ_LEN, sizeof(char));
-  
   // MAX_BINARY_READ_LEN is in bytes so we need to calculate how many doubles that will hold
   /*
   maxDoubles = floorl(MAX_BINARY_READ_LEN/sizeof(double));
@@ -3031,9 +5335,9 @@ asynStatus SPiiPlusController::test()
   //status = pComm_->getDoubleArray(buffer, "DC_DATA_1", 0, 2, 0, (maxProfilePoints_-1));
   
   // Generate three binary read errors by attempting to read variables that don't exist
-  status = pComm_->getDoubleArray(buffer, "FAKE_VAR_1", 0, 2, 0, 0);
-  status = pComm_->getDoubleArray(buffer, "FAKE_VAR_2", 0, 2, 0, 0);
-  status = pComm_->getDoubleArray(buffer, "FAKE_VAR_3", 0, 2, 0, 0);
+  status = pComm_->getDoubleArray((char *)buffer, "FAKE_VAR_1", 0, 2, 0, 0, false);
+  status = pComm_->getDoubleArray((char *)buffer, "FAKE_VAR_2", 0, 2, 0, 0, false);
+  status = pComm_->getDoubleArray((char *)buffer, "FAKE_VAR_3", 0, 2, 0, 0, false);
   // Try to read too many points
   //status = pComm_->getDoubleArray(buffer, "testVar", 0, 2, 0, maxProfilePoints_);
   
@@ -3070,8 +5374,6 @@ asynStatus SPiiPlusController::test()
   //status = pComm_->putDoubleArray(data, "testVar", 0, 4-1, 0, dataSize/4-1);
   */
   
-  free(buffer);
-  
   return status;
 }
 
@@ -3093,6 +5395,31 @@ void SPiiPlusController::report(FILE *fp, int level)
   fprintf(fp, "    idle poll period: %lf\n", idlePollPeriod_);
   fprintf(fp, "    firmware version: %s\n", firmwareVersion_);
   fprintf(fp, "    virtual feedback position support: %s\n", virtualFeedbackPositionSupported_ ? "Yes" : "No");
+  fprintf(fp, "    poll tiers: slow every %i moving polls, on-demand every %i slow reads\n", slowPollDivisor_, onDemandPollDivisor_);
+  fprintf(fp, "    poll tier reads: fast=%lu, slow=%lu, on-demand=%lu\n", fastPollCount_, slowPollCount_, onDemandPollCount_);
+  fprintf(fp, "    ACC/DEC writes: %lu, skipped: %lu\n", accelerationWrites_, accelerationWritesSkipped_);
+  fprintf(fp, "    poll ranges:");
+  for (size_t i=0; i<pollRanges_.size(); i++)
+    fprintf(fp, " (%i, %i)", pollRanges_[i].first, pollRanges_[i].second);
+  fprintf(fp, "\n");
+  if (snapshotBuffer_ < 0)
+    fprintf(fp, "    poll snapshot: disabled\n");
+  else
+    fprintf(fp, "    poll snapshot: buffer %i (%s)\n", snapshotBuffer_, snapshotActive_ ? "active" : "inactive");
+  if (profileBuffer_ < 0)
+    fprintf(fp, "    profile upload: disabled\n");
+  else
+    fprintf(fp, "    profile upload: buffer %i (%s)\n", profileBuffer_, loadedFeeder_.empty() ? "no feeder loaded" : "feeder loaded");
+  fprintf(fp, "    profile cache: %lu builds skipped\n", profileBuildsSkipped_);
+  fprintf(fp, "    profile slots: next %i, executing %i\n", nextSlot_, execSlot_);
+  for (int i=0; i<SPIIPLUS_PROFILE_SLOTS; i++)
+  {
+    SPiiPlusProfileSlot *slot = &profileSlots_[i];
+    fprintf(fp, "      slot %i: %s, %i points, %s, point stream %i bytes\n", i, slot->hashValid ? "valid" : "empty", slot->size,
+            slot->uploaded ? "uploaded" : "not uploaded", (int)slot->pointStream.size());
+  }
+  fprintf(fp, "    path buffer depth: %i points\n", pathBufferSize_);
+  pComm_->report(fp, 0);
   fprintf(fp, "\n");
   
   // level = 0: only print ACS driver report info
@@ -3147,6 +5474,138 @@ static void configSPiiPlusProfileCallFunc(const iocshArgBuf *args)
     SPiiPlusCreateProfile(args[0].sval, args[1].ival, args[2].ival);
 }
 
+asynStatus SPiiPlusConfigSnapshot(const char *SPiiPlusName,         /* specify which controller by port name */
+                            int buffer)                  /* program buffer for the snapshot program, -1 to disable */
+{
+  SPiiPlusController *pC;
+  asynStatus status;
+  static const char *functionName = "SPiiPlusConfigSnapshot";
+
+  pC = (SPiiPlusController*) findAsynPortDriver(SPiiPlusName);
+  if (!pC) {
+    printf("%s:%s: Error port %s not found\n",
+           driverName, functionName, SPiiPlusName);
+    return asynError;
+  }
+  pC->lock();
+  status = pC->configSnapshot(buffer);
+  pC->unlock();
+  return status;
+}
+
+asynStatus SPiiPlusConfigPolling(const char *SPiiPlusName,          /* specify which controller by port name */
+                            int slowPollDivisor,         /* moving polls per slow-tier read */
+                            int onDemandPollDivisor,     /* slow-tier reads per on-demand-tier read, 0 = only on demand */
+                            int roundTripBytes)          /* bytes of unused axes worth reading to avoid a query */
+{
+  SPiiPlusController *pC;
+  asynStatus status;
+  static const char *functionName = "SPiiPlusConfigPolling";
+
+  pC = (SPiiPlusController*) findAsynPortDriver(SPiiPlusName);
+  if (!pC) {
+    printf("%s:%s: Error port %s not found\n",
+           driverName, functionName, SPiiPlusName);
+    return asynError;
+  }
+  pC->lock();
+  status = pC->configPolling(slowPollDivisor, onDemandPollDivisor, roundTripBytes);
+  pC->unlock();
+  return status;
+}
+
+asynStatus SPiiPlusConfigProfileBuffer(const char *SPiiPlusName,    /* specify which controller by port name */
+                            int buffer)                  /* program buffer for the profile feeder program, -1 to disable */
+{
+  SPiiPlusController *pC;
+  asynStatus status;
+  static const char *functionName = "SPiiPlusConfigProfileBuffer";
+
+  pC = (SPiiPlusController*) findAsynPortDriver(SPiiPlusName);
+  if (!pC) {
+    printf("%s:%s: Error port %s not found\n",
+           driverName, functionName, SPiiPlusName);
+    return asynError;
+  }
+  pC->lock();
+  status = pC->configProfileBuffer(buffer);
+  pC->unlock();
+  return status;
+}
+
+asynStatus SPiiPlusConfigBinaryPort(const char *SPiiPlusName,       /* specify which controller by port name */
+                            const char *asynPortName)    /* asyn port with a second connection to the controller */
+{
+  SPiiPlusController *pC;
+  asynStatus status;
+  static const char *functionName = "SPiiPlusConfigBinaryPort";
+
+  pC = (SPiiPlusController*) findAsynPortDriver(SPiiPlusName);
+  if (!pC) {
+    printf("%s:%s: Error port %s not found\n",
+           driverName, functionName, SPiiPlusName);
+    return asynError;
+  }
+  pC->lock();
+  status = pC->configBinaryPort(asynPortName);
+  pC->unlock();
+  return status;
+}
+
+// Profile Buffer Setup arguments
+static const iocshArg SPiiPlusConfigProfileBufferArg0 = {"ACS port name", iocshArgString};
+static const iocshArg SPiiPlusConfigProfileBufferArg1 = {"Program buffer", iocshArgInt};
+
+static const iocshArg * const SPiiPlusConfigProfileBufferArgs[2] = {&SPiiPlusConfigProfileBufferArg0, &SPiiPlusConfigProfileBufferArg1};
+
+static const iocshFuncDef configSPiiPlusProfileBuffer = {"SPiiPlusConfigProfileBuffer", 2, SPiiPlusConfigProfileBufferArgs};
+
+static void configSPiiPlusProfileBufferCallFunc(const iocshArgBuf *args)
+{
+    SPiiPlusConfigProfileBuffer(args[0].sval, args[1].ival);
+}
+
+// Binary Port Setup arguments
+static const iocshArg SPiiPlusConfigBinaryPortArg0 = {"ACS port name", iocshArgString};
+static const iocshArg SPiiPlusConfigBinaryPortArg1 = {"Binary asyn port name", iocshArgString};
+
+static const iocshArg * const SPiiPlusConfigBinaryPortArgs[2] = {&SPiiPlusConfigBinaryPortArg0, &SPiiPlusConfigBinaryPortArg1};
+
+static const iocshFuncDef configSPiiPlusBinaryPort = {"SPiiPlusConfigBinaryPort", 2, SPiiPlusConfigBinaryPortArgs};
+
+static void configSPiiPlusBinaryPortCallFunc(const iocshArgBuf *args)
+{
+    SPiiPlusConfigBinaryPort(args[0].sval, args[1].sval);
+}
+
+// Polling Setup arguments
+static const iocshArg SPiiPlusConfigPollingArg0 = {"ACS port name", iocshArgString};
+static const iocshArg SPiiPlusConfigPollingArg1 = {"Slow poll divisor", iocshArgInt};
+static const iocshArg SPiiPlusConfigPollingArg2 = {"On-demand poll divisor", iocshArgInt};
+static const iocshArg SPiiPlusConfigPollingArg3 = {"Round trip cost (bytes)", iocshArgInt};
+
+static const iocshArg * const SPiiPlusConfigPollingArgs[4] = {&SPiiPlusConfigPollingArg0, &SPiiPlusConfigPollingArg1, &SPiiPlusConfigPollingArg2, &SPiiPlusConfigPollingArg3};
+
+static const iocshFuncDef configSPiiPlusPolling = {"SPiiPlusConfigPolling", 4, SPiiPlusConfigPollingArgs};
+
+static void configSPiiPlusPollingCallFunc(const iocshArgBuf *args)
+{
+    SPiiPlusConfigPolling(args[0].sval, args[1].ival, args[2].ival, args[3].ival);
+}
+
+// Snapshot Setup arguments
+static const iocshArg SPiiPlusConfigSnapshotArg0 = {"ACS port name", iocshArgString};
+static const iocshArg SPiiPlusConfigSnapshotArg1 = {"Program buffer", iocshArgInt};
+
+static const iocshArg * const SPiiPlusConfigSnapshotArgs[2] = {&SPiiPlusConfigSnapshotArg0, &SPiiPlusConfigSnapshotArg1};
+
+static const iocshFuncDef configSPiiPlusSnapshot = {"SPiiPlusConfigSnapshot", 2, SPiiPlusConfigSnapshotArgs};
+
+static void configSPiiPlusSnapshotCallFunc(const iocshArgBuf *args)
+{
+    SPiiPlusConfigSnapshot(args[0].sval, args[1].ival);
+}
+
 // ACS Setup arguments
 static const iocshArg configArg0 = {"ACS port name", iocshArgString};
 static const iocshArg configArg1 = {"asyn port name", iocshArgString};
@@ -3169,6 +5628,10 @@ static void AcsMotionRegister(void)
 {
 	iocshRegister(&configAcsMotion, AcsMotionCallFunc);
 	iocshRegister(&configSPiiPlusProfile, configSPiiPlusProfileCallFunc);
+	iocshRegister(&configSPiiPlusSnapshot, configSPiiPlusSnapshotCallFunc);
+	iocshRegister(&configSPiiPlusPolling, configSPiiPlusPollingCallFunc);
+	iocshRegister(&configSPiiPlusBinaryPort, configSPiiPlusBinaryPortCallFunc);
+	iocshRegister(&configSPiiPlusProfileBuffer, configSPiiPlusProfileBufferCallFunc);
 }
 
 epicsExportRegistrar(AcsMotionRegister);
@@ -1,4 +1,7 @@
 #include <string>
+#include <stdint.h>
+
+#include <epicsTime.h>
 
 #include "asynMotorController.h"
 #include "asynMotorAxis.h"
@@ -6,10 +9,15 @@
 #include "SPiiPlusCommDriver.h"
 
 #define SPIIPLUS_MAX_AXES 64
-#define SPIIPLUS_MAX_DC_AXES 8
+// Data collection channels (DC_DATA_n arrays); with SPIIPLUS_MAX_AXES axes a channel records up to 8 axes (16 variables)
+#define SPIIPLUS_MAX_DC_CHANNELS 8
+
+// Profiles that can be built at once: one executing, one waiting
+#define SPIIPLUS_PROFILE_SLOTS 2
 #define SPIIPLUS_CMD_TIMEOUT 0.05
 #define SPIIPLUS_ACK_TIMEOUT 0.2
 #define SPIIPLUS_ARRAY_TIMEOUT 10.0
+#define SPIIPLUS_AXIS_STATE_TIMEOUT 1.0
 #define MAX_MESSAGE_LEN   256
 #define MAX_ACCEL_SEGMENTS 20
 
@@ -17,6 +25,88 @@
 #define MAX_BINARY_READ_LEN 65536
 #define MAX_BINARY_WRITE_LEN 65536
 
+// The poll snapshot program packs the polled variables into one global array (one row per variable)
+#define SPIIPLUS_SNAPSHOT_VAR		"EPICS_SNAPSHOT"
+#define SPIIPLUS_SNAPSHOT_LABEL		"EPICS_SNAPSHOT"
+#define SPIIPLUS_SNAPSHOT_STALE_PASSES	10
+#define SPIIPLUS_SNAPSHOT_STALE_MIN_TIME	0.2
+#define SPIIPLUS_SNAPSHOT_RETRY_PERIOD	1.0
+//
+#define SPIIPLUS_SNAPSHOT_APOS		0
+#define SPIIPLUS_SNAPSHOT_RPOS		1
+#define SPIIPLUS_SNAPSHOT_EPOS		2
+#define SPIIPLUS_SNAPSHOT_FPOS		3
+#define SPIIPLUS_SNAPSHOT_F2POS		4
+#define SPIIPLUS_SNAPSHOT_VPOS		5
+#define SPIIPLUS_SNAPSHOT_FVEL		6
+#define SPIIPLUS_SNAPSHOT_ROFFS		7
+#define SPIIPLUS_SNAPSHOT_EOFFS		8
+#define SPIIPLUS_SNAPSHOT_E2OFFS	9
+#define SPIIPLUS_SNAPSHOT_E_AOFFS	10
+#define SPIIPLUS_SNAPSHOT_AST		11
+#define SPIIPLUS_SNAPSHOT_MST		12
+#define SPIIPLUS_SNAPSHOT_FAULT		13
+#define SPIIPLUS_SNAPSHOT_MFLAGS	14
+#define SPIIPLUS_SNAPSHOT_MFLAGSX	15
+#define SPIIPLUS_SNAPSHOT_XVEL		16
+#define SPIIPLUS_SNAPSHOT_XACC		17
+#define SPIIPLUS_SNAPSHOT_ACC		18
+#define SPIIPLUS_SNAPSHOT_DEC		19
+// TIME is written to the first column of the last row so the driver can detect a stopped program
+#define SPIIPLUS_SNAPSHOT_TIME		20
+#define SPIIPLUS_SNAPSHOT_ROWS		21
+
+// Profile execution modes (SPIIPLUS_PROFILE_EXEC_MODE)
+#define SPIIPLUS_PROFILE_EXEC_POINT	0
+#define SPIIPLUS_PROFILE_EXEC_UPLOAD	1
+#define SPIIPLUS_PROFILE_EXEC_MPOINT	2
+// Profile segment modes (SPIIPLUS_PROFILE_SEGMENT_MODE)
+#define SPIIPLUS_PROFILE_SEGMENT_LINEAR	0
+#define SPIIPLUS_PROFILE_SEGMENT_SPLINE	1
+// Profile ramp modes (SPIIPLUS_PROFILE_RAMP_MODE)
+#define SPIIPLUS_PROFILE_RAMP_LINEAR	0
+#define SPIIPLUS_PROFILE_RAMP_SCURVE	1
+// Peak acceleration of an S-curve ramp relative to a linear ramp of the same duration
+#define SPIIPLUS_SCURVE_PEAK_ACCEL	1.5
+// Profile readback modes (SPIIPLUS_PROFILE_READBACK_MODE)
+#define SPIIPLUS_PROFILE_READBACK_FINAL		0
+#define SPIIPLUS_PROFILE_READBACK_INCREMENTAL	1
+// Minimum period (s) between incremental reads of the data collection arrays
+#define SPIIPLUS_READBACK_PERIOD	0.5
+// Ramp segments last at least this many controller cycles (CTIME)
+#define SPIIPLUS_MIN_SEGMENT_CYCLES	2
+// Size of the controller's PATH point buffer, used until the depth is read from GSFREE
+#define SPIIPLUS_PATH_BUFFER_SIZE	50
+// The point buffer is refilled when the motion it holds drains to this fraction
+#define SPIIPLUS_REFILL_WATERMARK	0.5
+// Limits of the period between point buffer refills (s)
+#define SPIIPLUS_REFILL_MIN_PERIOD	0.005
+#define SPIIPLUS_REFILL_MAX_PERIOD	0.1
+// Maximum number of POINT commands sent in one write
+#define SPIIPLUS_POINT_BATCH_SIZE	10
+// The upload mode stores the profile in global arrays that a feeder program passes to PATH
+#define SPIIPLUS_PROFILE_LABEL		"EPICS_PROFILE"
+#define SPIIPLUS_PROFILE_DATA_VAR	"EPICS_PROFILE_DATA"
+#define SPIIPLUS_PROFILE_LOADED_VAR	"EPICS_PROFILE_LOADED"
+// runProfile sets the slot and the number of points of the profile the feeder program passes to PATH
+#define SPIIPLUS_PROFILE_SLOT_VAR	"EPICS_PROFILE_SLOT"
+#define SPIIPLUS_PROFILE_SIZE_VAR	"EPICS_PROFILE_SIZE"
+// The pulse positions of the array pulse mode (the slot number is appended, like SPIIPLUS_PROFILE_DATA_VAR)
+#define SPIIPLUS_PULSE_VAR		"pulsePos"
+// The MPOINT mode writes each refill to this matrix (one point per column, the last row is the time)
+#define SPIIPLUS_PROFILE_MPOINT_VAR	"EPICS_PROFILE_MPOINT"
+// Maximum number of segments of the transition between chained profiles
+#define SPIIPLUS_MAX_TRANSITION_SEGMENTS	(2*MAX_ACCEL_SEGMENTS)
+
+// ACC/DEC are written with 6 significant digits, so polled values only match to this relative tolerance
+#define SPIIPLUS_MOTION_PARAM_TOLERANCE	1.0e-5
+
+// Default tiered poll schedule (see SPiiPlusConfigPolling)
+#define SPIIPLUS_SLOW_POLL_DIVISOR	10
+#define SPIIPLUS_ON_DEMAND_POLL_DIVISOR	10
+// Cost of an extra query, expressed as bytes of array data, used to decide whether to merge axis ranges
+#define SPIIPLUS_POLL_ROUND_TRIP_BYTES	256
+
 // The following values need to match the homingMethod mbbo record
 #define MBBO_HOME_NONE			0
 #define MBBO_HOME_LIMIT_INDEX		1
@@ -98,6 +188,12 @@
 #define SPIIPLUS_AXIS_STATUS_DECOMPON   1<<26
 #define SPIIPLUS_AXIS_STATUS_INSHAPE    1<<27
 #define SPIIPLUS_AXIS_STATUS_ENCPROC    1<<29
+//
+#define SPIIPLUS_MOTOR_STATUS_ENABLED   1<<0
+#define SPIIPLUS_MOTOR_STATUS_OPEN      1<<1
+#define SPIIPLUS_MOTOR_STATUS_INPOS     1<<4
+#define SPIIPLUS_MOTOR_STATUS_MOVE      1<<5
+#define SPIIPLUS_MOTOR_STATUS_ACC       1<<6
 
 
 // drvInfo strings for extra parameters that the ACS controller supports
@@ -159,6 +255,19 @@
 #define SPiiPlusPOUTSBitCodeString             "SPIIPLUS_POUTS_BIT_CODE"
 #define SPiiPlusPulseWidthString               "SPIIPLUS_PULSE_WIDTH"
 //
+#define SPiiPlusProfileExecModeString          "SPIIPLUS_PROFILE_EXEC_MODE"
+#define SPiiPlusProfileSegmentModeString       "SPIIPLUS_PROFILE_SEGMENT_MODE"
+#define SPiiPlusProfileRampModeString          "SPIIPLUS_PROFILE_RAMP_MODE"
+#define SPiiPlusProfileRampPeriodString        "SPIIPLUS_PROFILE_RAMP_PERIOD"
+#define SPiiPlusProfileUnderrunsString         "SPIIPLUS_PROFILE_UNDERRUNS"
+#define SPiiPlusProfileStarvationsString       "SPIIPLUS_PROFILE_STARVATIONS"
+#define SPiiPlusProfileStreamBytesString       "SPIIPLUS_PROFILE_STREAM_BYTES"
+#define SPiiPlusProfileBuildTimeString         "SPIIPLUS_PROFILE_BUILD_TIME"
+#define SPiiPlusProfileReadbackModeString      "SPIIPLUS_PROFILE_READBACK_MODE"
+#define SPiiPlusProfileChainLengthString       "SPIIPLUS_PROFILE_CHAIN_LENGTH"
+#define SPiiPlusProfileChainedString           "SPIIPLUS_PROFILE_CHAINED"
+#define SPiiPlusProfileWaitLatencyString       "SPIIPLUS_PROFILE_WAIT_LATENCY"
+//
 #define SPiiPlusMFlagsString                   "SPIIPLUS_MFLAGS"
 #define SPiiPlusMFlagsXString                  "SPIIPLUS_MFLAGSX"
 //
@@ -169,6 +278,70 @@ struct SPiiPlusDrvUser_t {
     int              len;
 };
 
+/** One column of the point-major profile arena (a time, position or velocity per point) */
+class SPiiPlusProfileColumn
+{
+public:
+	SPiiPlusProfileColumn() : base_(NULL), stride_(0) {}
+	void attach(double *base, size_t stride) { base_ = base; stride_ = stride; }
+	double& operator[](size_t point) { return base_[point*stride_]; }
+	const double& operator[](size_t point) const { return base_[point*stride_]; }
+	
+private:
+	double *base_;
+	size_t stride_;
+};
+
+/*
+ * The products of a build that executing it needs.  A successful build is published to one of
+ * two slots, each with its own arena and controller variables, so the next profile can be built
+ * and sent to the controller while the profile in the other slot is executed.
+ */
+class SPiiPlusProfileSlot
+{
+public:
+	SPiiPlusProfileSlot() : index(0), arena(NULL), stride(0), size(0), numAccelSegments(0), numDecelSegments(0),
+	                        pulseStartPos(0.0), pulseEndPos(0.0), pulseSpacing(0.0), dataCollectionInterval(0.0),
+	                        segmentMode(0), moveMode(0), execMode(0), numPoints(0), numPulses(0), startPulses(0),
+	                        endPulses(0), pulseMode(0), pulseAxis(0), uploaded(false), uploadCols(0), hash(0), hashValid(false) {}
+	double time(int point) const { return arena[point*stride]; }
+	double position(int j, int point) const { return arena[point*stride + 1 + j]; }
+	
+	int index;                                   /**< Suffix of the controller variables of the slot */
+	char pulseVar[MAX_FRAME_VAR_LEN];            /**< Pulse positions of the array pulse mode */
+	char dataVar[MAX_FRAME_VAR_LEN];             /**< Uploaded profile matrix */
+	std::vector <int> axes;
+	double *arena;                               /**< Rows of the full profile (see layoutProfileArena) */
+	size_t stride;
+	int size;                                    /**< Points in the full profile */
+	int numAccelSegments;
+	int numDecelSegments;
+	std::vector <double> startPos;               /**< Position of each profile axis before the acceleration */
+	std::vector <double> flybackPos;             /**< Position of each profile axis after the profile */
+	std::vector <double> origin;                 /**< Position of each profile axis before the move to the start (set by runProfile) */
+	double pulseStartPos;                        /**< From the start position of the pulse axis in relative profiles */
+	double pulseEndPos;
+	double pulseSpacing;
+	std::vector <double> relativePulses;         /**< Pulse positions of a relative profile in the array pulse mode */
+	double dataCollectionInterval;
+	int segmentMode;
+	int moveMode;                                /**< The parameters the profile was built with */
+	int execMode;
+	int numPoints;
+	int numPulses;
+	int startPulses;
+	int endPulses;
+	int pulseMode;
+	int pulseAxis;
+	std::vector <char> pointStream;              /**< POINT commands of the point execution mode */
+	std::vector <size_t> pointStreamOffsets;
+	std::vector <std::string> feederProgram;     /**< Feeder program of the upload execution mode */
+	bool uploaded;                               /**< dataVar holds the profile */
+	int uploadCols;                              /**< Columns of the declared dataVar (0 if not declared or to be redeclared) */
+	uint64_t hash;                               /**< Hash of the build inputs (see hashProfile) */
+	bool hashValid;                              /**< The slot (and its controller variables) hold the build with this hash */
+};
+
 class epicsShareClass SPiiPlusAxis : public asynMotorAxis
 {
 public:
@@ -183,7 +356,7 @@ public:
 	asynStatus setPosition(double position);
 	asynStatus setClosedLoop(bool closedLoop);
 	asynStatus defineProfile(double *positions, size_t numPoints);
-	asynStatus readbackProfile(size_t numPoints);
+	asynStatus readbackProfile(size_t first, size_t last);
 	
 	asynStatus getMaxParams();
 	asynStatus updateFeedbackParams();
@@ -195,12 +368,16 @@ public:
 	asynStatus correctProfile(size_t numPoints);
 	
 private:
+	void appendAccelerationCommands(std::vector <std::string>& batch, double acceleration);
+	
+
 	SPiiPlusController *pC_;	/**< Pointer to the asynMotorController to which this axis belongs.
 				*   Abbreviated because it is used very frequently */
-	double profileAccelPositions_[MAX_ACCEL_SEGMENTS];  /**< Array of target positions for acceleration of profile moves */
-	double profileDecelPositions_[MAX_ACCEL_SEGMENTS];  /**< Array of target positions for deceleration of profile moves */
-	double *fullProfilePositions_;                      /**< Array of target positions for profile moves */
-	double *profilePositionsUser_;
+	std::vector <double> profileAccelPositions_;        /**< Array of target positions for acceleration of profile moves */
+	std::vector <double> profileDecelPositions_;        /**< Array of target positions for deceleration of profile moves */
+	SPiiPlusProfileColumn fullProfilePositions_;        /**< Target positions for profile moves (view of the profile arena) */
+	SPiiPlusProfileColumn fullProfileVelocities_;       /**< Velocities at the end of each segment of spline profiles (view of the profile arena) */
+	double *profilePositionsUser_;                      /**< This axis' slice of the controller's user position block */
 	double profilePreDistance_;
 	double profilePostDistance_;
 	double profileStartPos_;
@@ -223,6 +400,13 @@ private:
 	int hall_;			// MFLAGS, bit 27
 	double resolution_;		// STEPF
 	bool virtual_;			// Is virtual axis
+	bool deferredMove_;		// A move is waiting for deferred moves to be turned off
+	double deferredPosition_;	// SPiiPlus units
+	double deferredVelocity_;
+	double deferredAcceleration_;	// Motor record units
+	int deferredRelative_;
+	double cachedAcceleration_;	// Last ACC/DEC written by the driver (SPiiPlus units)
+	bool accelerationCached_;	// ACC/DEC on the controller still equal cachedAcceleration_
 	
 friend class SPiiPlusController;
 };
@@ -242,6 +426,7 @@ public:
 	SPiiPlusAxis* getAxis(asynUser* pasynUser);
 	SPiiPlusAxis* getAxis(int axisNo);
 	asynStatus poll();
+	asynStatus setDeferredMoves(bool deferMoves);
 	void report(FILE *fp, int level);
 	
 	/* These are functions for profile moves */
@@ -256,10 +441,12 @@ public:
 	void assembleFullProfile(int numPoints);
 	void sanityCheckProfile();
 	void createAccDecTimes(double preTimeMax, double postTimeMax);
-	void createAccDecPositions(SPiiPlusAxis* axis, int moveMode, int numPoints, double preTimeMax, double postTimeMax, double preVelocity, double postVelocity);
+	void createAccDecPositions(SPiiPlusAxis* axis, int moveMode, int numPoints, double preTimeMax, double postTimeMax, double preVelocity, double postVelocity, int rampMode);
 	asynStatus definePulses(int pulseAxis, int moveMode, size_t numPulses);
 	asynStatus runProfile();
-	int getNumAccelSegments(double time);
+	int getNumAccelSegments(double time, double rampPeriod);
+	double rampDistance(double fraction, bool decel, int rampMode);
+	bool validateProfile(int moveMode, int numPoints, int segmentMode, char *message);
 	long int calculateCurrentPulse(int currentPoint, int startPulse, int endPulse, int numPulses, int pulseMode);
 	asynStatus readGlobalIntVar(asynUser *pasynUser, epicsInt32 *value);
 	asynStatus writeGlobalIntVar(asynUser *pasynUser, epicsInt32 value);
@@ -267,6 +454,10 @@ public:
 	asynStatus writeGlobalRealVar(asynUser *pasynUser, epicsFloat64 value);
 	asynStatus startProgram(asynUser *pasynUser, epicsFloat64 value);
 	asynStatus stopProgram(asynUser *pasynUser, epicsFloat64 value);
+	asynStatus configSnapshot(int buffer);
+	asynStatus configBinaryPort(const char *asynPortName);
+	asynStatus configPolling(int slowPollDivisor, int onDemandPollDivisor, int roundTripBytes);
+	asynStatus configProfileBuffer(int buffer);
 	
 protected:
 	SPiiPlusAxis **pAxes_;       /**< Array of pointers to axis objects */
@@ -334,6 +525,19 @@ protected:
 	int SPiiPlusPOUTSBitCode_;
 	int SPiiPlusPulseWidth_;
 	//
+	int SPiiPlusProfileExecMode_;
+	int SPiiPlusProfileSegmentMode_;
+	int SPiiPlusProfileRampMode_;
+	int SPiiPlusProfileRampPeriod_;
+	int SPiiPlusProfileUnderruns_;
+	int SPiiPlusProfileStarvations_;
+	int SPiiPlusProfileStreamBytes_;
+	int SPiiPlusProfileBuildTime_;
+	int SPiiPlusProfileReadbackMode_;
+	int SPiiPlusProfileChainLength_;
+	int SPiiPlusProfileChained_;
+	int SPiiPlusProfileWaitLatency_;
+	//
 	int SPiiPlusMFlags_;
 	int SPiiPlusMFlagsX_;
 	//
@@ -344,9 +548,18 @@ protected:
 private:
 	SPiiPlusDrvUser_t *drvUser_;                          /** Drv user structure */
 	bool initialized_;                                    /** If initialized successfully */
-	double profileAccelTimes_[MAX_ACCEL_SEGMENTS];        /**< Array of times per profile acceleration point */
-	double profileDecelTimes_[MAX_ACCEL_SEGMENTS];        /**< Array of times per profile deceleration point */
-	double *fullProfileTimes_;                            /**< Array of times per profile point */
+	std::vector <double> profileAccelTimes_;              /**< Array of times per profile acceleration point */
+	std::vector <double> profileDecelTimes_;              /**< Array of times per profile deceleration point */
+	std::vector <double> checkTimes_;                     /**< Padded segment times used by validateProfile */
+	std::vector <double> checkPositions_;                 /**< Absolute positions of one axis used by validateProfile */
+	std::vector <double> checkVelocities_;                /**< Segment velocities of one axis used by validateProfile */
+	std::vector <double> checkAccelerations_;             /**< Accelerations at the points of one axis used by validateProfile */
+	int profileRampMode_;                                 /**< Ramp mode of the last successful build */
+	double profileRampPeriod_;                            /**< Minimum duration (s) of a ramp segment in the last successful build */
+	SPiiPlusProfileColumn fullProfileTimes_;              /**< Times per profile point (view of the profile arena) */
+	double *profileArena_;                                /**< Arena of the slot being built: time, positions and velocities of the profile axes per row */
+	size_t profileArenaStride_;                           /**< Row length of profileArena_ for the current build */
+	double *profileUserPositions_;                        /**< User-specified positions of all axes, maxProfilePoints_ per axis */
 	int fullProfileSize_;
 	std::string axesToString(std::vector <int> axes);
 	std::string motorsToString(std::vector <int> axes);
@@ -354,13 +567,47 @@ private:
 	std::string accelPositionsToString(int positionIndex);
 	std::string decelPositionsToString(int positionIndex);
 	asynStatus waitMotors();
+	bool waitAxisState(int pegAxis);
 	void calculateDataCollectionInterval();
 	asynStatus stopDataCollection();
+	int dcChannels();
+	int dcChannelAxes(int channel, int *firstAxis);
+	const char *dcPositionSource(int axis);
 	asynStatus stopPEG(int pulseAxis);
+	asynStatus uploadProfile(SPiiPlusProfileSlot *slot, char *message);
+	void publishProfile(SPiiPlusProfileSlot *slot);
+	bool canChainProfile(const SPiiPlusProfileSlot *from, const SPiiPlusProfileSlot *to);
+	int buildTransition(const SPiiPlusProfileSlot *from, const SPiiPlusProfileSlot *to);
+	asynStatus armPEG(const SPiiPlusProfileSlot *slot, double pulseWidth, double pulseOrigin);
+	double profileDisplacement(const SPiiPlusProfileSlot *slot, int axis);
+	double profileOrigin(int axis);
+	void calculateSplineVelocities(int moveMode);
+	void buildPointStream(int segmentMode);
+	asynStatus sendPoints(int first, int count, int execMode);
+	asynStatus sendPointStream(const std::vector <char>& stream, const std::vector <size_t>& offsets, int first, int count);
+	asynStatus declareMpointMatrix();
+	void layoutProfileArena();
+	uint64_t hashProfile(const double *settings, int numSettings, int moveMode, int numPoints, int pulseAxis, int numPulses);
+	asynStatus sendMatrixPoints(int first, int count);
+	asynStatus readSamples(int last);
+	void updateReadbacks(epicsTimeStamp *lastRead, bool force);
+	double bufferedTime(int first, int last);
 	asynStatus test();
+	asynStatus pollVariables();
+	asynStatus pollSnapshot();
+	asynStatus pollDoubleArray(epicsFloat64 *output, const char *var);
+	asynStatus pollIntegerArray(epicsInt32 *output, const char *var);
+	void setAxisActive(int axis);
+	void updatePollRanges();
+	void validateMotionParams(int firstAxis, int lastAxis);
+	void invalidateMotionParams();
 	char firmwareVersion_[MAX_MESSAGE_LEN];
 	
 	epicsEventId profileExecuteEvent_;
+	epicsEventId axisStateEvent_;                         /**< Signaled by the polls when the done or PEGREADY state of an axis changes */
+	epicsTimeStamp axisStateTime_;                        /**< Time axisStateEvent_ was last signaled */
+	bool axisStatePolled_;                                /**< A poll has started since the profile phase wait began */
+	double waitLatency_;                                  /**< Largest delay between a signal of axisStateEvent_ and the wait ending in this execution */
 	std::vector <int> profileAxes_;
 	int numAccelSegments_;
 	int numDecelSegments_;
@@ -383,6 +630,8 @@ private:
 	epicsFloat64 absoluteEncoder2Offset_[SPIIPLUS_MAX_AXES];
 	epicsFloat64 maxVelocity_[SPIIPLUS_MAX_AXES];
 	epicsFloat64 maxAcceleration_[SPIIPLUS_MAX_AXES];
+	epicsFloat64 acceleration_[SPIIPLUS_MAX_AXES];
+	epicsFloat64 deceleration_[SPIIPLUS_MAX_AXES];
 	epicsInt32 motorFlags_[SPIIPLUS_MAX_AXES];
 	epicsInt32 motorFlagsX_[SPIIPLUS_MAX_AXES];
 	epicsInt32 faultStatus_[SPIIPLUS_MAX_AXES];
@@ -393,10 +642,59 @@ private:
 	epicsInt32 encoderType_[SPIIPLUS_MAX_AXES];
 	epicsInt32 encoder2Type_[SPIIPLUS_MAX_AXES];
 	
+	int snapshotBuffer_;                                  /**< Buffer running the poll snapshot program (-1 = disabled) */
+	bool snapshotActive_;
+	double snapshotTime_;                                 /**< Last TIME written by the snapshot program */
+	epicsTimeStamp snapshotAdvanced_;                     /**< When snapshotTime_ last changed, or the last retry of a stopped program */
+	double snapshotStaleTime_;                            /**< Time without a new pass after which the program is taken to have stopped */
+	bool snapshotLoaded_;
+	epicsFloat64 snapshotData_[SPIIPLUS_SNAPSHOT_ROWS*SPIIPLUS_MAX_AXES];
+	
+	int slowPollDivisor_;                                 /**< Moving polls per slow-tier read */
+	int onDemandPollDivisor_;                             /**< Slow-tier reads per on-demand-tier read (0 = only on demand) */
+	int slowPollCounter_;
+	int onDemandPollCounter_;
+	bool slowPollRequested_;
+	bool onDemandPollRequested_;
+	bool pollWasMoving_;
+	unsigned long fastPollCount_;
+	unsigned long slowPollCount_;
+	unsigned long onDemandPollCount_;
+	
+	bool axisActive_[SPIIPLUS_MAX_AXES];                  /**< Axes with records or profile usage */
+	int roundTripBytes_;
+	bool pollRangesDirty_;
+	std::vector <std::pair<int,int> > pollRanges_;        /**< Contiguous axis ranges read by pollVariables */
+	
+	bool movesDeferred_;
+	
+	unsigned long accelerationWrites_;
+	unsigned long accelerationWritesSkipped_;
+	
 	size_t maxProfilePulses_;
 	double *profilePulses_;
 	double *profilePulsesUser_;
 	double *profilePulsePositions_;
+	bool readbackIncremental_;                            /**< The last profile was read back while it was executed */
+	int readbackCount_;                                   /**< Samples already read into (and converted in) the readback arrays */
+	int dcAxesPerChannel_;                                /**< Profile axes recorded by each data collection channel during the last execution */
+	int profileBuffer_;                                   /**< Buffer for the profile feeder program (-1 = upload mode unavailable) */
+	SPiiPlusProfileSlot profileSlots_[SPIIPLUS_PROFILE_SLOTS];
+	int nextSlot_;                                        /**< Slot of the last build, which the next execute runs (-1 = none) */
+	int execSlot_;                                        /**< Slot being executed (-1 = none) */
+	SPiiPlusProfileSlot *exec_;                           /**< profileSlots_[execSlot_] while runProfile runs */
+	std::vector <int> recordedAxes_;                      /**< Profile axes of the last execution, recorded by data collection */
+	std::vector <std::string> loadedFeeder_;              /**< The feeder program in profileBuffer_ */
+	unsigned long profileBuildsSkipped_;
+	int pathBufferSize_;                                  /**< Depth of the PATH point buffer, read when a profile starts */
+	int profileSegmentMode_;                              /**< Segment mode of the last successful build */
+	std::vector <char> pointStream_;                      /**< POINT commands of the current build, each followed by '\r' (see publishProfile) */
+	std::vector <size_t> pointStreamOffsets_;             /**< Start of each point's command in pointStream_, then its size */
+	std::vector <char> transitionStream_;                 /**< POINT commands of the transition between chained profiles */
+	std::vector <size_t> transitionOffsets_;              /**< Start of each command in transitionStream_, then its size */
+	std::vector <double> mpointMatrix_;                   /**< The points of one MPOINT refill, row-major */
+	int mpointRows_;                                      /**< Size of the declared MPOINT matrix (0 = not declared) */
+	int mpointCols_;
 	double pulseStartPos_;
 	double pulseSpacing_;
 	double pulseEndPos_;